@@ -0,0 +1,268 @@
+// benchmark.cpp
+// Implements CPU-side terrain query benchmarks reported in performance mode
+
+#include "benchmark.h"
+#include "height_sampler.h"
+#include "horizon_map.h"
+#include "job_system.h"
+#include "parallel.h"
+#include "path_planner.h"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Seconds elapsed since start
+static double
+secondsSince(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration<double>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+void runRaycastBenchmark(const Terrain &terrain, int rayCount) {
+  // Fixed seed so runs are comparable
+  std::mt19937 rng(1234);
+  float half = terrain.getWorldSize() / 2.0f;
+  std::uniform_real_distribution<float> position(-half, half);
+  std::uniform_real_distribution<float> altitude(12.0f, 30.0f);
+  std::uniform_real_distribution<float> slant(-1.0f, 1.0f);
+
+  std::vector<glm::vec3> origins(rayCount);
+  std::vector<glm::vec3> directions(rayCount);
+  for (int i = 0; i < rayCount; ++i) {
+    origins[i] = glm::vec3(position(rng), altitude(rng), position(rng));
+    directions[i] = glm::vec3(slant(rng), -1.0f, slant(rng));
+  }
+  std::vector<RaycastHit> hits(rayCount);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < rayCount; ++i) {
+    hits[i] = terrain.raycast(origins[i], directions[i]);
+  }
+  double singleTime = secondsSince(start);
+
+  start = std::chrono::high_resolution_clock::now();
+  terrain.raycastBatch(origins.data(), directions.data(), hits.data(),
+                       rayCount);
+  double batchTime = secondsSince(start);
+
+  int hitCount = 0;
+  for (const auto &hit : hits) {
+    hitCount += hit.hit ? 1 : 0;
+  }
+
+  std::cout << "Raycast Throughput (1 thread): "
+            << rayCount / singleTime / 1e6 << " Mrays/s" << std::endl;
+  std::cout << "Raycast Throughput (" << workerCount()
+            << " threads): " << rayCount / batchTime / 1e6 << " Mrays/s"
+            << " (" << hitCount << "/" << rayCount << " hit)" << std::endl;
+}
+
+void runViewshedBenchmark(const Terrain &terrain, int viewshedCount) {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> cell(0, terrain.getGridSize() - 1);
+  HeightGrid grid = terrain.getHeightGrid();
+  Viewshed viewshed;
+  long long visibleTotal = 0;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < viewshedCount; ++i) {
+    viewshed.compute(grid, cell(rng), cell(rng), 2.0f);
+    visibleTotal += viewshed.getVisibleCount();
+  }
+  double elapsed = secondsSince(start);
+
+  double vertexCount =
+      static_cast<double>(terrain.getGridSize()) * terrain.getGridSize();
+  std::cout << "Viewshed Time (" << terrain.getGridSize() << "x"
+            << terrain.getGridSize()
+            << " grid): " << elapsed / viewshedCount * 1000.0 << " ms"
+            << " (" << visibleTotal / viewshedCount / vertexCount * 100.0
+            << "% visible on average)" << std::endl;
+}
+
+void runPathPlanningBenchmark(const Terrain &terrain, int queryCount) {
+  auto start = std::chrono::high_resolution_clock::now();
+  PathPlanner planner;
+  planner.build(terrain.getHeightGrid());
+  double buildTime = secondsSince(start);
+  std::cout << "Path Planner Build Time: " << buildTime * 1000.0 << " ms ("
+            << planner.getAbstractNodeCount() << " entrance nodes)"
+            << std::endl;
+
+  // Same endpoints for every mode
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> cell(0, terrain.getGridSize() - 1);
+  std::vector<int> endpoints(queryCount * 4);
+  for (auto &coordinate : endpoints) {
+    coordinate = cell(rng);
+  }
+
+  const PathPlanner::Mode modes[] = {PathPlanner::Mode::AStar,
+                                     PathPlanner::Mode::ThetaStar,
+                                     PathPlanner::Mode::Hierarchical};
+  const char *names[] = {"A*", "Theta*", "HPA*"};
+  for (int m = 0; m < 3; ++m) {
+    int found = 0;
+    long long expanded = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < queryCount; ++i) {
+      const int *e = &endpoints[i * 4];
+      PathPlanner::Result result =
+          planner.findPath(e[0], e[1], e[2], e[3], modes[m]);
+      found += result.found ? 1 : 0;
+      expanded += result.expanded;
+    }
+    double elapsed = secondsSince(start);
+    std::cout << "Path Planning Latency (" << names[m]
+              << "): " << elapsed / queryCount * 1000.0 << " ms ("
+              << expanded / queryCount << " nodes expanded, " << found << "/"
+              << queryCount << " found)" << std::endl;
+  }
+}
+
+void runHeightSampleBenchmark(const Terrain &terrain, int sampleCount) {
+  std::mt19937 rng(1234);
+  float half = terrain.getWorldSize() / 2.0f;
+  std::uniform_real_distribution<float> position(-half, half);
+
+  std::vector<float> xs(sampleCount);
+  std::vector<float> zs(sampleCount);
+  for (int i = 0; i < sampleCount; ++i) {
+    xs[i] = position(rng);
+    zs[i] = position(rng);
+  }
+  std::vector<float> heights(sampleCount);
+
+  // Repeat so the timings are well above the clock resolution
+  const int passes = 20;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < passes; ++pass) {
+    for (int i = 0; i < sampleCount; ++i) {
+      heights[i] = terrain.sampleHeight(xs[i], zs[i]);
+    }
+  }
+  double singleTime = secondsSince(start);
+
+  start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < passes; ++pass) {
+    terrain.sampleHeights(xs.data(), zs.data(), heights.data(), sampleCount);
+  }
+  double batchTime = secondsSince(start);
+
+  double samples = static_cast<double>(sampleCount) * passes;
+  std::cout << "Height Sampling (scalar): " << samples / singleTime / 1e6
+            << " Msamples/s" << std::endl;
+  std::cout << "Height Sampling (batched, "
+            << (heightSamplerUsesAVX2() ? "AVX2" : "scalar fallback")
+            << "): " << samples / batchTime / 1e6 << " Msamples/s"
+            << std::endl;
+}
+
+void runRasterBenchmark(const Terrain &terrain, int buildCount) {
+  HeightGrid grid = terrain.getHeightGrid();
+  TerrainRasters rasters;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < buildCount; ++i) {
+    rasters.build(grid);
+  }
+  double elapsed = secondsSince(start);
+
+  double samples = static_cast<double>(grid.gridSize) * grid.gridSize;
+  std::cout << "Slope/Aspect/Curvature Generation: "
+            << samples * buildCount / elapsed / 1e6 << " Msamples/s ("
+            << elapsed / buildCount * 1000.0 << " ms per build)" << std::endl;
+}
+
+void runHorizonMapBenchmark(const Terrain &terrain, int buildCount) {
+  HeightGrid grid = terrain.getHeightGrid();
+  const int directionCounts[] = {8, 16, 32};
+  for (int directions : directionCounts) {
+    HorizonMap horizonMap;
+    double total = 0.0;
+    for (int i = 0; i < buildCount; ++i) {
+      horizonMap.build(grid, directions);
+      total += horizonMap.getBuildTime();
+    }
+    std::cout << "Horizon Map (" << directions
+              << " directions): " << total / buildCount << " ms per build, "
+              << horizonMap.getTextureBytes() / 1024 << " KB ("
+              << horizonMap.getLayerCount() << " RGBA8 layers)" << std::endl;
+  }
+}
+
+void runJobScalingBenchmark(const Terrain &terrain, int repeatCount) {
+  int gridSize = terrain.getGridSize();
+  size_t vertexCount = static_cast<size_t>(gridSize) * gridSize;
+  std::vector<float> vertices(vertexCount * 3), normals(vertexCount * 3);
+  std::vector<float> heights(vertexCount);
+  std::vector<unsigned int> indices(static_cast<size_t>(gridSize - 1) *
+                                    (gridSize - 1) * 6);
+
+  struct Stage {
+    const char *name;
+    std::function<void(JobSystem &)> run;
+  };
+  std::vector<Stage> stages;
+  if (terrain.hasHeightmap()) {
+    stages.push_back({"Vertices", [&](JobSystem &jobs) {
+                        terrain.generateVertices(jobs, vertices.data(),
+                                                 heights.data());
+                      }});
+  } else {
+    std::cout << "Job Scaling: vertex stage skipped (mesh loaded from "
+                 "cache, run with --no-mesh-cache)"
+              << std::endl;
+  }
+  stages.push_back({"Indices", [&](JobSystem &jobs) {
+                      terrain.generateIndices(jobs, indices.data());
+                    }});
+  stages.push_back({"Normals", [&](JobSystem &jobs) {
+                      terrain.calculateNormals(jobs, normals.data());
+                    }});
+
+  // 1, 2, 4, ... threads, ending at the hardware thread count
+  std::vector<int> threadCounts;
+  for (int threads = 1; threads < workerCount(); threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(workerCount());
+
+  // times[stage][thread count index], in ms per run
+  std::vector<std::vector<double>> times(stages.size());
+  for (int threads : threadCounts) {
+    JobSystem jobs(threads);
+    for (size_t i = 0; i < stages.size(); ++i) {
+      stages[i].run(jobs); // Warm up the workers and caches
+      auto start = std::chrono::high_resolution_clock::now();
+      for (int r = 0; r < repeatCount; ++r) {
+        stages[i].run(jobs);
+      }
+      times[i].push_back(secondsSince(start) / repeatCount * 1000.0);
+    }
+  }
+
+  for (size_t i = 0; i < stages.size(); ++i) {
+    for (size_t t = 0; t < threadCounts.size(); ++t) {
+      std::cout << "Job Scaling - " << stages[i].name << " ("
+                << threadCounts[t]
+                << (threadCounts[t] == 1 ? " thread): " : " threads): ")
+                << times[i][t] << " ms (" << times[i][0] / times[i][t]
+                << "x)" << std::endl;
+    }
+  }
+}
+
+void runTerrainBenchmarks(const Terrain &terrain) {
+  std::cout << "Running terrain query benchmarks..." << std::endl;
+  runRaycastBenchmark(terrain, 200000);
+  runViewshedBenchmark(terrain, 100);
+  runPathPlanningBenchmark(terrain, 20);
+  runRasterBenchmark(terrain, 200);
+  runHorizonMapBenchmark(terrain, 5);
+  runHeightSampleBenchmark(terrain, 50000);
+  runJobScalingBenchmark(terrain, 20);
+}
@@ -0,0 +1,43 @@
+// benchmark.h
+// Declares CPU-side terrain query benchmarks reported in performance mode
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "terrain.h"
+
+// Cast rayCount random downward rays and report rays per second, both on the
+// calling thread and through the batched multithreaded path
+void runRaycastBenchmark(const Terrain &terrain, int rayCount);
+
+// Compute viewshedCount viewsheds from random observers and report the
+// average time per viewshed at the terrain's grid size
+void runViewshedBenchmark(const Terrain &terrain, int viewshedCount);
+
+// Build the path planner and plan queryCount routes between random points
+// across the whole terrain with each planning mode, reporting build time and
+// average latency per query
+void runPathPlanningBenchmark(const Terrain &terrain, int queryCount);
+
+// Sample sampleCount random world positions one at a time and through the
+// batched path, reporting samples per second for each
+void runHeightSampleBenchmark(const Terrain &terrain, int sampleCount);
+
+// Rebuild the slope/aspect/curvature rasters buildCount times and report
+// generation throughput in megasamples per second
+void runRasterBenchmark(const Terrain &terrain, int buildCount);
+
+// Build the horizon map with 8, 16 and 32 directions, buildCount times
+// each, and report the average build time and texture size per direction
+// count
+void runHorizonMapBenchmark(const Terrain &terrain, int buildCount);
+
+// Time each mesh generation stage on job systems of 1, 2, 4, ... up to the
+// hardware thread count, averaged over repeatCount runs, and report the
+// speedup over one thread
+void runJobScalingBenchmark(const Terrain &terrain, int repeatCount);
+
+// Run every terrain query benchmark and print the results
+void runTerrainBenchmarks(const Terrain &terrain);
+
+#endif // BENCHMARK_H
@@ -2,11 +2,14 @@
 // Implements the Camera class methods
 
 #include "camera.h"
+#include "terrain.h"
+#include <algorithm>
 
 Camera::Camera(glm::vec3 position, glm::vec3 up, float yaw, float pitch,
                float sensitivity)
     : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(2.5f),
-      MouseSensitivity(sensitivity) {
+      MouseSensitivity(sensitivity), FollowTerrain(false),
+      GroundClearance(1.5f), LookAhead(1.0f), terrain(nullptr) {
   Position = position;
   WorldUp = up;
   Yaw = yaw;
@@ -22,16 +25,65 @@ void Camera::ProcessKeyboard(float deltaTime, bool forward, bool backward,
                              bool left, bool right) {
   // Calculate the velocity based on movement speed and delta time
   float velocity = MovementSpeed * deltaTime;
+  glm::vec3 start = Position;
+
+  // Following the terrain, move along the ground plane at full speed
+  // whatever the pitch; the altitude comes from the terrain
+  glm::vec3 moveFront = Front;
+  glm::vec3 moveRight = Right;
+  if (FollowTerrain && terrain) {
+    moveFront = glm::normalize(glm::vec3(Front.x, 0.0f, Front.z));
+    moveRight = glm::normalize(glm::vec3(Right.x, 0.0f, Right.z));
+  }
 
   // Update camera position based on input
   if (forward)
-    Position += Front * velocity;
+    Position += moveFront * velocity;
   if (backward)
-    Position -= Front * velocity;
+    Position -= moveFront * velocity;
   if (left)
-    Position -= Right * velocity;
+    Position -= moveRight * velocity;
   if (right)
-    Position += Right * velocity;
+    Position += moveRight * velocity;
+
+  if (FollowTerrain && terrain)
+    followTerrain(start);
+}
+
+void Camera::SetTerrain(const Terrain *terrain) { this->terrain = terrain; }
+
+void Camera::SetFollowTerrain(bool follow) {
+  FollowTerrain = follow;
+  if (FollowTerrain && terrain)
+    followTerrain(Position);
+}
+
+void Camera::followTerrain(const glm::vec3 &from) {
+  // Altitude comes from the terrain, so only the horizontal part of the move
+  // is kept
+  glm::vec2 move(Position.x - from.x, Position.z - from.z);
+
+  // O(1) bilinear lookup for the ground under the new position
+  float ground = terrain->sampleHeight(Position.x, Position.z);
+  float altitude = ground + GroundClearance;
+
+  // A fast move can step over a ridge between two ground samples. Bound the
+  // terrain over the box swept by the move plus LookAhead in the direction
+  // of travel and keep at least half the clearance above its highest point,
+  // which also starts the climb before reaching rising ground.
+  float length = glm::length(move);
+  glm::vec2 ahead(Position.x, Position.z);
+  if (length > 0.0f)
+    ahead = ahead + move / length * LookAhead;
+  float minHeight, maxHeight;
+  if (terrain->getHeightRange(
+          std::min(from.x, ahead.x), std::min(from.z, ahead.y),
+          std::max(from.x, ahead.x), std::max(from.z, ahead.y), minHeight,
+          maxHeight)) {
+    altitude = std::max(altitude, maxHeight + 0.5f * GroundClearance);
+  }
+
+  Position.y = altitude;
 }
 
 void Camera::ProcessMouseMovement(float xoffset, float yoffset) {
@@ -8,6 +8,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
+class Terrain;
+
 class Camera {
 public:
   // Constructor
@@ -20,6 +22,11 @@ public:
                        bool right);
   void ProcessMouseMovement(float xoffset, float yoffset);
 
+  // Terrain-following mode: movement becomes horizontal and the camera holds
+  // GroundClearance above the surface
+  void SetTerrain(const Terrain *terrain);
+  void SetFollowTerrain(bool follow);
+
   // Camera attributes
   glm::vec3 Position;
   glm::vec3 Front;
@@ -35,7 +42,17 @@ public:
   float MovementSpeed;
   float MouseSensitivity;
 
+  // Terrain-following options
+  bool FollowTerrain;
+  float GroundClearance; // Height held above the interpolated ground
+  float LookAhead;       // Distance past each move checked for rising terrain
+
 private:
+  const Terrain *terrain;
+
+  // Place the camera above the terrain after a move that started at from
+  void followTerrain(const glm::vec3 &from);
+
   // Updates the camera's internal vectors based on the Euler angles
   void updateCameraVectors();
 };
@@ -0,0 +1,175 @@
+#version 430
+
+// Frustum and Hi-Z occlusion test and level of detail selection of every
+// terrain chunk (see chunk_culling.h). A chunk is drawn as its interior and
+// four edge strips, each strip refined to the level of a finer neighbour.
+// Visible chunks append their non-empty commands and bump the draw count,
+// or, without a GPU draw count, every chunk rewrites its own kDrawnParts
+// commands with an instance count of one or zero.
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+const int kMaxLods = 4;
+const int kChunkCommands = 1 + 4 * kMaxLods;
+const int kDrawnParts = 5;
+
+layout(std430, binding = 8) readonly buffer BoundsBuffer {
+    // World space min corner with the chunk's coarsest level in w, then the
+    // max corner, per chunk
+    vec4 bounds[];
+};
+
+// kChunkCommands per chunk per level of detail, level-major
+layout(std430, binding = 9) readonly buffer ChunkCommandBuffer {
+    DrawCommand chunkCommands[];
+};
+
+layout(std430, binding = 10) writeonly buffer CommandBuffer {
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 11) buffer StatsBuffer {
+    uint frustumCulled;
+    uint occluded;
+    uint drawn[kMaxLods];
+};
+
+layout(std430, binding = 12) buffer DrawCountBuffer {
+    uint drawCount;
+};
+
+// Farthest window depth per texel; level 0 matches the viewport
+layout(binding = 0) uniform sampler2D pyramidMap;
+
+uniform mat4 viewProjection;
+uniform vec3 eye; // World space camera position
+uniform uint chunkCount;
+uniform uint columnCount; // Chunks per row
+uniform int lodCount;
+uniform float lodDistance; // Where level 1 starts; each level doubles it
+uniform bool compact;
+uniform bool occlusionTest;
+uniform int levelCount; // Pyramid levels
+
+// True when the bounds are behind the pyramid
+bool isOccluded(vec3 ndcMin, vec3 ndcMax) {
+    // The level where the rectangle spans at most 2x2 texels
+    vec2 viewport = vec2(textureSize(pyramidMap, 0));
+    ivec2 pixelMin = ivec2(clamp((ndcMin.xy * 0.5 + 0.5) * viewport,
+                                 vec2(0.0), viewport - 1.0));
+    ivec2 pixelMax = ivec2(clamp((ndcMax.xy * 0.5 + 0.5) * viewport,
+                                 vec2(0.0), viewport - 1.0));
+    int level = 0;
+    while (level < levelCount - 1 &&
+           any(greaterThan((pixelMax >> level) - (pixelMin >> level),
+                           ivec2(1)))) {
+        ++level;
+    }
+    ivec2 last = textureSize(pyramidMap, level) - 1;
+    ivec2 t0 = min(pixelMin >> level, last);
+    ivec2 t1 = min(pixelMax >> level, last);
+    float farthest =
+        max(max(texelFetch(pyramidMap, t0, level).r,
+                texelFetch(pyramidMap, ivec2(t1.x, t0.y), level).r),
+            max(texelFetch(pyramidMap, ivec2(t0.x, t1.y), level).r,
+                texelFetch(pyramidMap, t1, level).r));
+    return ndcMin.z * 0.5 + 0.5 > farthest;
+}
+
+// Level by the distance from the eye to the bounds, capped by the chunk's
+// coarsest level. Neighbours evaluate it the same way for each other.
+int chunkLod(uint chunk) {
+    vec4 lo = bounds[2 * chunk];
+    vec3 hi = bounds[2 * chunk + 1].xyz;
+    float distance = length(max(max(lo.xyz - eye, eye - hi), vec3(0.0)));
+    int lod = 0;
+    if (distance >= lodDistance && lodDistance > 0.0)
+        lod = int(log2(distance / lodDistance)) + 1;
+    return min(lod, min(lodCount - 1, int(lo.w)));
+}
+
+void main() {
+    uint chunk = gl_GlobalInvocationID.x;
+    if (chunk >= chunkCount) return;
+    vec3 lo = bounds[2 * chunk].xyz;
+    vec3 hi = bounds[2 * chunk + 1].xyz;
+
+    // Outside the frustum when every corner is beyond the same clip plane.
+    // The screen rectangle and nearest depth only hold when every corner is
+    // in front of the eye.
+    ivec3 below = ivec3(0);
+    ivec3 above = ivec3(0);
+    bool behindEye = false;
+    vec3 ndcMin = vec3(1.0e30);
+    vec3 ndcMax = vec3(-1.0e30);
+    for (int corner = 0; corner < 8; ++corner) {
+        vec3 point = vec3((corner & 1) != 0 ? hi.x : lo.x,
+                          (corner & 2) != 0 ? hi.y : lo.y,
+                          (corner & 4) != 0 ? hi.z : lo.z);
+        vec4 clip = viewProjection * vec4(point, 1.0);
+        below += ivec3(lessThan(clip.xyz, vec3(-clip.w)));
+        above += ivec3(greaterThan(clip.xyz, vec3(clip.w)));
+        if (clip.w <= 0.0) {
+            behindEye = true;
+        } else {
+            ndcMin = min(ndcMin, clip.xyz / clip.w);
+            ndcMax = max(ndcMax, clip.xyz / clip.w);
+        }
+    }
+
+    bool visible = all(lessThan(below, ivec3(8))) &&
+                   all(lessThan(above, ivec3(8)));
+    if (!visible) {
+        atomicAdd(frustumCulled, 1u);
+    } else if (occlusionTest && !behindEye && isOccluded(ndcMin, ndcMax)) {
+        visible = false;
+        atomicAdd(occluded, 1u);
+    }
+
+    // The interior, then each edge at the level of the neighbour across it
+    // when that one is finer (-z, +z, -x, +x; none past the grid's border)
+    int lod = chunkLod(chunk);
+    uint column = chunk % columnCount;
+    uint rows = (chunkCount + columnCount - 1u) / columnCount;
+    uint row = chunk / columnCount;
+    bool hasNeighbour[4] = bool[4](row > 0u, row + 1u < rows, column > 0u,
+                                   column + 1u < columnCount);
+    uint neighbour[4] = uint[4](chunk - columnCount, chunk + columnCount,
+                                chunk - 1u, chunk + 1u);
+    uint first = (uint(lod) * chunkCount + chunk) * uint(kChunkCommands);
+    DrawCommand parts[kDrawnParts];
+    parts[0] = chunkCommands[first];
+    uint partCount = parts[0].count > 0u ? 1u : 0u;
+    for (int edge = 0; edge < 4; ++edge) {
+        int edgeLod = lod;
+        if (hasNeighbour[edge] && neighbour[edge] < chunkCount)
+            edgeLod = min(lod, chunkLod(neighbour[edge]));
+        parts[1 + edge] =
+            chunkCommands[first + uint(1 + edge * kMaxLods + edgeLod)];
+        if (parts[1 + edge].count > 0u) ++partCount;
+    }
+
+    if (compact) {
+        if (!visible) return;
+        uint slot = atomicAdd(drawCount, partCount);
+        for (int part = 0; part < kDrawnParts; ++part) {
+            if (parts[part].count == 0u) continue;
+            parts[part].instanceCount = 1u;
+            commands[slot++] = parts[part];
+        }
+    } else {
+        for (int part = 0; part < kDrawnParts; ++part) {
+            parts[part].instanceCount = visible ? 1u : 0u;
+            commands[chunk * uint(kDrawnParts) + uint(part)] = parts[part];
+        }
+    }
+    if (visible) atomicAdd(drawn[lod], 1u);
+}
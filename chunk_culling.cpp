@@ -0,0 +1,310 @@
+// chunk_culling.cpp
+// Implements the occluder depth pass, the Hi-Z pyramid build, the chunk
+// culling dispatch and the indirect draw
+
+#include "chunk_culling.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+
+ChunkCulling::ChunkCulling(ShaderManager &shaders, GpuTimers &timers)
+    : shaders(shaders), timers(timers),
+      depthSection(timers.getSection("Occlusion depth")),
+      pyramidSection(timers.getSection("Occlusion Hi-Z build")),
+      cullSection(timers.getSection("Chunk culling")),
+      pyramidProgram(shaders.loadProgram(
+          "hiz_build", {{GL_COMPUTE_SHADER, "hiz_build.glsl"}})),
+      cullProgram(shaders.loadProgram(
+          "chunk_cull", {{GL_COMPUTE_SHADER, "chunk_cull.glsl"}})),
+      useDrawCount(GLEW_ARB_indirect_parameters), chunkCount(0),
+      columnCount(1), lodCount(0), lodDistance(0.0f), occlusionTest(true),
+      boundsBuffer(0), chunkCommandBuffer(0), commandBuffer(0),
+      drawCountBuffer(0), statsBuffers(), statsFences(), statsFrame(0),
+      framebuffer(0), depthTexture(0), pyramidTexture(0), width(0),
+      height(0), levelCount(0), total(), last(), statsCount(0) {
+  glGenBuffers(1, &boundsBuffer);
+  glGenBuffers(1, &chunkCommandBuffer);
+  glGenBuffers(1, &commandBuffer);
+  glGenBuffers(1, &drawCountBuffer);
+  glGenBuffers(kStatsLatency, statsBuffers);
+  for (GLuint buffer : statsBuffers) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Stats), nullptr,
+                 GL_DYNAMIC_READ);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glGenFramebuffers(1, &framebuffer);
+}
+
+ChunkCulling::~ChunkCulling() {
+  glDeleteBuffers(1, &boundsBuffer);
+  glDeleteBuffers(1, &chunkCommandBuffer);
+  glDeleteBuffers(1, &commandBuffer);
+  glDeleteBuffers(1, &drawCountBuffer);
+  glDeleteBuffers(kStatsLatency, statsBuffers);
+  for (GLsync fence : statsFences) {
+    if (fence)
+      glDeleteSync(fence);
+  }
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteTextures(1, &depthTexture);
+  glDeleteTextures(1, &pyramidTexture);
+}
+
+bool ChunkCulling::isAvailable() const {
+  return shaders.getProgram(pyramidProgram) != 0 &&
+         shaders.getProgram(cullProgram) != 0;
+}
+
+void ChunkCulling::setChunks(const std::vector<BoundingBox> &bounds,
+                             int columns, const std::vector<int> &maxLods,
+                             const std::vector<DrawCommand> &commands) {
+  chunkCount = static_cast<int>(bounds.size());
+  columnCount = columns > 0 ? columns : 1;
+  lodCount = chunkCount > 0 ? static_cast<int>(commands.size()) /
+                                  (chunkCount * kChunkCommands)
+                            : 0;
+  if (lodCount > kMaxLods)
+    lodCount = kMaxLods;
+  std::vector<glm::vec4> corners;
+  corners.reserve(bounds.size() * 2);
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    corners.push_back(
+        glm::vec4(bounds[i].min, static_cast<float>(maxLods[i])));
+    corners.push_back(glm::vec4(bounds[i].max, 0.0f));
+  }
+  // Every chunk's level 0 interior, with its (empty) level 0 edges
+  std::vector<DrawCommand> visible;
+  visible.reserve(static_cast<size_t>(chunkCount) * kDrawnParts);
+  for (int i = 0; i < chunkCount; ++i) {
+    const DrawCommand *chunk = &commands[i * kChunkCommands];
+    visible.push_back(chunk[0]);
+    for (int edge = 0; edge < 4; ++edge) {
+      visible.push_back(chunk[1 + edge * kMaxLods]);
+    }
+  }
+  for (DrawCommand &command : visible) {
+    command.instanceCount = 1;
+  }
+  GLuint drawCount = static_cast<GLuint>(visible.size());
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, corners.size() * sizeof(glm::vec4),
+               corners.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunkCommandBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               static_cast<size_t>(lodCount) * chunkCount * kChunkCommands *
+                   sizeof(DrawCommand),
+               commands.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, visible.size() * sizeof(DrawCommand),
+               visible.data(), GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &drawCount,
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// (Re)allocate the occluder depth buffer and a full mip chain of the
+// pyramid at width x height
+void ChunkCulling::resize(int width, int height) {
+  this->width = width;
+  this->height = height;
+  levelCount = 1;
+  while ((std::max(width, height) >> levelCount) > 0) {
+    ++levelCount;
+  }
+
+  glDeleteTextures(1, &depthTexture);
+  glGenTextures(1, &depthTexture);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glDeleteTextures(1, &pyramidTexture);
+  glGenTextures(1, &pyramidTexture);
+  glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+  glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_R32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         depthTexture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Occlusion depth buffer is incomplete" << std::endl;
+  }
+}
+
+// Draw last frame's chunks depth only and reduce their depth into the
+// pyramid: level 0 copies the depth, each further level the one above
+void ChunkCulling::buildPyramid() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint previousFramebuffer;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  if (viewport[2] != width || viewport[3] != height)
+    resize(viewport[2], viewport[3]);
+
+  // Filled even in wireframe mode
+  timers.begin(depthSection);
+  GLint polygonMode[2];
+  glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glUseProgram(0);
+  draw();
+  glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+  timers.end(depthSection);
+
+  timers.begin(pyramidSection);
+  GLuint program = shaders.getProgram(pyramidProgram);
+  glUseProgram(program);
+  glActiveTexture(GL_TEXTURE0);
+  for (int level = 0; level < levelCount; ++level) {
+    int levelWidth = std::max(width >> level, 1);
+    int levelHeight = std::max(height >> level, 1);
+    glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+    glUniform1i(glGetUniformLocation(program, "sourceLevel"),
+                std::max(level - 1, 0));
+    glUniform1i(glGetUniformLocation(program, "downsample"), level > 0);
+    glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+  timers.end(pyramidSection);
+}
+
+// Add the counters of the cull that last used slot to the totals, if the
+// GPU has finished it; the slot is reused either way
+void ChunkCulling::collectStats(int slot) {
+  GLsync &fence = statsFences[slot];
+  if (!fence)
+    return;
+  GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  glDeleteSync(fence);
+  fence = nullptr;
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+    return;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[slot]);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Stats), &last);
+  total.frustumCulled += last.frustumCulled;
+  total.occluded += last.occluded;
+  for (int lod = 0; lod < kMaxLods; ++lod) {
+    total.drawn[lod] += last.drawn[lod];
+  }
+  statsCount++;
+}
+
+void ChunkCulling::cull() {
+  if (chunkCount == 0)
+    return;
+  bool useOcclusion = occlusionTest;
+  if (useOcclusion)
+    buildPyramid();
+
+  timers.begin(cullSection);
+  int slot = statsFrame;
+  statsFrame = (statsFrame + 1) % kStatsLatency;
+  collectStats(slot);
+  // Cleared on the GPU, so a slot whose sample was dropped does not make
+  // the driver wait for the cull still writing it
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[slot]);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, nullptr);
+  const GLuint noCommands = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &noCommands);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glm::mat4 projection, view;
+  glGetFloatv(GL_PROJECTION_MATRIX, glm::value_ptr(projection));
+  glGetFloatv(GL_MODELVIEW_MATRIX, glm::value_ptr(view));
+  glm::mat4 viewProjection = projection * view;
+  glm::vec3 eye(glm::inverse(view)[3]);
+
+  GLuint program = shaders.getProgram(cullProgram);
+  glUseProgram(program);
+  glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1,
+                     GL_FALSE, glm::value_ptr(viewProjection));
+  glUniform3f(glGetUniformLocation(program, "eye"), eye.x, eye.y, eye.z);
+  glUniform1ui(glGetUniformLocation(program, "chunkCount"),
+               static_cast<GLuint>(chunkCount));
+  glUniform1ui(glGetUniformLocation(program, "columnCount"),
+               static_cast<GLuint>(columnCount));
+  glUniform1i(glGetUniformLocation(program, "lodCount"), lodCount);
+  glUniform1f(glGetUniformLocation(program, "lodDistance"), lodDistance);
+  glUniform1i(glGetUniformLocation(program, "compact"), useDrawCount);
+  glUniform1i(glGetUniformLocation(program, "occlusionTest"), useOcclusion);
+  glUniform1i(glGetUniformLocation(program, "levelCount"), levelCount);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, useOcclusion ? pyramidTexture : 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, chunkCommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, statsBuffers[slot]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, drawCountBuffer);
+  glDispatchCompute((chunkCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+  timers.end(cullSection);
+}
+
+void ChunkCulling::draw() const {
+  if (chunkCount == 0)
+    return;
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  if (useDrawCount) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, drawCountBuffer);
+    glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                        nullptr, 0,
+                                        chunkCount * kDrawnParts, 0);
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  } else {
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                chunkCount * kDrawnParts, 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+double ChunkCulling::getAverageFrustumCulled() const {
+  return statsCount > 0 ? static_cast<double>(total.frustumCulled) /
+                              statsCount
+                        : 0.0;
+}
+
+double ChunkCulling::getAverageOccluded() const {
+  return statsCount > 0 ? static_cast<double>(total.occluded) / statsCount
+                        : 0.0;
+}
+
+double ChunkCulling::getAverageDrawn(int lod) const {
+  return statsCount > 0 ? static_cast<double>(total.drawn[lod]) / statsCount
+                        : 0.0;
+}
+
+int ChunkCulling::getLastDrawn() const {
+  int drawn = 0;
+  for (int lod = 0; lod < kMaxLods; ++lod) {
+    drawn += static_cast<int>(last.drawn[lod]);
+  }
+  return drawn;
+}
+
+void ChunkCulling::resetStats() {
+  total = Stats();
+  statsCount = 0;
+}
@@ -0,0 +1,163 @@
+// chunk_culling.h
+// Defines the GPU-driven culling, level of detail selection and drawing of
+// terrain chunks
+
+#ifndef CHUNK_CULLING_H
+#define CHUNK_CULLING_H
+
+#include "gpu_timers.h"
+#include "light.h"
+#include "shader_manager.h"
+#include <GL/glew.h>
+#include <vector>
+
+// GPU-driven drawing of terrain chunks. A compute pass tests the bounds of
+// every chunk against the frustum, picks its level of detail from its
+// distance to the camera, and appends the draw commands of that level to a
+// buffer while counting them; the chunks are then drawn with a single
+// glMultiDrawElementsIndirectCount call, so the CPU cost of a frame does
+// not depend on the number of chunks. Without ARB_indirect_parameters the
+// commands stay in chunk order, culled chunks getting an instance count of
+// zero, and are drawn with glMultiDrawElementsIndirect.
+//
+// Chunks at different levels would leave T-junction cracks along their
+// shared edges, so a chunk is drawn as its interior plus four edge strips,
+// and each strip has one variant per level the neighbour across it may
+// have. Where the neighbour is finer, the coarser chunk's strip takes in
+// the neighbour's edge vertices, so both sides of every edge share their
+// vertices whatever the level difference.
+//
+// With the occlusion test on, the chunks drawn the previous frame are first
+// drawn again, depth only, with the current matrices; their depth is
+// reduced into a max-depth mip pyramid (Hi-Z), and chunks behind it at the
+// level where their bounds cover at most 2x2 texels are culled too. The
+// occluders are real geometry drawn from the current viewpoint, so a chunk
+// is only culled when it is truly hidden; a chunk hidden only by chunks
+// that were not drawn last frame is merely drawn unnecessarily.
+//
+// Each command's baseInstance is its chunk index, for shaders that look up
+// per-chunk data through an instanced attribute.
+class ChunkCulling {
+public:
+  static const int kMaxLods = 4;
+  // Commands of one chunk at one level: the interior, then for each edge
+  // (-z, +z, -x, +x) one per level the neighbour across it can have, the
+  // chunk's own level being the edge as it is. Level 0, never coarser than
+  // a neighbour, has the whole chunk as its interior and empty edges.
+  static const int kChunkCommands = 1 + 4 * kMaxLods;
+  // Commands drawn per visible chunk: the interior and one per edge
+  static const int kDrawnParts = 5;
+
+  // Layout of DrawElementsIndirectCommand
+  struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  // Requires a current GL context
+  ChunkCulling(ShaderManager &shaders, GpuTimers &timers);
+  ~ChunkCulling();
+
+  // False when a culling program failed to build
+  bool isAvailable() const;
+
+  // True when the draw count is read on the GPU (ARB_indirect_parameters)
+  bool hasDrawCount() const { return useDrawCount; }
+
+  // World space bounds of the chunks, row-major in rows of columns chunks,
+  // the coarsest level each chunk has, and the draw commands of every level
+  // of detail (with any instance count), level-major: commands holds
+  // kChunkCommands per chunk per level, at most kMaxLods levels. Every
+  // chunk starts out visible at level 0.
+  void setChunks(const std::vector<BoundingBox> &bounds, int columns,
+                 const std::vector<int> &maxLods,
+                 const std::vector<DrawCommand> &commands);
+
+  // Chunks within lodDistance of the camera use level 0; each further level
+  // starts at twice the distance of the previous one
+  void setLodDistance(float distance) { lodDistance = distance; }
+  float getLodDistance() const { return lodDistance; }
+
+  // Hi-Z occlusion test on top of the frustum test
+  void setOcclusionTest(bool enabled) { occlusionTest = enabled; }
+  bool getOcclusionTest() const { return occlusionTest; }
+
+  // Cull every chunk and select its level under the current matrices and
+  // viewport. With the occlusion test, last frame's chunks are drawn to
+  // build the pyramid, so the vertex array and index buffer the commands
+  // refer to must be bound.
+  void cull();
+
+  // Draw the chunks that survived the last cull()
+  void draw() const;
+
+  int getChunkCount() const { return chunkCount; }
+  int getLodCount() const { return lodCount; }
+
+  // Chunks culled and drawn per frame, averaged since the last
+  // resetStats(). A cull's counters are read when its slot comes round
+  // again, kStatsLatency frames later, and only if its fence has signaled;
+  // a sample the GPU has not finished by then is dropped rather than
+  // waited for.
+  double getAverageFrustumCulled() const;
+  double getAverageOccluded() const;
+  double getAverageDrawn(int lod) const;
+  int getLastOccluded() const { return static_cast<int>(last.occluded); }
+  int getLastDrawn() const;
+  void resetStats();
+
+private:
+  static const int kStatsLatency = 3;
+
+  // std430 layout of the culling counters
+  struct Stats {
+    GLuint frustumCulled;
+    GLuint occluded;
+    GLuint drawn[kMaxLods];
+  };
+
+  const ShaderManager &shaders;
+  GpuTimers &timers;
+  int depthSection;
+  int pyramidSection;
+  int cullSection;
+  int pyramidProgram;
+  int cullProgram;
+  bool useDrawCount;
+
+  int chunkCount;
+  int columnCount;
+  int lodCount;
+  float lodDistance;
+  bool occlusionTest;
+  GLuint boundsBuffer;       // Min corner and coarsest level, max corner
+  GLuint chunkCommandBuffer; // Every level's command of every chunk
+  GLuint commandBuffer;      // Commands of the last cull
+  GLuint drawCountBuffer;    // Number of commands of the last cull
+  GLuint statsBuffers[kStatsLatency];
+  GLsync statsFences[kStatsLatency]; // Set after the cull writing the slot
+  int statsFrame;
+
+  GLuint framebuffer;
+  GLuint depthTexture;
+  GLuint pyramidTexture; // R32F, max depth per texel at every level
+  int width;
+  int height;
+  int levelCount;
+
+  Stats total; // Sums of the collected frames
+  Stats last;  // Most recently collected frame
+  int statsCount;
+
+  void resize(int width, int height);
+  void buildPyramid();
+  void collectStats(int slot);
+
+  ChunkCulling(const ChunkCulling &) = delete;
+  ChunkCulling &operator=(const ChunkCulling &) = delete;
+};
+
+#endif // CHUNK_CULLING_H
@@ -0,0 +1,283 @@
+// clustered_lighting.cpp
+// Implements froxel light assignment and its GPU upload
+
+#include "clustered_lighting.h"
+#include "job_system.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+// Allocate and fill a shader storage buffer, orphaning its previous store.
+// Empty data still gets a small store so the binding stays valid.
+static void uploadStorage(GLuint buffer, const void *data, size_t bytes) {
+  static const unsigned int kEmpty[8] = {};
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  if (bytes == 0) {
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(kEmpty), kEmpty,
+                 GL_STREAM_DRAW);
+  } else {
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, GL_STREAM_DRAW);
+  }
+}
+
+ClusteredLighting::ClusteredLighting()
+    : lightBuffer(0), clusterBuffer(0), indexBuffer(0), chunkIndexBuffer(0),
+      chunkRangeBuffer(0),
+      clusters(kClusterCount * 2, 0), sliceIndices(kSlices),
+      sliceScale(0.0f), sliceBias(0.0f), viewportSize(1.0f), tileSize(1.0f),
+      buildTime(0.0) {
+  glGenBuffers(1, &lightBuffer);
+  glGenBuffers(1, &clusterBuffer);
+  glGenBuffers(1, &indexBuffer);
+  glGenBuffers(1, &chunkIndexBuffer);
+  glGenBuffers(1, &chunkRangeBuffer);
+  upload();
+}
+
+ClusteredLighting::~ClusteredLighting() {
+  glDeleteBuffers(1, &lightBuffer);
+  glDeleteBuffers(1, &clusterBuffer);
+  glDeleteBuffers(1, &indexBuffer);
+  glDeleteBuffers(1, &chunkIndexBuffer);
+  glDeleteBuffers(1, &chunkRangeBuffer);
+}
+
+void ClusteredLighting::update(const std::vector<Light> &lights,
+                               const glm::mat4 &view,
+                               const glm::mat4 &projection,
+                               const std::vector<BoundingBox> &chunks) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // Recover the clip planes from the perspective projection
+  float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  viewportSize = glm::vec2(static_cast<float>(viewport[2]),
+                           static_cast<float>(viewport[3]));
+  tileSize = glm::vec2(std::max(std::ceil(viewportSize.x / kTilesX), 1.0f),
+                       std::max(std::ceil(viewportSize.y / kTilesY), 1.0f));
+  float logRatio = std::log(farPlane / nearPlane);
+  sliceScale = kSlices / logRatio;
+  sliceBias = -kSlices * std::log(nearPlane) / logRatio;
+
+  JobSystem &jobs = JobSystem::shared();
+  int count = static_cast<int>(lights.size());
+  gpuLights.resize(count);
+  bounds.resize(count);
+  jobs.parallelFor(0, count, 256, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const Light &light = lights[i];
+      glm::vec4 position = view * glm::vec4(light.position, 1.0f);
+      gpuLights[i].positionRange =
+          glm::vec4(position.x, position.y, position.z, light.radius);
+      gpuLights[i].colorIntensity = glm::vec4(light.color, light.intensity);
+      bounds[i] = computeBounds(gpuLights[i], projection, nearPlane,
+                                farPlane);
+    }
+  });
+
+  jobs.parallelFor(0, kSlices, 1, [&](int begin, int end) {
+    for (int slice = begin; slice < end; ++slice) {
+      buildSlice(slice);
+    }
+  });
+
+  // Concatenate the slice lists, rebasing their froxel offsets
+  lightIndices.clear();
+  const int sliceClusters = kTilesX * kTilesY;
+  for (int slice = 0; slice < kSlices; ++slice) {
+    unsigned int base = static_cast<unsigned int>(lightIndices.size());
+    for (int c = slice * sliceClusters; c < (slice + 1) * sliceClusters;
+         ++c) {
+      clusters[2 * c] += base;
+    }
+    lightIndices.insert(lightIndices.end(), sliceIndices[slice].begin(),
+                        sliceIndices[slice].end());
+  }
+
+  cullChunks(lights, chunks);
+  upload();
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void ClusteredLighting::updateLights(const std::vector<Light> &lights,
+                                     const glm::mat4 &view) {
+  auto start = std::chrono::high_resolution_clock::now();
+  int count = static_cast<int>(lights.size());
+  gpuLights.resize(count);
+  JobSystem::shared().parallelFor(0, count, 256, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const Light &light = lights[i];
+      glm::vec4 position = view * glm::vec4(light.position, 1.0f);
+      gpuLights[i].positionRange =
+          glm::vec4(position.x, position.y, position.z, light.radius);
+      gpuLights[i].colorIntensity = glm::vec4(light.color, light.intensity);
+    }
+  });
+
+  std::fill(clusters.begin(), clusters.end(), 0u);
+  lightIndices.clear();
+  std::fill(chunkRanges.begin(), chunkRanges.end(), 0u);
+  chunkLightIndices.clear();
+  upload();
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Froxels covered by the view-space bounding box of a light's range. A
+// light straddling the near plane conservatively covers every tile.
+ClusteredLighting::LightBounds
+ClusteredLighting::computeBounds(const GpuLight &light,
+                                 const glm::mat4 &projection,
+                                 float nearPlane, float farPlane) const {
+  LightBounds result = {0, kTilesX - 1, 0, kTilesY - 1, 1, 0};
+  glm::vec3 center(light.positionRange);
+  float range = light.positionRange.w;
+  float minDepth = -center.z - range;
+  float maxDepth = -center.z + range;
+  if (range <= 0.0f || maxDepth < nearPlane || minDepth > farPlane)
+    return result;
+
+  auto slice = [this](float depth) {
+    int s = static_cast<int>(std::floor(std::log(depth) * sliceScale +
+                                        sliceBias));
+    return std::min(std::max(s, 0), kSlices - 1);
+  };
+  result.z0 = slice(std::max(minDepth, nearPlane));
+  result.z1 = slice(std::min(maxDepth, farPlane));
+  if (minDepth <= nearPlane)
+    return result;
+
+  // Project the corners of the box, all in front of the near plane, and
+  // map the rectangle to tiles exactly as the fragment shader does
+  glm::vec2 lo(std::numeric_limits<float>::max());
+  glm::vec2 hi(-std::numeric_limits<float>::max());
+  for (int corner = 0; corner < 8; ++corner) {
+    glm::vec3 offset((corner & 1) ? range : -range,
+                     (corner & 2) ? range : -range,
+                     (corner & 4) ? range : -range);
+    glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+    for (int axis = 0; axis < 2; ++axis) {
+      lo[axis] = std::min(lo[axis], clip[axis] / clip.w);
+      hi[axis] = std::max(hi[axis], clip[axis] / clip.w);
+    }
+  }
+  if (lo.x > 1.0f || lo.y > 1.0f || hi.x < -1.0f || hi.y < -1.0f) {
+    result.z0 = 1;
+    result.z1 = 0;
+    return result;
+  }
+
+  auto tile = [this](float ndc, int axis, int tiles) {
+    float pixel =
+        (glm::clamp(ndc, -1.0f, 1.0f) * 0.5f + 0.5f) * viewportSize[axis];
+    int t = static_cast<int>(pixel / tileSize[axis]);
+    return std::min(std::max(t, 0), tiles - 1);
+  };
+  result.x0 = tile(lo.x, 0, kTilesX);
+  result.x1 = tile(hi.x, 0, kTilesX);
+  result.y0 = tile(lo.y, 1, kTilesY);
+  result.y1 = tile(hi.y, 1, kTilesY);
+  return result;
+}
+
+// Count, then list, the lights of every froxel in one depth slice. Offsets
+// are relative to the slice until update() concatenates the slices.
+void ClusteredLighting::buildSlice(int slice) {
+  const int sliceClusters = kTilesX * kTilesY;
+  unsigned int *cluster = &clusters[2 * slice * sliceClusters];
+  std::vector<unsigned int> &list = sliceIndices[slice];
+  unsigned int counts[kTilesX * kTilesY] = {};
+
+  int count = static_cast<int>(bounds.size());
+  for (int i = 0; i < count; ++i) {
+    const LightBounds &b = bounds[i];
+    if (slice < b.z0 || slice > b.z1)
+      continue;
+    for (int y = b.y0; y <= b.y1; ++y) {
+      for (int x = b.x0; x <= b.x1; ++x) {
+        ++counts[y * kTilesX + x];
+      }
+    }
+  }
+
+  unsigned int offset = 0;
+  for (int t = 0; t < sliceClusters; ++t) {
+    cluster[2 * t] = offset;
+    cluster[2 * t + 1] = counts[t];
+    offset += counts[t];
+    counts[t] = cluster[2 * t]; // Reused as the fill cursor
+  }
+  list.resize(offset);
+
+  for (int i = 0; i < count; ++i) {
+    const LightBounds &b = bounds[i];
+    if (slice < b.z0 || slice > b.z1)
+      continue;
+    for (int y = b.y0; y <= b.y1; ++y) {
+      for (int x = b.x0; x <= b.x1; ++x) {
+        list[counts[y * kTilesX + x]++] = static_cast<unsigned int>(i);
+      }
+    }
+  }
+}
+
+// List the lights whose radius reaches each chunk's bounds
+void ClusteredLighting::cullChunks(const std::vector<Light> &lights,
+                                   const std::vector<BoundingBox> &chunks) {
+  int chunkCount = static_cast<int>(chunks.size());
+  chunkIndices.resize(chunkCount);
+  JobSystem::shared().parallelFor(0, chunkCount, 1, [&](int begin, int end) {
+    for (int chunk = begin; chunk < end; ++chunk) {
+      std::vector<unsigned int> &list = chunkIndices[chunk];
+      list.clear();
+      for (size_t i = 0; i < lights.size(); ++i) {
+        if (lightReaches(lights[i], chunks[chunk]))
+          list.push_back(static_cast<unsigned int>(i));
+      }
+    }
+  });
+
+  chunkRanges.resize(chunkCount * 2);
+  chunkLightIndices.clear();
+  for (int chunk = 0; chunk < chunkCount; ++chunk) {
+    chunkRanges[2 * chunk] =
+        static_cast<unsigned int>(chunkLightIndices.size());
+    chunkRanges[2 * chunk + 1] =
+        static_cast<unsigned int>(chunkIndices[chunk].size());
+    chunkLightIndices.insert(chunkLightIndices.end(),
+                             chunkIndices[chunk].begin(),
+                             chunkIndices[chunk].end());
+  }
+}
+
+void ClusteredLighting::upload() {
+  uploadStorage(lightBuffer, gpuLights.data(),
+                gpuLights.size() * sizeof(GpuLight));
+  uploadStorage(clusterBuffer, clusters.data(),
+                clusters.size() * sizeof(unsigned int));
+  uploadStorage(indexBuffer, lightIndices.data(),
+                lightIndices.size() * sizeof(unsigned int));
+  uploadStorage(chunkIndexBuffer, chunkLightIndices.data(),
+                chunkLightIndices.size() * sizeof(unsigned int));
+  uploadStorage(chunkRangeBuffer, chunkRanges.data(),
+                chunkRanges.size() * sizeof(unsigned int));
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ClusteredLighting::bind(GLuint program) const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, lightBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, clusterBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, indexBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, chunkIndexBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, chunkRangeBuffer);
+  glUniform3i(glGetUniformLocation(program, "clusterGrid"), kTilesX, kTilesY,
+              kSlices);
+  glUniform2f(glGetUniformLocation(program, "tileSize"), tileSize.x,
+              tileSize.y);
+  glUniform1f(glGetUniformLocation(program, "sliceScale"), sliceScale);
+  glUniform1f(glGetUniformLocation(program, "sliceBias"), sliceBias);
+}
@@ -0,0 +1,104 @@
+// clustered_lighting.h
+// Defines the froxel light grid used for clustered forward shading
+
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include "light.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Splits the view frustum into kTilesX x kTilesY screen tiles and kSlices
+// exponentially spaced depth slices (froxels) and lists, for each froxel,
+// the lights whose range reaches it. The lights, the per-froxel (offset,
+// count) pairs and the flattened light index lists live in shader storage
+// buffers, so a fragment only iterates the lights of its own froxel.
+//
+// Lights are also culled against the world-space bounds of each terrain
+// chunk. Each chunk has its own light list, found through the chunk index
+// the vertex shader passes down, and each fragment walks the shorter of its
+// froxel and chunk lists (both contain every light that can reach it).
+//
+// Buffer bindings: 3 lights, 4 froxels, 5 light indices, 6 chunk light
+// indices, 7 chunk light ranges.
+class ClusteredLighting {
+public:
+  static const int kTilesX = 16;
+  static const int kTilesY = 9;
+  static const int kSlices = 24;
+  static const int kClusterCount = kTilesX * kTilesY * kSlices;
+
+  // Requires a current GL context
+  ClusteredLighting();
+  ~ClusteredLighting();
+
+  // Rebuild the grid for lights seen through view and projection (a
+  // perspective projection) over the current viewport and the light lists
+  // of chunks, on the job system, and upload them
+  void update(const std::vector<Light> &lights, const glm::mat4 &view,
+              const glm::mat4 &projection,
+              const std::vector<BoundingBox> &chunks);
+
+  // Upload only the lights seen through view, leaving every froxel and
+  // chunk list empty. For the deferred path, whose tiled pass culls the
+  // whole light list itself.
+  void updateLights(const std::vector<Light> &lights, const glm::mat4 &view);
+
+  // Bind the buffers and set the froxel uniforms of a lit program (which
+  // must be in use)
+  void bind(GLuint program) const;
+
+  int getLightCount() const { return static_cast<int>(gpuLights.size()); }
+  size_t getIndexCount() const { return lightIndices.size(); }
+  // Lights reaching each chunk, summed over every chunk of the last
+  // update(), whether or not it is drawn
+  size_t getChunkPairCount() const { return chunkLightIndices.size(); }
+  double getBuildTime() const { return buildTime; } // Milliseconds
+
+private:
+  // std430 layout of one light; positions are in view space
+  struct GpuLight {
+    glm::vec4 positionRange;
+    glm::vec4 colorIntensity;
+  };
+
+  // Froxel ranges a light overlaps (inclusive); empty when z0 > z1
+  struct LightBounds {
+    int x0, x1, y0, y1, z0, z1;
+  };
+
+  GLuint lightBuffer;
+  GLuint clusterBuffer;
+  GLuint indexBuffer;
+  GLuint chunkIndexBuffer;
+  GLuint chunkRangeBuffer;
+
+  std::vector<GpuLight> gpuLights;
+  std::vector<LightBounds> bounds;
+  std::vector<unsigned int> clusters; // (offset, count) per froxel
+  std::vector<unsigned int> lightIndices;
+  std::vector<std::vector<unsigned int>> sliceIndices;
+  std::vector<unsigned int> chunkRanges; // (offset, count) per chunk
+  std::vector<unsigned int> chunkLightIndices;
+  std::vector<std::vector<unsigned int>> chunkIndices;
+
+  float sliceScale; // slice = log(depth) * sliceScale + sliceBias
+  float sliceBias;
+  glm::vec2 viewportSize; // Pixels
+  glm::vec2 tileSize;
+  double buildTime;
+
+  LightBounds computeBounds(const GpuLight &light,
+                            const glm::mat4 &projection, float nearPlane,
+                            float farPlane) const;
+  void buildSlice(int slice);
+  void cullChunks(const std::vector<Light> &lights,
+                  const std::vector<BoundingBox> &chunks);
+  void upload();
+
+  ClusteredLighting(const ClusteredLighting &) = delete;
+  ClusteredLighting &operator=(const ClusteredLighting &) = delete;
+};
+
+#endif // CLUSTERED_LIGHTING_H
@@ -2,47 +2,57 @@
 
 layout(local_size_x = 256) in;
 
-layout(std430, binding = 0) buffer VertexBuffer {
-    vec4 vertices[];
+// Both buffers hold tightly packed xyz floats, the same layout the vertex
+// arrays are drawn from (vec3/vec4 blocks would use a 16-byte stride)
+layout(std430, binding = 0) readonly buffer VertexBuffer {
+    float vertices[];
 };
 
-layout(std430, binding = 1) buffer IndexBuffer {
-    uint indices[];
-};
-
-layout(std430, binding = 2) buffer NormalBuffer {
-    vec4 normals[];
+layout(std430, binding = 2) writeonly buffer NormalBuffer {
+    float normals[];
 };
 
 uniform int gridSize;
 
-void main() {
-    uint gid = gl_GlobalInvocationID.x;
-    if (gid >= gridSize * gridSize) return;
-
-    vec3 normal = vec3(0.0, 0.0, 0.0);
+vec3 position(int x, int z) {
+    int i = (z * gridSize + x) * 3;
+    return vec3(vertices[i], vertices[i + 1], vertices[i + 2]);
+}
 
-    // Calculate normals for surrounding faces
-    for (int i = -1; i <= 1; i++) {
-        for (int j = -1; j <= 1; j++) {
-            if (i == 0 && j == 0) continue;
+// Quad (x, z) holds triangles (TL, BL, TR) and (TR, BL, BR)
+vec3 upperNormal(int x, int z) {
+    vec3 topLeft = position(x, z);
+    return normalize(cross(position(x, z + 1) - topLeft,
+                           position(x + 1, z) - topLeft));
+}
 
-            int x = int(gid % gridSize) + i;
-            int z = int(gid / gridSize) + j;
+vec3 lowerNormal(int x, int z) {
+    vec3 topRight = position(x + 1, z);
+    return normalize(cross(position(x, z + 1) - topRight,
+                           position(x + 1, z + 1) - topRight));
+}
 
-            if (x < 0 || x >= gridSize - 1 || z < 0 || z >= gridSize - 1) continue;
+void main() {
+    int gid = int(gl_GlobalInvocationID.x);
+    if (gid >= gridSize * gridSize) return;
 
-            uint index = z * gridSize + x;
-            
-            vec3 v1 = vertices[indices[index * 6]].xyz;
-            vec3 v2 = vertices[indices[index * 6 + 1]].xyz;
-            vec3 v3 = vertices[indices[index * 6 + 2]].xyz;
+    int x = gid % gridSize;
+    int z = gid / gridSize;
+    int cells = gridSize - 1;
 
-            vec3 edge1 = v2 - v1;
-            vec3 edge2 = v3 - v1;
-            normal += normalize(cross(edge1, edge2));
-        }
+    // Sum the (up to six) triangles sharing this vertex
+    vec3 normal = vec3(0.0);
+    if (z > 0) {
+        if (x > 0) normal += lowerNormal(x - 1, z - 1);
+        if (x < cells) normal += upperNormal(x, z - 1) + lowerNormal(x, z - 1);
+    }
+    if (z < cells) {
+        if (x > 0) normal += upperNormal(x - 1, z) + lowerNormal(x - 1, z);
+        if (x < cells) normal += upperNormal(x, z);
     }
+    normal = normalize(normal);
 
-    normals[gid] = vec4(normalize(normal), 0.0);
-}
\ No newline at end of file
+    normals[gid * 3] = normal.x;
+    normals[gid * 3 + 1] = normal.y;
+    normals[gid * 3 + 2] = normal.z;
+}
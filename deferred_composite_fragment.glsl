@@ -0,0 +1,16 @@
+#version 430 compatibility
+
+// Copy the deferred lighting result and the G-buffer depth to the bound
+// framebuffer, so later forward draws depth test against the terrain
+
+uniform sampler2D litMap;
+uniform sampler2D depthMap;
+
+in vec2 uv;
+
+layout(location = 0) out vec4 fragColor;
+
+void main() {
+    fragColor = texture(litMap, uv);
+    gl_FragDepth = texture(depthMap, uv).r;
+}
@@ -0,0 +1,10 @@
+#version 430 compatibility
+
+// Full-screen triangle for the deferred composite, from gl_VertexID alone
+
+out vec2 uv;
+
+void main() {
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,142 @@
+#version 430
+
+// Tiled deferred lighting. Each work group shades one kTileSize^2 pixel
+// tile of the G-buffer: it finds the tile's depth range, lists the lights
+// whose range reaches the tile's view space bounds in shared memory, and
+// lights each pixel with the sun and only those lights.
+
+const uint kTileSize = 16u; // The local size
+const uint kMaxTileLights = 1024u;
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+struct Light {
+    vec4 positionRange;  // View space position, radius
+    vec4 colorIntensity;
+};
+
+layout(std430, binding = 3) readonly buffer LightBuffer {
+    Light lights[];
+};
+
+layout(binding = 0) uniform sampler2D depthMap;
+layout(binding = 1) uniform sampler2D normalMap;
+layout(binding = 2) uniform sampler2D albedoMap;
+layout(binding = 3) uniform sampler2D occlusionMap;
+layout(rgba8, binding = 0) writeonly uniform image2D litImage;
+
+uniform mat4 inverseProjection;
+uniform uint lightCount;
+uniform vec3 sunDirection; // View space, towards the sun
+uniform vec3 sunColor;
+uniform vec3 ambientColor;
+uniform vec4 clearColor; // Written where nothing was drawn
+
+shared uint tileMinDepth; // Depth bits; ordered like the depths
+shared uint tileMaxDepth;
+shared uint tileLightCount;
+shared uint tileLights[kMaxTileLights];
+
+vec3 viewPositionAt(vec2 uv, float depth) {
+    vec4 position = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0,
+                                             1.0);
+    return position.xyz / position.w;
+}
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
+// Inverse-square falloff windowed to reach zero at radius
+float attenuation(float lightDistance, float radius) {
+    float ratio = lightDistance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / max(lightDistance * lightDistance, 0.01);
+}
+
+void main() {
+    ivec2 size = textureSize(depthMap, 0);
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    bool inside = all(lessThan(pixel, size));
+
+    if (gl_LocalInvocationIndex == 0) {
+        tileMinDepth = 0xffffffffu;
+        tileMaxDepth = 0u;
+        tileLightCount = 0u;
+    }
+    memoryBarrierShared();
+    barrier();
+
+    float depth = inside ? texelFetch(depthMap, pixel, 0).r : 1.0;
+    bool covered = depth < 1.0;
+    if (covered) {
+        atomicMin(tileMinDepth, floatBitsToUint(depth));
+        atomicMax(tileMaxDepth, floatBitsToUint(depth));
+    }
+    memoryBarrierShared();
+    barrier();
+
+    // View space box around the tile's frustum between its depth extremes
+    if (tileMinDepth <= tileMaxDepth) {
+        vec2 uv0 = vec2(gl_WorkGroupID.xy * kTileSize) / vec2(size);
+        vec2 uv1 = vec2((gl_WorkGroupID.xy + 1u) * kTileSize) / vec2(size);
+        float depths[2] = float[2](uintBitsToFloat(tileMinDepth),
+                                   uintBitsToFloat(tileMaxDepth));
+        vec3 boxMin = vec3(1e30);
+        vec3 boxMax = vec3(-1e30);
+        for (int corner = 0; corner < 8; ++corner) {
+            vec2 uv = vec2((corner & 1) != 0 ? uv1.x : uv0.x,
+                           (corner & 2) != 0 ? uv1.y : uv0.y);
+            vec3 p = viewPositionAt(uv, depths[corner >> 2]);
+            boxMin = min(boxMin, p);
+            boxMax = max(boxMax, p);
+        }
+
+        uint threads = kTileSize * kTileSize;
+        for (uint i = gl_LocalInvocationIndex; i < lightCount;
+             i += threads) {
+            vec4 light = lights[i].positionRange;
+            vec3 nearest = clamp(light.xyz, boxMin, boxMax);
+            vec3 offset = light.xyz - nearest;
+            if (dot(offset, offset) <= light.w * light.w) {
+                uint slot = atomicAdd(tileLightCount, 1u);
+                if (slot < kMaxTileLights) tileLights[slot] = i;
+            }
+        }
+    }
+    memoryBarrierShared();
+    barrier();
+
+    if (!inside) return;
+    if (!covered) {
+        imageStore(litImage, pixel, clearColor);
+        return;
+    }
+
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(size);
+    vec3 position = viewPositionAt(uv, depth);
+    vec3 normal = octahedralDecode(texelFetch(normalMap, pixel, 0).rg);
+    vec3 albedo = texelFetch(albedoMap, pixel, 0).rgb;
+    vec2 occlusion = texelFetch(occlusionMap, pixel, 0).rg;
+
+    vec3 light = ambientColor * occlusion.y +
+                 sunColor * occlusion.x *
+                 max(dot(normal, sunDirection), 0.0);
+    uint count = min(tileLightCount, kMaxTileLights);
+    for (uint i = 0u; i < count; ++i) {
+        Light pointLight = lights[tileLights[i]];
+        vec3 toLight = pointLight.positionRange.xyz - position;
+        float lightDistance = length(toLight);
+        float falloff = attenuation(lightDistance,
+                                    pointLight.positionRange.w);
+        light += pointLight.colorIntensity.rgb * pointLight.colorIntensity.a *
+                 falloff * max(dot(normal, toLight / lightDistance), 0.0);
+    }
+
+    imageStore(litImage, pixel, vec4(albedo * light, 1.0));
+}
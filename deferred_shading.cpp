@@ -0,0 +1,155 @@
+// deferred_shading.cpp
+// Implements the G-buffer, the tiled lighting dispatch and the composite
+
+#include "deferred_shading.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+
+DeferredShading::DeferredShading(ShaderManager &shaders, GpuTimers &timers)
+    : shaders(shaders), timers(timers),
+      timerSection(timers.getSection("Deferred lighting")),
+      lightingProgram(shaders.loadProgram(
+          "deferred_lighting",
+          {{GL_COMPUTE_SHADER, "deferred_lighting.glsl"}})),
+      compositeProgram(shaders.loadProgram(
+          "deferred_composite",
+          {{GL_VERTEX_SHADER, "deferred_composite_vertex.glsl"},
+           {GL_FRAGMENT_SHADER, "deferred_composite_fragment.glsl"}})),
+      framebuffer(0), depthTexture(0), normalTexture(0), albedoTexture(0),
+      occlusionTexture(0), litTexture(0), width(0), height(0) {
+  glGenFramebuffers(1, &framebuffer);
+}
+
+DeferredShading::~DeferredShading() {
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteTextures(1, &depthTexture);
+  glDeleteTextures(1, &normalTexture);
+  glDeleteTextures(1, &albedoTexture);
+  glDeleteTextures(1, &occlusionTexture);
+  glDeleteTextures(1, &litTexture);
+}
+
+bool DeferredShading::isAvailable() const {
+  return shaders.getProgram(lightingProgram) != 0 &&
+         shaders.getProgram(compositeProgram) != 0;
+}
+
+// (Re)allocate every target at width x height, sampled texel for texel
+void DeferredShading::resize(int width, int height) {
+  this->width = width;
+  this->height = height;
+  struct Target {
+    GLuint *texture;
+    GLenum internalFormat;
+    GLenum attachment;
+  };
+  const Target targets[] = {
+      {&depthTexture, GL_DEPTH_COMPONENT32F, GL_DEPTH_ATTACHMENT},
+      {&normalTexture, GL_RG16_SNORM, GL_COLOR_ATTACHMENT0},
+      {&albedoTexture, GL_RGBA8, GL_COLOR_ATTACHMENT1},
+      {&occlusionTexture, GL_RG8, GL_COLOR_ATTACHMENT2},
+      {&litTexture, GL_RGBA8, GL_NONE},
+  };
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  for (const Target &target : targets) {
+    glDeleteTextures(1, target.texture);
+    glGenTextures(1, target.texture);
+    glBindTexture(GL_TEXTURE_2D, *target.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, target.internalFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (target.attachment != GL_NONE)
+      glFramebufferTexture2D(GL_FRAMEBUFFER, target.attachment,
+                             GL_TEXTURE_2D, *target.texture, 0);
+  }
+  const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                GL_COLOR_ATTACHMENT2};
+  glDrawBuffers(3, drawBuffers);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Deferred G-buffer is incomplete" << std::endl;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredShading::begin() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (viewport[2] != width || viewport[3] != height)
+    resize(viewport[2], viewport[3]);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredShading::resolve(const ClusteredLighting &lighting) {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  timers.begin(timerSection);
+
+  // The fixed-function sun, already in eye space, and the clear color for
+  // pixels the terrain does not cover
+  glm::mat4 projection;
+  glGetFloatv(GL_PROJECTION_MATRIX, glm::value_ptr(projection));
+  GLfloat sunPosition[4], sunColor[4], ambient[4], clearColor[4];
+  glGetLightfv(GL_LIGHT0, GL_POSITION, sunPosition);
+  glGetLightfv(GL_LIGHT0, GL_DIFFUSE, sunColor);
+  glGetFloatv(GL_LIGHT_MODEL_AMBIENT, ambient);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glm::vec3 sunDirection = glm::normalize(
+      glm::vec3(sunPosition[0], sunPosition[1], sunPosition[2]));
+
+  GLuint program = shaders.getProgram(lightingProgram);
+  glUseProgram(program);
+  lighting.bind(program);
+  glUniformMatrix4fv(glGetUniformLocation(program, "inverseProjection"), 1,
+                     GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+  glUniform1ui(glGetUniformLocation(program, "lightCount"),
+               static_cast<GLuint>(lighting.getLightCount()));
+  glUniform3f(glGetUniformLocation(program, "sunDirection"), sunDirection.x,
+              sunDirection.y, sunDirection.z);
+  glUniform3fv(glGetUniformLocation(program, "sunColor"), 1, sunColor);
+  glUniform3fv(glGetUniformLocation(program, "ambientColor"), 1, ambient);
+  glUniform4fv(glGetUniformLocation(program, "clearColor"), 1, clearColor);
+  const GLuint inputs[] = {depthTexture, normalTexture, albedoTexture,
+                           occlusionTexture};
+  for (int unit = 0; unit < 4; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, inputs[unit]);
+  }
+  glBindImageTexture(0, litTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                     GL_RGBA8);
+  glDispatchCompute((width + kTileSize - 1) / kTileSize,
+                    (height + kTileSize - 1) / kTileSize, 1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  // Full-screen composite of the lit color and the G-buffer depth, filled
+  // even in wireframe mode
+  GLint polygonMode[2];
+  glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+  GLint depthFunc;
+  glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+  program = shaders.getProgram(compositeProgram);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "litMap"), 0);
+  glUniform1i(glGetUniformLocation(program, "depthMap"), 1);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, litTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glDepthFunc(GL_ALWAYS);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glDepthFunc(depthFunc);
+  glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+
+  for (int unit = 3; unit >= 0; --unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glUseProgram(0);
+  timers.end(timerSection);
+}
@@ -0,0 +1,74 @@
+// deferred_shading.h
+// Defines the G-buffer and tiled compute lighting of the deferred path
+
+#ifndef DEFERRED_SHADING_H
+#define DEFERRED_SHADING_H
+
+#include "clustered_lighting.h"
+#include "gpu_timers.h"
+#include "shader_manager.h"
+#include <GL/glew.h>
+#include <cstddef>
+
+// Deferred alternative to the clustered forward path. The terrain is drawn
+// once into a compact G-buffer:
+//   depth      D32F     view position reconstructed with the projection
+//   normal     RG16_SNORM octahedral view space normal
+//   albedo     RGBA8    tinted height color
+//   occlusion  RG8      sun visibility, ambient occlusion
+// and a compute pass then lights it in kTileSize x kTileSize tiles. Each
+// tile culls the lights of a ClusteredLighting against the view space box
+// of its depth range and shades its pixels with only those (at most 1024
+// per tile; more are dropped). The result and the G-buffer depth are
+// composited into the default framebuffer, so later forward draws depth
+// test against the terrain as usual.
+class DeferredShading {
+public:
+  static const int kTileSize = 16;
+
+  // Requires a current GL context
+  DeferredShading(ShaderManager &shaders, GpuTimers &timers);
+  ~DeferredShading();
+
+  // False when a deferred program failed to build
+  bool isAvailable() const;
+
+  // Bind the G-buffer, resized to the current viewport, and clear it.
+  // Draws until resolve() fill it.
+  void begin();
+
+  // Light the G-buffer with the lights of lighting, the fixed-function sun
+  // (GL_LIGHT0) and ambient light, under the current projection matrix,
+  // and composite the result into the default framebuffer
+  void resolve(const ClusteredLighting &lighting);
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  size_t getBytesPerPixel() const { return 4 + 4 + 4 + 2; }
+  size_t getGBufferBytes() const {
+    return static_cast<size_t>(width) * height * getBytesPerPixel();
+  }
+
+private:
+  const ShaderManager &shaders;
+  GpuTimers &timers;
+  int timerSection;
+  int lightingProgram;
+  int compositeProgram;
+
+  GLuint framebuffer;
+  GLuint depthTexture;
+  GLuint normalTexture;
+  GLuint albedoTexture;
+  GLuint occlusionTexture;
+  GLuint litTexture; // Compute pass output
+  int width;
+  int height;
+
+  void resize(int width, int height);
+
+  DeferredShading(const DeferredShading &) = delete;
+  DeferredShading &operator=(const DeferredShading &) = delete;
+};
+
+#endif // DEFERRED_SHADING_H
@@ -0,0 +1,16 @@
+#version 430 compatibility
+
+// Light gizmo cubes: one instance per light, transformed by the
+// fixed-function matrices
+
+layout(location = 0) in vec3 corner;
+layout(location = 1) in vec3 lightPosition; // Per instance
+layout(location = 2) in vec3 lightColor;    // Per instance
+
+out vec3 color;
+
+void main() {
+    color = lightColor;
+    gl_Position = gl_ModelViewProjectionMatrix *
+                  vec4(lightPosition + corner, 1.0);
+}
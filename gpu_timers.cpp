@@ -0,0 +1,96 @@
+// gpu_timers.cpp
+// Implements timestamp-query based GPU section timing
+
+#include "gpu_timers.h"
+
+GpuTimers::GpuTimers() : frame(0) {}
+
+GpuTimers::~GpuTimers() {
+  for (std::vector<Sample> &samples : frames) {
+    for (const Sample &sample : samples) {
+      freeQueries.push_back(sample.start);
+      freeQueries.push_back(sample.end);
+    }
+  }
+  if (!freeQueries.empty())
+    glDeleteQueries(static_cast<GLsizei>(freeQueries.size()),
+                    freeQueries.data());
+}
+
+void GpuTimers::newFrame() {
+  for (Section &section : sections) {
+    section.open = -1;
+  }
+  frame = (frame + 1) % kFrameLatency;
+  std::vector<Sample> &samples = frames[frame];
+  for (const Sample &sample : samples) {
+    if (sample.end != 0) {
+      GLuint64 start = 0;
+      GLuint64 end = 0;
+      glGetQueryObjectui64v(sample.start, GL_QUERY_RESULT, &start);
+      glGetQueryObjectui64v(sample.end, GL_QUERY_RESULT, &end);
+      sections[sample.section].total += (end - start) / 1.0e6;
+      sections[sample.section].count++;
+      freeQueries.push_back(sample.end);
+    }
+    freeQueries.push_back(sample.start);
+  }
+  samples.clear();
+}
+
+int GpuTimers::getSection(const std::string &name) {
+  for (size_t i = 0; i < sections.size(); ++i) {
+    if (sections[i].name == name)
+      return static_cast<int>(i);
+  }
+  Section section = {name, 0.0, 0, -1};
+  sections.push_back(section);
+  return static_cast<int>(sections.size()) - 1;
+}
+
+GLuint GpuTimers::takeQuery() {
+  if (freeQueries.empty()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+  GLuint query = freeQueries.back();
+  freeQueries.pop_back();
+  return query;
+}
+
+void GpuTimers::begin(int section) {
+  Sample sample = {section, takeQuery(), 0};
+  glQueryCounter(sample.start, GL_TIMESTAMP);
+  sections[section].open = static_cast<int>(frames[frame].size());
+  frames[frame].push_back(sample);
+}
+
+void GpuTimers::end(int section) {
+  int open = sections[section].open;
+  if (open < 0)
+    return;
+  Sample &sample = frames[frame][open];
+  sample.end = takeQuery();
+  glQueryCounter(sample.end, GL_TIMESTAMP);
+  sections[section].open = -1;
+}
+
+double GpuTimers::getAverage(int section) const {
+  const Section &s = sections[section];
+  return s.count > 0 ? s.total / s.count : 0.0;
+}
+
+void GpuTimers::report(std::ostream &out) const {
+  for (size_t i = 0; i < sections.size(); ++i) {
+    out << "  " << sections[i].name << ": "
+        << getAverage(static_cast<int>(i)) << " ms" << std::endl;
+  }
+}
+
+void GpuTimers::reset() {
+  for (Section &section : sections) {
+    section.total = 0.0;
+    section.count = 0;
+  }
+}
@@ -0,0 +1,63 @@
+// gpu_timers.h
+// Defines GpuTimers, which measures GPU time spent in named frame sections
+
+#ifndef GPU_TIMERS_H
+#define GPU_TIMERS_H
+
+#include <GL/glew.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// GPU time of named sections of a frame, measured with timestamp queries so
+// sections may nest. Results are read kFrameLatency frames after they were
+// issued, by which time the GPU has normally finished them, so reading them
+// does not stall the pipeline.
+class GpuTimers {
+public:
+  // Requires a current GL context
+  GpuTimers();
+  ~GpuTimers();
+
+  // Call once per frame before any begin(). Collects the results of the
+  // frame issued kFrameLatency frames ago.
+  void newFrame();
+
+  // Handle of the section called name, created on first use
+  int getSection(const std::string &name);
+  void begin(int section);
+  void end(int section);
+
+  // Average milliseconds per measurement since the last reset()
+  double getAverage(int section) const;
+  void report(std::ostream &out) const;
+  void reset();
+
+private:
+  static const int kFrameLatency = 4;
+
+  struct Section {
+    std::string name;
+    double total; // Milliseconds
+    int count;
+    int open; // Sample being measured in the current frame, or -1
+  };
+
+  struct Sample {
+    int section;
+    GLuint start;
+    GLuint end;
+  };
+
+  std::vector<Section> sections;
+  std::vector<Sample> frames[kFrameLatency];
+  std::vector<GLuint> freeQueries;
+  int frame;
+
+  GLuint takeQuery();
+
+  GpuTimers(const GpuTimers &) = delete;
+  GpuTimers &operator=(const GpuTimers &) = delete;
+};
+
+#endif // GPU_TIMERS_H
@@ -0,0 +1,22 @@
+// hash.h
+// Declares the 64-bit FNV-1a hash used to key the on-disk caches
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+const uint64_t kHashSeed = 14695981039346656037ull;
+
+// Fold size bytes at data into hash; start from kHashSeed
+inline uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#endif // HASH_H
@@ -0,0 +1,17 @@
+// height_grid.h
+// Defines the HeightGrid view of the terrain's generated vertex heights,
+// shared by the CPU query modules
+
+#ifndef HEIGHT_GRID_H
+#define HEIGHT_GRID_H
+
+// The grid has gridSize x gridSize vertices spaced step apart, starting at
+// world (offset, offset). Heights are row-major with z as the row.
+struct HeightGrid {
+  const float *heights;
+  int gridSize;
+  float step;
+  float offset;
+};
+
+#endif // HEIGHT_GRID_H
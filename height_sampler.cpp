@@ -0,0 +1,111 @@
+// height_sampler.cpp
+// Implements bilinear height lookups with an AVX2 gather batch path
+
+#include "height_sampler.h"
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEIGHT_SAMPLER_AVX2 1
+#include <immintrin.h>
+#endif
+
+float sampleHeightGrid(const HeightGrid &grid, float x, float z) {
+  int n = grid.gridSize;
+  if (n < 2)
+    return n == 1 ? grid.heights[0] : 0.0f;
+
+  // NaN fails every comparison and would reach the int conversion
+  // unclamped, so it is mapped to the first row or column, as the AVX2
+  // path's max does; infinities clamp like any other position.
+  float invStep = 1.0f / grid.step;
+  float limit = static_cast<float>(n - 1);
+  float gx = (x - grid.offset) * invStep;
+  float gz = (z - grid.offset) * invStep;
+  gx = gx > 0.0f ? std::min(gx, limit) : 0.0f;
+  gz = gz > 0.0f ? std::min(gz, limit) : 0.0f;
+  int ix = std::min(static_cast<int>(gx), n - 2);
+  int iz = std::min(static_cast<int>(gz), n - 2);
+  float fx = gx - static_cast<float>(ix);
+  float fz = gz - static_cast<float>(iz);
+
+  const float *row = grid.heights + static_cast<size_t>(iz) * n + ix;
+  float top = row[0] + (row[1] - row[0]) * fx;
+  float bottom = row[n] + (row[n + 1] - row[n]) * fx;
+  return top + (bottom - top) * fz;
+}
+
+#if defined(HEIGHT_SAMPLER_AVX2)
+// Compiled for AVX2 regardless of the global flags and only called after the
+// runtime check. Follows the scalar arithmetic step for step (no FMA) so both
+// paths round the same way.
+__attribute__((target("avx2"))) static int
+sampleBatchAVX2(const HeightGrid &grid, const float *xs, const float *zs,
+                float *out, int count) {
+  int n = grid.gridSize;
+  const __m256 offset = _mm256_set1_ps(grid.offset);
+  const __m256 invStep = _mm256_set1_ps(1.0f / grid.step);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 limit = _mm256_set1_ps(static_cast<float>(n - 1));
+  const __m256i lastCell = _mm256_set1_epi32(n - 2);
+  const __m256i rowStride = _mm256_set1_epi32(n);
+  const __m256i one = _mm256_set1_epi32(1);
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 gx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(xs + i), offset),
+                              invStep);
+    __m256 gz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(zs + i), offset),
+                              invStep);
+    // max returns its second operand for NaN lanes, so they clamp to zero
+    gx = _mm256_min_ps(_mm256_max_ps(gx, zero), limit);
+    gz = _mm256_min_ps(_mm256_max_ps(gz, zero), limit);
+    __m256i ix = _mm256_min_epi32(_mm256_cvttps_epi32(gx), lastCell);
+    __m256i iz = _mm256_min_epi32(_mm256_cvttps_epi32(gz), lastCell);
+    __m256 fx = _mm256_sub_ps(gx, _mm256_cvtepi32_ps(ix));
+    __m256 fz = _mm256_sub_ps(gz, _mm256_cvtepi32_ps(iz));
+
+    __m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(iz, rowStride), ix);
+    __m256i i01 = _mm256_add_epi32(i00, rowStride);
+    __m256 h00 = _mm256_i32gather_ps(grid.heights, i00, 4);
+    __m256 h10 = _mm256_i32gather_ps(grid.heights,
+                                     _mm256_add_epi32(i00, one), 4);
+    __m256 h01 = _mm256_i32gather_ps(grid.heights, i01, 4);
+    __m256 h11 = _mm256_i32gather_ps(grid.heights,
+                                     _mm256_add_epi32(i01, one), 4);
+
+    __m256 top =
+        _mm256_add_ps(h00, _mm256_mul_ps(_mm256_sub_ps(h10, h00), fx));
+    __m256 bottom =
+        _mm256_add_ps(h01, _mm256_mul_ps(_mm256_sub_ps(h11, h01), fx));
+    _mm256_storeu_ps(
+        out + i,
+        _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), fz)));
+  }
+  return i;
+}
+#endif
+
+bool heightSamplerUsesAVX2() {
+#if defined(HEIGHT_SAMPLER_AVX2)
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+void sampleHeightGridBatch(const HeightGrid &grid, const float *xs,
+                           const float *zs, float *out, int count) {
+  int i = 0;
+#if defined(HEIGHT_SAMPLER_AVX2)
+  // Gather offsets are 32-bit, enough for grids up to 46340 vertices a side
+  if (grid.gridSize >= 2 && grid.gridSize <= 46340 &&
+      heightSamplerUsesAVX2()) {
+    i = sampleBatchAVX2(grid, xs, zs, out, count);
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = sampleHeightGrid(grid, xs[i], zs[i]);
+  }
+}
@@ -0,0 +1,25 @@
+// height_sampler.h
+// Declares bilinear world-space height lookups on a height grid, one at a
+// time or in vectorized batches
+
+#ifndef HEIGHT_SAMPLER_H
+#define HEIGHT_SAMPLER_H
+
+#include "height_grid.h"
+
+// Height of the terrain surface at world (x, z), bilinearly interpolated
+// between the four surrounding vertices. Positions outside the grid clamp to
+// its edge; a NaN coordinate clamps to the grid's lower edge on that axis.
+float sampleHeightGrid(const HeightGrid &grid, float x, float z);
+
+// Batched form of sampleHeightGrid: out[i] is the height at (xs[i], zs[i]).
+// Processes eight samples per iteration with AVX2 gathers when the CPU
+// supports them and falls back to the scalar lookup otherwise. Results are
+// identical between the two paths.
+void sampleHeightGridBatch(const HeightGrid &grid, const float *xs,
+                           const float *zs, float *out, int count);
+
+// Whether sampleHeightGridBatch is using the AVX2 path on this machine
+bool heightSamplerUsesAVX2();
+
+#endif // HEIGHT_SAMPLER_H
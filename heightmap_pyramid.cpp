@@ -0,0 +1,148 @@
+// heightmap_pyramid.cpp
+// Implements building and sampling the prefiltered heightmap mip pyramid
+
+#include "heightmap_pyramid.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Fetch a texel with clamp-to-edge addressing
+float HeightmapPyramid::Level::texel(int x, int y) const {
+  x = std::min(std::max(x, 0), width - 1);
+  y = std::min(std::max(y, 0), height - 1);
+  return texels[static_cast<size_t>(y) * width + x];
+}
+
+void HeightmapPyramid::build(const unsigned char *data, int width,
+                             int height) {
+  levels.clear();
+  if (!data || width <= 0 || height <= 0)
+    return;
+
+  // Level 0 is the source image converted to normalized floats
+  levels.push_back(Level());
+  Level &base = levels.back();
+  base.width = width;
+  base.height = height;
+  base.texels.resize(static_cast<size_t>(width) * height);
+  for (size_t i = 0; i < base.texels.size(); ++i) {
+    base.texels[i] = data[i] / 255.0f;
+  }
+
+  // Reduce until a 1x1 level is reached
+  while (levels.back().width > 1 || levels.back().height > 1) {
+    Level next;
+    next.width = std::max(1, levels.back().width / 2);
+    next.height = std::max(1, levels.back().height / 2);
+    next.texels.resize(static_cast<size_t>(next.width) * next.height);
+    downsample(levels.back(), next);
+    levels.push_back(std::move(next));
+  }
+}
+
+// 2x2 box filter from src into dst. Sources with a dimension of 1 repeat
+// their only row/column; odd dimensions drop the last row/column like GL
+// mipmaps do.
+void HeightmapPyramid::downsample(const Level &src, Level &dst) {
+  parallelFor(0, dst.height, [&](int yBegin, int yEnd) {
+    for (int y = yBegin; y < yEnd; ++y) {
+      const float *row0 =
+          &src.texels[static_cast<size_t>(std::min(2 * y, src.height - 1)) *
+                      src.width];
+      const float *row1 =
+          &src.texels[static_cast<size_t>(
+                          std::min(2 * y + 1, src.height - 1)) *
+                      src.width];
+      float *out = &dst.texels[static_cast<size_t>(y) * dst.width];
+
+      int x = 0;
+#if defined(__SSE2__)
+      // Four output texels per iteration from eight source texels per row
+      if (src.width > 1) {
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        for (; x + 4 <= dst.width && 2 * x + 8 <= src.width; x += 4) {
+          __m128 sumLo = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x),
+                                    _mm_loadu_ps(row1 + 2 * x));
+          __m128 sumHi = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x + 4),
+                                    _mm_loadu_ps(row1 + 2 * x + 4));
+          __m128 even = _mm_shuffle_ps(sumLo, sumHi, _MM_SHUFFLE(2, 0, 2, 0));
+          __m128 odd = _mm_shuffle_ps(sumLo, sumHi, _MM_SHUFFLE(3, 1, 3, 1));
+          _mm_storeu_ps(out + x, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+        }
+      }
+#endif
+      for (; x < dst.width; ++x) {
+        int x0 = std::min(2 * x, src.width - 1);
+        int x1 = std::min(2 * x + 1, src.width - 1);
+        out[x] = 0.25f * (row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+      }
+    }
+  });
+}
+
+int HeightmapPyramid::selectLevel(float footprint) const {
+  if (footprint <= 1.0f || levels.empty())
+    return 0;
+  // Nearest level in log2 space, as GL does for GL_*_MIPMAP_NEAREST
+  int level = static_cast<int>(std::floor(std::log2(footprint) + 0.5f));
+  return std::min(level, getLevelCount() - 1);
+}
+
+float HeightmapPyramid::sampleBilinear(int level, float u, float v) const {
+  const Level &l = levels[level];
+  float fx = std::min(std::max(u, 0.0f), 1.0f) * (l.width - 1);
+  float fy = std::min(std::max(v, 0.0f), 1.0f) * (l.height - 1);
+  int x0 = static_cast<int>(fx);
+  int y0 = static_cast<int>(fy);
+  float tx = fx - x0;
+  float ty = fy - y0;
+
+  float top = l.texel(x0, y0) * (1.0f - tx) + l.texel(x0 + 1, y0) * tx;
+  float bottom =
+      l.texel(x0, y0 + 1) * (1.0f - tx) + l.texel(x0 + 1, y0 + 1) * tx;
+  return top * (1.0f - ty) + bottom * ty;
+}
+
+// Catmull-Rom weights for the four taps around a sample at fraction t
+static void catmullRomWeights(float t, float w[4]) {
+  float t2 = t * t;
+  float t3 = t2 * t;
+  w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+  w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+  w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+  w[3] = 0.5f * (t3 - t2);
+}
+
+float HeightmapPyramid::sampleBicubic(int level, float u, float v) const {
+  const Level &l = levels[level];
+  float fx = std::min(std::max(u, 0.0f), 1.0f) * (l.width - 1);
+  float fy = std::min(std::max(v, 0.0f), 1.0f) * (l.height - 1);
+  int x0 = static_cast<int>(fx);
+  int y0 = static_cast<int>(fy);
+
+  float wx[4], wy[4];
+  catmullRomWeights(fx - x0, wx);
+  catmullRomWeights(fy - y0, wy);
+
+  float result = 0.0f;
+  for (int j = 0; j < 4; ++j) {
+    float row = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+      row += wx[i] * l.texel(x0 - 1 + i, y0 - 1 + j);
+    }
+    result += wy[j] * row;
+  }
+
+  // Catmull-Rom can overshoot near sharp steps
+  return std::min(std::max(result, 0.0f), 1.0f);
+}
+
+float HeightmapPyramid::sample(int level, float u, float v,
+                               HeightFilter filter) const {
+  if (filter == HeightFilter::Bicubic)
+    return sampleBicubic(level, u, v);
+  return sampleBilinear(level, u, v);
+}
@@ -0,0 +1,48 @@
+// heightmap_pyramid.h
+// Defines the HeightmapPyramid class, a prefiltered mip chain of the heightmap
+// used to resample it at any grid resolution
+
+#ifndef HEIGHTMAP_PYRAMID_H
+#define HEIGHTMAP_PYRAMID_H
+
+#include <vector>
+
+// Reconstruction filter used when sampling a pyramid level
+enum class HeightFilter { Bilinear, Bicubic };
+
+class HeightmapPyramid {
+public:
+  // One level of the pyramid, heights normalized to [0, 1]
+  struct Level {
+    int width;
+    int height;
+    std::vector<float> texels;
+
+    float texel(int x, int y) const;
+  };
+
+  // Build the pyramid from an 8-bit single channel image. Each level is a
+  // 2x2 box-filtered reduction of the level below it.
+  void build(const unsigned char *data, int width, int height);
+
+  bool empty() const { return levels.empty(); }
+  int getLevelCount() const { return static_cast<int>(levels.size()); }
+  const Level &getLevel(int level) const { return levels[level]; }
+
+  // Pick the level whose texel spacing best matches a sample footprint given
+  // in level 0 texels
+  int selectLevel(float footprint) const;
+
+  // Sample a level at normalized coordinates (u, v) in [0, 1], where 0 and 1
+  // map to the centers of the first and last texel
+  float sampleBilinear(int level, float u, float v) const;
+  float sampleBicubic(int level, float u, float v) const;
+  float sample(int level, float u, float v, HeightFilter filter) const;
+
+private:
+  std::vector<Level> levels;
+
+  static void downsample(const Level &src, Level &dst);
+};
+
+#endif // HEIGHTMAP_PYRAMID_H
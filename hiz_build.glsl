@@ -0,0 +1,39 @@
+#version 430
+
+// One level of the Hi-Z pyramid (see chunk_culling.h). Level 0 copies
+// the occluder depth buffer; every further level keeps the farthest depth
+// of the 2x2 texels above it, taking in the extra row or column of an odd
+// sized level along its last texels so no texel is skipped.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D sourceMap;
+layout(r32f, binding = 0) writeonly uniform image2D pyramidLevel;
+
+uniform int sourceLevel;
+uniform bool downsample;
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(pyramidLevel);
+    if (any(greaterThanEqual(texel, size))) return;
+
+    if (!downsample) {
+        float depth = texelFetch(sourceMap, texel, 0).r;
+        imageStore(pyramidLevel, texel, vec4(depth));
+        return;
+    }
+
+    ivec2 sourceSize = textureSize(sourceMap, sourceLevel);
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(texel, size - 1)),
+                     sourceSize - 1);
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            depth = max(depth,
+                        texelFetch(sourceMap, ivec2(x, y), sourceLevel).r);
+        }
+    }
+    imageStore(pyramidLevel, texel, vec4(depth));
+}
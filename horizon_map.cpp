@@ -0,0 +1,263 @@
+// horizon_map.cpp
+// Implements horizon tracing and the packed horizon texture layout
+
+#include "horizon_map.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float kPi = 3.14159265358979f;
+
+// Border of the padded height copy: three lanes past the last vertex inside
+// the grid plus the bilinear neighbour
+const int kPadding = 4;
+
+// Trace distances in grid steps: every vertex up close, then growing by
+// kStepGrowth so distant ridges cost few samples
+const float kDenseSteps = 16.0f;
+const float kStepGrowth = 1.08f;
+
+// Distance along (dx, dz) at which the last of lanes vertices starting at x
+// leaves the grid
+float exitDistance(int n, int x, int z, int lanes, float dx, float dz) {
+  float limit = std::numeric_limits<float>::max();
+  if (dx > 0.0f)
+    limit = std::min(limit, (n - 1 - x) / dx);
+  else if (dx < 0.0f)
+    limit = std::min(limit, (x + lanes - 1) / -dx);
+  if (dz > 0.0f)
+    limit = std::min(limit, (n - 1 - z) / dz);
+  else if (dz < 0.0f)
+    limit = std::min(limit, z / -dz);
+  return limit;
+}
+
+// Unit step along azimuth 2 pi direction / count, with the components of
+// axis-aligned directions exactly zero
+glm::vec2 directionStep(int direction, int count) {
+  float azimuth = 2.0f * kPi * direction / count;
+  glm::vec2 step(std::cos(azimuth), std::sin(azimuth));
+  for (int axis = 0; axis < 2; ++axis) {
+    if (std::fabs(step[axis]) < 1e-6f)
+      step[axis] = 0.0f;
+  }
+  return step;
+}
+
+inline uint8_t quantize(float sine) {
+  return static_cast<uint8_t>(
+      std::lrint(std::min(std::max(sine, 0.0f), 1.0f) * 255.0f));
+}
+
+} // namespace
+
+HorizonMap::HorizonMap()
+    : gridSize(0), directionCount(0), buildTime(0.0), paddedWidth(0) {}
+
+void HorizonMap::build(const HeightGrid &grid, int directionCount) {
+  auto start = std::chrono::high_resolution_clock::now();
+  gridSize = grid.gridSize;
+  this->directionCount = std::max(2, directionCount & ~1);
+  horizon.assign(cellCount() * this->directionCount, 0);
+  ambient.assign(cellCount(), 255);
+  layers.clear();
+  if (gridSize < 2)
+    return;
+
+  int n = gridSize;
+  paddedWidth = n + 2 * kPadding;
+  padded.resize(static_cast<size_t>(paddedWidth) * paddedWidth);
+  for (int z = 0; z < paddedWidth; ++z) {
+    int sz = std::min(std::max(z - kPadding, 0), n - 1);
+    for (int x = 0; x < paddedWidth; ++x) {
+      int sx = std::min(std::max(x - kPadding, 0), n - 1);
+      padded[static_cast<size_t>(z) * paddedWidth + x] =
+          grid.heights[static_cast<size_t>(sz) * n + sx];
+    }
+  }
+
+  std::vector<float> steps;
+  for (float t = 1.0f; t < 1.5f * n;
+       t = t < kDenseSteps ? t + 1.0f : std::ceil(t * kStepGrowth)) {
+    steps.push_back(t);
+  }
+
+  int directions = this->directionCount;
+  parallelFor(0, n, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      for (int direction = 0; direction < directions; ++direction) {
+        int x = 0;
+        traceRowSIMD(grid, z, direction, steps, x);
+        for (; x < n; ++x) {
+          traceVertex(grid, x, z, direction, steps);
+        }
+      }
+
+      // Cosine-weighted visible fraction of each azimuthal slice is
+      // cos^2 of its horizon elevation
+      for (int x = 0; x < n; ++x) {
+        float visible = 0.0f;
+        for (int direction = 0; direction < directions; ++direction) {
+          float sine = horizonSine(x, z, direction);
+          visible += 1.0f - sine * sine;
+        }
+        ambient[cellIndex(x, z)] = quantize(visible / directions);
+      }
+    }
+  });
+  padded.clear();
+  padded.shrink_to_fit();
+
+  layers.resize(cellCount() * 4 * getLayerCount());
+  for (int layer = 0; layer < getLayerCount(); ++layer) {
+    const uint8_t *planes[3];
+    for (int channel = 0; channel < 3; ++channel) {
+      int direction = (2 * layer + channel) % directions;
+      planes[channel] = &horizon[direction * cellCount()];
+    }
+    uint8_t *out = &layers[layer * cellCount() * 4];
+    for (size_t i = 0; i < cellCount(); ++i) {
+      out[0] = planes[0][i];
+      out[1] = planes[1][i];
+      out[2] = planes[2][i];
+      out[3] = ambient[i];
+      out += 4;
+    }
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void HorizonMap::assign(int gridSize, int directionCount,
+                        const uint8_t *horizons, const uint8_t *ambient,
+                        const uint8_t *layers) {
+  auto start = std::chrono::high_resolution_clock::now();
+  this->gridSize = gridSize;
+  this->directionCount = directionCount;
+  horizon.assign(horizons, horizons + cellCount() * directionCount);
+  this->ambient.assign(ambient, ambient + cellCount());
+  this->layers.assign(layers, layers + cellCount() * 4 * getLayerCount());
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Bilinear height at grid coordinates (x, z) from the padded copy
+float HorizonMap::paddedHeight(float x, float z) const {
+  float fx = x + kPadding;
+  float fz = z + kPadding;
+  int ix = static_cast<int>(std::floor(fx));
+  int iz = static_cast<int>(std::floor(fz));
+  float wx = fx - ix;
+  float wz = fz - iz;
+  const float *row0 = &padded[static_cast<size_t>(iz) * paddedWidth + ix];
+  const float *row1 = row0 + paddedWidth;
+  float top = row0[0] + (row0[1] - row0[0]) * wx;
+  float bottom = row1[0] + (row1[1] - row1[0]) * wx;
+  return top + (bottom - top) * wz;
+}
+
+// Steepest rise seen from a vertex along one direction, up to the grid edge
+void HorizonMap::traceVertex(const HeightGrid &grid, int x, int z,
+                             int direction, const std::vector<float> &steps) {
+  glm::vec2 step = directionStep(direction, directionCount);
+  float dx = step.x;
+  float dz = step.y;
+  float limit = exitDistance(gridSize, x, z, 1, dx, dz);
+  float base = grid.heights[cellIndex(x, z)];
+
+  float maxTangent = 0.0f;
+  for (float t : steps) {
+    if (t > limit)
+      break;
+    float rise = paddedHeight(x + t * dx, z + t * dz) - base;
+    maxTangent = std::max(maxTangent, rise / (t * grid.step));
+  }
+  horizon[direction * cellCount() + cellIndex(x, z)] =
+      quantize(maxTangent / std::sqrt(1.0f + maxTangent * maxTangent));
+}
+
+// Four vertices per iteration starting at x. Neighbouring vertices sample
+// points exactly one column apart, so they share bilinear weights and each
+// corner is one unaligned load. Lanes whose sample has left the grid are
+// masked out until the last one leaves. Leaves x at the first vertex still
+// to be traced.
+void HorizonMap::traceRowSIMD(const HeightGrid &grid, int z, int direction,
+                              const std::vector<float> &steps, int &x) {
+#if defined(__SSE2__)
+  int n = gridSize;
+  glm::vec2 step = directionStep(direction, directionCount);
+  float dx = step.x;
+  float dz = step.y;
+  const float *row = grid.heights + static_cast<size_t>(z) * n;
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128 laneOffsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  const __m128 lastColumn = _mm_set1_ps(static_cast<float>(n - 1));
+  uint8_t *out = &horizon[direction * cellCount() + cellIndex(0, z)];
+
+  for (; x + 4 <= n; x += 4) {
+    float limit = exitDistance(n, x, z, 4, dx, dz);
+    __m128 base = _mm_loadu_ps(row + x);
+    __m128 maxTangent = _mm_setzero_ps();
+    for (float t : steps) {
+      if (t > limit)
+        break;
+      float fx = x + t * dx + kPadding;
+      float fz = z + t * dz + kPadding;
+      int ix = static_cast<int>(std::floor(fx));
+      int iz = static_cast<int>(std::floor(fz));
+      __m128 wx = _mm_set1_ps(fx - ix);
+      __m128 wz = _mm_set1_ps(fz - iz);
+      const float *row0 = &padded[static_cast<size_t>(iz) * paddedWidth + ix];
+      const float *row1 = row0 + paddedWidth;
+      __m128 a = _mm_loadu_ps(row0), b = _mm_loadu_ps(row0 + 1);
+      __m128 c = _mm_loadu_ps(row1), d = _mm_loadu_ps(row1 + 1);
+      __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+      __m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), wx));
+      __m128 height =
+          _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wz));
+      __m128 tangent = _mm_mul_ps(_mm_sub_ps(height, base),
+                                  _mm_set1_ps(1.0f / (t * grid.step)));
+      __m128 laneX = _mm_add_ps(_mm_set1_ps(x + t * dx), laneOffsets);
+      __m128 inside = _mm_and_ps(_mm_cmpge_ps(laneX, _mm_setzero_ps()),
+                                 _mm_cmple_ps(laneX, lastColumn));
+      maxTangent = _mm_max_ps(maxTangent, _mm_and_ps(inside, tangent));
+    }
+
+    __m128 sine = _mm_div_ps(
+        maxTangent,
+        _mm_sqrt_ps(_mm_add_ps(one, _mm_mul_ps(maxTangent, maxTangent))));
+    __m128i quantized = _mm_cvtps_epi32(_mm_mul_ps(sine, scale));
+    __m128i packed16 = _mm_packs_epi32(quantized, _mm_setzero_si128());
+    int packed8 = _mm_cvtsi128_si32(_mm_packus_epi16(packed16, packed16));
+    std::memcpy(out + x, &packed8, 4);
+  }
+#endif
+}
+
+void HorizonMap::sunLookup(const glm::vec3 &sunDirection, int &layer,
+                           glm::vec3 &weights) const {
+  float azimuth = std::atan2(sunDirection.z, sunDirection.x);
+  if (azimuth < 0.0f)
+    azimuth += 2.0f * kPi;
+  float position = azimuth / (2.0f * kPi) * directionCount;
+  int direction = static_cast<int>(position) % directionCount;
+  float blend = position - std::floor(position);
+
+  // Directions 2k and 2k + 1 are channels 0/1 of layer k; 2k + 1 and 2k + 2
+  // are channels 1/2
+  layer = direction / 2;
+  weights = glm::vec3(0.0f);
+  int channel = direction % 2;
+  weights[channel] = 1.0f - blend;
+  weights[channel + 1] = blend;
+}
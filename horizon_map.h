@@ -0,0 +1,94 @@
+// horizon_map.h
+// Defines the HorizonMap class holding precomputed per-vertex horizon angles
+// for terrain self-shadowing and ambient occlusion
+
+#ifndef HORIZON_MAP_H
+#define HORIZON_MAP_H
+
+#include "height_grid.h"
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// For every vertex, the elevation of the horizon seen along a fixed number
+// of azimuths, stored as its sine in 8 bits, plus the ambient occlusion
+// derived from them. The sun at any direction is visible from a vertex when
+// it is above the horizon interpolated between the two nearest azimuths.
+//
+// Texture layout: directionCount / 2 RGBA8 layers, layer k holding the
+// horizons of directions 2k, 2k + 1 and 2k + 2 (wrapping) and the ambient
+// occlusion. Any two neighbouring directions share a layer, so a shader
+// gets the sun's horizon and the occlusion from one filtered fetch.
+class HorizonMap {
+public:
+  static const int kDefaultDirections = 16;
+
+  HorizonMap();
+
+  // Trace the horizons of every vertex (directionCount must be even). Rows
+  // are split across worker threads and each row is traced four vertices
+  // at a time with SSE2 where available.
+  void build(const HeightGrid &grid,
+             int directionCount = kDefaultDirections);
+
+  // Take the horizons, occlusion and layers a previous build produced, such
+  // as a copy in the mesh cache, in the layouts the getters below return
+  void assign(int gridSize, int directionCount, const uint8_t *horizons,
+              const uint8_t *ambient, const uint8_t *layers);
+
+  bool empty() const { return ambient.empty(); }
+  int getGridSize() const { return gridSize; }
+  int getDirectionCount() const { return directionCount; }
+
+  // Direction d looks along azimuth 2 pi d / directionCount, measured from
+  // +x towards +z
+  float horizonSine(int x, int z, int direction) const {
+    return horizon[direction * cellCount() + cellIndex(x, z)] / 255.0f;
+  }
+  float ambientOcclusion(int x, int z) const {
+    return ambient[cellIndex(x, z)] / 255.0f;
+  }
+
+  // One plane of sines per direction, and the plane of occlusion
+  const std::vector<uint8_t> &getHorizons() const { return horizon; }
+  const std::vector<uint8_t> &getAmbient() const { return ambient; }
+
+  int getLayerCount() const { return directionCount / 2; }
+  const std::vector<uint8_t> &getLayers() const { return layers; }
+
+  // Layer and channel weights for a sun direction (world space, towards the
+  // sun): the horizon sine is dot(texel.rgb, weights)
+  void sunLookup(const glm::vec3 &sunDirection, int &layer,
+                 glm::vec3 &weights) const;
+
+  size_t getTextureBytes() const { return layers.size(); }
+  double getBuildTime() const { return buildTime; } // Milliseconds
+
+private:
+  int gridSize;
+  int directionCount;
+  std::vector<uint8_t> horizon; // One plane of sines per direction
+  std::vector<uint8_t> ambient;
+  std::vector<uint8_t> layers;
+  double buildTime;
+
+  // Heights with an edge-replicating border, so the four vertices traced
+  // together can sample just past the grid edge
+  std::vector<float> padded;
+  int paddedWidth;
+
+  size_t cellCount() const {
+    return static_cast<size_t>(gridSize) * gridSize;
+  }
+  size_t cellIndex(int x, int z) const {
+    return static_cast<size_t>(z) * gridSize + x;
+  }
+  float paddedHeight(float x, float z) const;
+  void traceVertex(const HeightGrid &grid, int x, int z, int direction,
+                   const std::vector<float> &steps);
+  void traceRowSIMD(const HeightGrid &grid, int z, int direction,
+                    const std::vector<float> &steps, int &x);
+};
+
+#endif // HORIZON_MAP_H
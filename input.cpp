@@ -1,6 +1,7 @@
 // input.cpp
 // Implements input handling functions
 
+#include <GL/glew.h>
 #include "input.h"
 #include "light.h"
 #include <iostream>
@@ -10,27 +11,25 @@
 bool leftMouseButtonPressed = false;
 float lastX = 400, lastY = 300;
 bool firstMouse = true;
+float lookOffsetX = 0.0f, lookOffsetY = 0.0f;
 
 // External light vector (defined in main.cpp)
 extern std::vector<Light> lights;
 
-void processInput(GLFWwindow *window, Camera &camera, float deltaTime,
-                  bool &wireframe, bool &wireframeKeyPressed,
-                  bool &showNormals) {
+void processInput(GLFWwindow *window, const glm::vec3 &cameraPosition,
+                  InputState &input, bool &wireframe,
+                  bool &wireframeKeyPressed, bool &showNormals) {
   // Check for exit
   if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
 
-  // Camera movement
-  float cameraSpeed = 2.5f * deltaTime;
-  if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-    camera.ProcessKeyboard(cameraSpeed, true, false, false, false);
-  if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-    camera.ProcessKeyboard(cameraSpeed, false, true, false, false);
-  if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-    camera.ProcessKeyboard(cameraSpeed, false, false, true, false);
-  if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-    camera.ProcessKeyboard(cameraSpeed, false, false, false, true);
+  // Camera movement, applied by the simulation thread
+  input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+  input.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+  input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+  input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+  input.lookX = lookOffsetX;
+  input.lookY = lookOffsetY;
 
   // Toggle wireframe mode
   if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
@@ -54,13 +53,25 @@ void processInput(GLFWwindow *window, Camera &camera, float deltaTime,
     normalKeyPressed = false;
   }
 
-  // Place new light at camera position
+  // Toggle terrain following
+  static bool followKeyPressed = false;
+  if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
+    if (!followKeyPressed) {
+      ++input.followToggles;
+      followKeyPressed = true;
+    }
+  } else {
+    followKeyPressed = false;
+  }
+
+  // Place new light at camera position. Intensity 25 gives a 50 unit
+  // radius, the width of the terrain.
   static bool lightKeyPressed = false;
   if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS) {
     if (!lightKeyPressed) {
-      lights.emplace_back(camera.Position, glm::vec3(1.0f, 1.0f, 1.0f), 1.0f);
-      std::cout << "Light placed at: " << camera.Position.x << ", "
-                << camera.Position.y << ", " << camera.Position.z << std::endl;
+      lights.emplace_back(cameraPosition, glm::vec3(1.0f, 1.0f, 1.0f), 25.0f);
+      std::cout << "Light placed at: " << cameraPosition.x << ", "
+                << cameraPosition.y << ", " << cameraPosition.z << std::endl;
       lightKeyPressed = true;
     }
   } else {
@@ -82,8 +93,9 @@ void mouseCallback(GLFWwindow *window, double xpos, double ypos) {
     lastX = xpos;
     lastY = ypos;
 
-    Camera *camera = static_cast<Camera *>(glfwGetWindowUserPointer(window));
-    camera->ProcessMouseMovement(xoffset, yoffset);
+    // The simulation thread owns the camera and applies the difference
+    lookOffsetX += xoffset;
+    lookOffsetY += yoffset;
   }
 }
 
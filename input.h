@@ -4,19 +4,40 @@
 #ifndef INPUT_H
 #define INPUT_H
 
-#include "camera.h"
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+// Input sampled on the render thread and handed to the simulation thread.
+// Look offsets are running totals, so no mouse movement is lost when the
+// simulation skips a sample.
+struct InputState {
+  bool forward;
+  bool backward;
+  bool left;
+  bool right;
+  float lookX;
+  float lookY;
+  unsigned int followToggles; // Presses of the terrain-following key so far
+
+  InputState()
+      : forward(false), backward(false), left(false), right(false),
+        lookX(0.0f), lookY(0.0f), followToggles(0) {}
+};
 
 // Global input state variables
 extern bool leftMouseButtonPressed;
 extern float lastX;
 extern float lastY;
 extern bool firstMouse;
+extern float lookOffsetX; // Total mouse movement while rotating
+extern float lookOffsetY;
 
-// Function to process keyboard input
-void processInput(GLFWwindow *window, Camera &camera, float deltaTime,
-                  bool &wireframe, bool &wireframeKeyPressed,
-                  bool &showNormals);
+// Function to process keyboard input. Camera movement is recorded in input;
+// wireframe, normal and light toggles are applied directly, placing lights
+// at cameraPosition.
+void processInput(GLFWwindow *window, const glm::vec3 &cameraPosition,
+                  InputState &input, bool &wireframe,
+                  bool &wireframeKeyPressed, bool &showNormals);
 
 // Callback function for mouse movement
 void mouseCallback(GLFWwindow *window, double xpos, double ypos);
@@ -24,4 +45,4 @@ void mouseCallback(GLFWwindow *window, double xpos, double ypos);
 // Callback function for mouse button events
 void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
 
-#endif // INPUT_H
\ No newline at end of file
+#endif // INPUT_H
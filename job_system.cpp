@@ -0,0 +1,305 @@
+// job_system.cpp
+// Implements the work-stealing deque and job scheduler
+
+#include "job_system.h"
+#include <algorithm>
+
+class Job {
+public:
+  explicit Job(std::function<void()> work)
+      : work(std::move(work)), unfinished(1), pending(1), finished(false) {}
+
+  std::function<void()> work;
+  JobRef parent;
+  JobRef self;                 // Keeps a submitted job alive until it ends
+  std::atomic<int> unfinished; // Own work plus unfinished children
+  std::atomic<int> pending;    // Unfinished dependencies plus the submit
+
+  std::mutex continuationMutex;
+  std::vector<JobRef> continuations; // Jobs depending on this one
+  bool finished;                     // Guarded by continuationMutex
+};
+
+namespace {
+
+// Scheduler and deque index of the calling worker thread
+thread_local const JobSystem *currentSystem = nullptr;
+thread_local int currentWorker = -1;
+
+// Idle rounds a worker spins through before going to sleep
+const int kSpinRounds = 64;
+
+} // namespace
+
+WorkStealingDeque::WorkStealingDeque() : top(0), bottom(0) {
+  for (std::atomic<Job *> &slot : jobs) {
+    slot.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+bool WorkStealingDeque::push(Job *job) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= kCapacity)
+    return false;
+  jobs[b & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+Job *WorkStealingDeque::pop() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+  if (t > b) {
+    // Empty
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Job *job = jobs[b & (kCapacity - 1)].load(std::memory_order_relaxed);
+  if (t == b) {
+    // Last job: race the thieves for it
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      job = nullptr;
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+Job *WorkStealingDeque::steal() {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b)
+    return nullptr;
+
+  Job *job = jobs[t & (kCapacity - 1)].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                   std::memory_order_relaxed))
+    return nullptr;
+  return job;
+}
+
+JobSystem::JobSystem(int threadCount)
+    : threadCount(std::max(threadCount, 1)), queuedJobs(0), sleepers(0),
+      stopping(false) {
+  for (int i = 1; i < this->threadCount; ++i) {
+    deques.emplace_back(new WorkStealingDeque());
+  }
+  for (int i = 0; i < this->threadCount - 1; ++i) {
+    workers.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+}
+
+// Jobs still queued are abandoned, so wait for them first
+JobSystem::~JobSystem() {
+  stopping.store(true);
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_all();
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+JobSystem &JobSystem::shared() {
+  static JobSystem system;
+  return system;
+}
+
+JobRef JobSystem::createJob(std::function<void()> work) {
+  return std::make_shared<Job>(std::move(work));
+}
+
+JobRef JobSystem::createChild(const JobRef &parent,
+                              std::function<void()> work) {
+  JobRef job = createJob(std::move(work));
+  parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+  job->parent = parent;
+  return job;
+}
+
+void JobSystem::addDependency(const JobRef &job, const JobRef &prerequisite) {
+  std::lock_guard<std::mutex> lock(prerequisite->continuationMutex);
+  if (prerequisite->finished)
+    return;
+  job->pending.fetch_add(1, std::memory_order_relaxed);
+  prerequisite->continuations.push_back(job);
+}
+
+void JobSystem::submit(const JobRef &job) {
+  job->self = job;
+  release(job.get());
+}
+
+bool JobSystem::isFinished(const JobRef &job) const {
+  return job->unfinished.load(std::memory_order_acquire) == 0;
+}
+
+void JobSystem::wait(const JobRef &job) {
+  while (!isFinished(job)) {
+    Job *next = findJob();
+    if (next)
+      execute(next);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void JobSystem::parallelFor(int begin, int end, int grain,
+                            const std::function<void(int, int)> &fn) {
+  if (end <= begin)
+    return;
+  grain = std::max(grain, 1);
+  if (threadCount == 1 || end - begin <= grain) {
+    fn(begin, end);
+    return;
+  }
+
+  JobRef group = createJob(nullptr);
+  splitRange(group, begin, end, grain, fn);
+  submit(group);
+  wait(group);
+}
+
+// Hand the upper half to the scheduler and keep splitting the lower half, so
+// thieves take the largest remaining ranges and split them further
+void JobSystem::splitRange(const JobRef &group, int begin, int end, int grain,
+                           const std::function<void(int, int)> &fn) {
+  while (end - begin > grain) {
+    int middle = begin + (end - begin) / 2;
+    submit(createChild(group, [this, group, middle, end, grain, &fn] {
+      splitRange(group, middle, end, grain, fn);
+    }));
+    end = middle;
+  }
+  fn(begin, end);
+}
+
+void JobSystem::workerLoop(int worker) {
+  currentSystem = this;
+  currentWorker = worker;
+
+  int idleRounds = 0;
+  while (!stopping.load(std::memory_order_acquire)) {
+    Job *job = findJob();
+    if (job) {
+      execute(job);
+      idleRounds = 0;
+      continue;
+    }
+    if (++idleRounds < kSpinRounds) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Sleepers are counted before queuedJobs is checked, and push() bumps
+    // queuedJobs before checking for sleepers, so a wakeup cannot be lost
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleepers.fetch_add(1);
+    wake.wait(lock,
+              [this] { return stopping.load() || queuedJobs.load() > 0; });
+    sleepers.fetch_sub(1);
+    idleRounds = 0;
+  }
+}
+
+// Queue a job whose dependencies have all finished
+void JobSystem::push(Job *job) {
+  queuedJobs.fetch_add(1);
+  if (currentSystem == this) {
+    if (!deques[currentWorker]->push(job)) {
+      // Deque full: run it here rather than grow
+      queuedJobs.fetch_sub(1);
+      execute(job);
+      return;
+    }
+  } else {
+    std::lock_guard<std::mutex> lock(injectionMutex);
+    injection.push_back(job);
+  }
+
+  if (sleepers.load() > 0) {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_one();
+  }
+}
+
+// Take a job from this worker's deque, the injection queue or another
+// worker, in that order
+Job *JobSystem::findJob() {
+  bool isWorker = currentSystem == this;
+  if (isWorker) {
+    Job *job = deques[currentWorker]->pop();
+    if (job) {
+      queuedJobs.fetch_sub(1);
+      return job;
+    }
+  }
+  if (queuedJobs.load(std::memory_order_relaxed) <= 0)
+    return nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(injectionMutex);
+    if (!injection.empty()) {
+      Job *job = injection.front();
+      injection.pop_front();
+      queuedJobs.fetch_sub(1);
+      return job;
+    }
+  }
+
+  int count = static_cast<int>(deques.size());
+  int start = isWorker ? currentWorker + 1 : 0;
+  for (int i = 0; i < count; ++i) {
+    int victim = (start + i) % count;
+    if (isWorker && victim == currentWorker)
+      continue;
+    Job *job = deques[victim]->steal();
+    if (job) {
+      queuedJobs.fetch_sub(1);
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+void JobSystem::execute(Job *job) {
+  if (job->work)
+    job->work();
+  finish(job);
+}
+
+// Drop one unit of outstanding work. The last one releases the job's
+// continuations and reports to its parent.
+void JobSystem::finish(Job *job) {
+  if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  std::vector<JobRef> continuations;
+  {
+    std::lock_guard<std::mutex> lock(job->continuationMutex);
+    job->finished = true;
+    continuations.swap(job->continuations);
+  }
+  for (const JobRef &continuation : continuations) {
+    release(continuation.get());
+  }
+
+  // The job may be destroyed when self goes out of scope
+  JobRef self = std::move(job->self);
+  JobRef parent = std::move(job->parent);
+  if (parent)
+    finish(parent.get());
+}
+
+// Drop one pending dependency (or the submit); the last one queues the job
+void JobSystem::release(Job *job) {
+  if (job->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    push(job);
+}
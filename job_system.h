@@ -0,0 +1,118 @@
+// job_system.h
+// Defines a work-stealing job scheduler for CPU-side terrain work
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use for CPU-side terrain work
+inline int workerCount() {
+  unsigned int hw = std::thread::hardware_concurrency();
+  return hw == 0 ? 1 : static_cast<int>(hw);
+}
+
+class Job;
+typedef std::shared_ptr<Job> JobRef;
+
+// Fixed-capacity Chase-Lev deque of jobs. The owning worker pushes and pops
+// at the bottom (newest first); any other thread steals from the top (oldest
+// first, which for recursively split ranges are the largest pieces).
+class WorkStealingDeque {
+public:
+  WorkStealingDeque();
+
+  // Owner only. push() returns false when the deque is full.
+  bool push(Job *job);
+  Job *pop();
+
+  // Any thread. Returns nullptr when empty or when another thief won.
+  Job *steal();
+
+private:
+  static const int64_t kCapacity = 1024; // Power of two
+
+  std::atomic<int64_t> top;
+  std::atomic<int64_t> bottom;
+  std::atomic<Job *> jobs[kCapacity];
+};
+
+// Work-stealing job scheduler. Each worker thread owns a deque; jobs pushed
+// by a worker go on its own deque, jobs submitted from other threads go on a
+// shared injection queue, and idle workers steal from each other. A thread
+// waiting for a job runs other jobs meanwhile, so jobs may wait on jobs.
+//
+// A job finishes when its work and all its children have finished. Jobs
+// added as dependencies of another job must all finish before it runs;
+// together with children this expresses task graphs and continuations.
+class JobSystem {
+public:
+  // threadCount counts the thread that waits on the jobs, so threadCount - 1
+  // workers are started. With one thread, jobs run when they are waited on.
+  explicit JobSystem(int threadCount = workerCount());
+  ~JobSystem();
+
+  // Scheduler shared by the terrain modules, sized to the hardware
+  static JobSystem &shared();
+
+  int getThreadCount() const { return threadCount; }
+
+  // Create a job that runs work (which may be empty). A child keeps parent
+  // from finishing until the child has finished; children must be created
+  // before their parent finishes, normally from inside the parent's work.
+  JobRef createJob(std::function<void()> work);
+  JobRef createChild(const JobRef &parent, std::function<void()> work);
+
+  // Run job only after prerequisite has finished (a continuation of
+  // prerequisite). Must be called before job is submitted.
+  void addDependency(const JobRef &job, const JobRef &prerequisite);
+
+  // Queue job to run once its dependencies have finished
+  void submit(const JobRef &job);
+
+  // Run other jobs until job has finished
+  void wait(const JobRef &job);
+  bool isFinished(const JobRef &job) const;
+
+  // Call fn(rangeBegin, rangeEnd) over [begin, end) split recursively into
+  // ranges of at most grain items, and return once all have run
+  void parallelFor(int begin, int end, int grain,
+                   const std::function<void(int, int)> &fn);
+
+private:
+  int threadCount;
+  std::vector<std::unique_ptr<WorkStealingDeque>> deques; // One per worker
+  std::vector<std::thread> workers;
+
+  std::mutex injectionMutex;
+  std::deque<Job *> injection; // Jobs submitted from non-worker threads
+
+  // Idle workers sleep until queuedJobs is non-zero
+  std::atomic<int> queuedJobs;
+  std::atomic<int> sleepers;
+  std::atomic<bool> stopping;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+
+  void workerLoop(int worker);
+  void push(Job *job);
+  Job *findJob();
+  void execute(Job *job);
+  void finish(Job *job);
+  void release(Job *job);
+  void splitRange(const JobRef &group, int begin, int end, int grain,
+                  const std::function<void(int, int)> &fn);
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+};
+
+#endif // JOB_SYSTEM_H
@@ -1,41 +1,118 @@
 // light.cpp
-// Implements the renderCube function for visualizing light sources
+// Implements the instanced light gizmo renderer
 
 #include "light.h"
-#include <GL/glew.h>
-
-void renderCube() {
-  // Render a small cube to represent the light source
-  glBegin(GL_QUADS);
-  // Front face
-  glVertex3f(-0.1f, -0.1f, 0.1f);
-  glVertex3f(0.1f, -0.1f, 0.1f);
-  glVertex3f(0.1f, 0.1f, 0.1f);
-  glVertex3f(-0.1f, 0.1f, 0.1f);
-  // Back face
-  glVertex3f(-0.1f, -0.1f, -0.1f);
-  glVertex3f(-0.1f, 0.1f, -0.1f);
-  glVertex3f(0.1f, 0.1f, -0.1f);
-  glVertex3f(0.1f, -0.1f, -0.1f);
-  // Top face
-  glVertex3f(-0.1f, 0.1f, -0.1f);
-  glVertex3f(-0.1f, 0.1f, 0.1f);
-  glVertex3f(0.1f, 0.1f, 0.1f);
-  glVertex3f(0.1f, 0.1f, -0.1f);
-  // Bottom face
-  glVertex3f(-0.1f, -0.1f, -0.1f);
-  glVertex3f(0.1f, -0.1f, -0.1f);
-  glVertex3f(0.1f, -0.1f, 0.1f);
-  glVertex3f(-0.1f, -0.1f, 0.1f);
-  // Right face
-  glVertex3f(0.1f, -0.1f, -0.1f);
-  glVertex3f(0.1f, 0.1f, -0.1f);
-  glVertex3f(0.1f, 0.1f, 0.1f);
-  glVertex3f(0.1f, -0.1f, 0.1f);
-  // Left face
-  glVertex3f(-0.1f, -0.1f, -0.1f);
-  glVertex3f(-0.1f, -0.1f, 0.1f);
-  glVertex3f(-0.1f, 0.1f, 0.1f);
-  glVertex3f(-0.1f, 0.1f, -0.1f);
-  glEnd();
-}
\ No newline at end of file
+#include "shader_manager.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+
+const float kHalfSize = 0.1f;
+
+// Cube corners, indexed by bit 0 = x, bit 1 = y, bit 2 = z
+const GLfloat kCubeVertices[] = {
+    -kHalfSize, -kHalfSize, -kHalfSize, kHalfSize,  -kHalfSize, -kHalfSize,
+    -kHalfSize, kHalfSize,  -kHalfSize, kHalfSize,  kHalfSize,  -kHalfSize,
+    -kHalfSize, -kHalfSize, kHalfSize,  kHalfSize,  -kHalfSize, kHalfSize,
+    -kHalfSize, kHalfSize,  kHalfSize,  kHalfSize,  kHalfSize,  kHalfSize};
+
+// Two counter-clockwise triangles per face
+const GLushort kCubeIndices[] = {
+    4, 5, 7, 4, 7, 6, // Front (+z)
+    1, 0, 2, 1, 2, 3, // Back (-z)
+    2, 6, 7, 2, 7, 3, // Top (+y)
+    0, 1, 5, 0, 5, 4, // Bottom (-y)
+    1, 3, 7, 1, 7, 5, // Right (+x)
+    0, 4, 6, 0, 6, 2  // Left (-x)
+};
+
+const GLsizei kCubeIndexCount = sizeof(kCubeIndices) / sizeof(kCubeIndices[0]);
+
+} // namespace
+
+LightGizmos::LightGizmos(ShaderManager &shaders)
+    : shaders(shaders), program(-1), vertexArray(0), cubeBuffer(0),
+      cubeIndexBuffer(0), instanceBuffer(0), instanceCapacity(0) {
+  program = shaders.loadProgram(
+      "light_gizmo", {{GL_VERTEX_SHADER, "gizmo_vertex.glsl"},
+                      {GL_FRAGMENT_SHADER, "gizmo_fragment.glsl"}});
+
+  glGenVertexArrays(1, &vertexArray);
+  glGenBuffers(1, &cubeBuffer);
+  glGenBuffers(1, &cubeIndexBuffer);
+  glGenBuffers(1, &instanceBuffer);
+  glBindVertexArray(vertexArray);
+
+  // Attribute 0: cube corner
+  glBindBuffer(GL_ARRAY_BUFFER, cubeBuffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(kCubeVertices), kCubeVertices,
+               GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+  // Attributes 1 and 2: light position and color, advanced once per cube
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                        reinterpret_cast<void *>(offsetof(Instance, position)));
+  glVertexAttribDivisor(1, 1);
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                        reinterpret_cast<void *>(offsetof(Instance, color)));
+  glVertexAttribDivisor(2, 1);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIndexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kCubeIndices), kCubeIndices,
+               GL_STATIC_DRAW);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+LightGizmos::~LightGizmos() {
+  glDeleteVertexArrays(1, &vertexArray);
+  glDeleteBuffers(1, &cubeBuffer);
+  glDeleteBuffers(1, &cubeIndexBuffer);
+  glDeleteBuffers(1, &instanceBuffer);
+}
+
+void LightGizmos::update(const std::vector<Light> &lights) {
+  bool changed = lights.size() != instances.size();
+  for (size_t i = 0; i < lights.size() && !changed; ++i) {
+    changed = lights[i].position != instances[i].position ||
+              lights[i].color != instances[i].color;
+  }
+  if (!changed)
+    return;
+
+  instances.resize(lights.size());
+  for (size_t i = 0; i < lights.size(); ++i) {
+    instances[i].position = lights[i].position;
+    instances[i].color = lights[i].color;
+  }
+
+  // Grow the store geometrically; otherwise overwrite it in place
+  GLsizeiptr bytes = instances.size() * sizeof(Instance);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  if (bytes > instanceCapacity) {
+    instanceCapacity = std::max(bytes, instanceCapacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity, nullptr, GL_DYNAMIC_DRAW);
+  }
+  if (bytes > 0)
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void LightGizmos::render() const {
+  GLuint id = shaders.getProgram(program);
+  if (id == 0 || instances.empty())
+    return;
+
+  glUseProgram(id);
+  glBindVertexArray(vertexArray);
+  glDrawElementsInstanced(GL_TRIANGLES, kCubeIndexCount, GL_UNSIGNED_SHORT,
+                          nullptr, static_cast<GLsizei>(instances.size()));
+  glBindVertexArray(0);
+  glUseProgram(0);
+}
@@ -1,22 +1,90 @@
 // light.h
-// Defines the Light structure and declares the renderCube function
+// Defines the Light structure and the LightGizmos class, which draws a small
+// cube at every light
 
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
+#include <vector>
 
-// Structure to represent a light source
+class ShaderManager;
+
+// Fraction of full brightness below which a light is treated as reaching
+// nothing
+const float kLightCutoff = 0.01f;
+
+// Distance at which inverse-square falloff from intensity drops to
+// kLightCutoff
+inline float lightRadius(float intensity) {
+  return std::sqrt(std::max(intensity, 0.0f) / kLightCutoff);
+}
+
+// Structure to represent a light source. Illuminance falls off with the
+// inverse square of distance, windowed to reach exactly zero at radius:
+//   intensity / d^2 * clamp(1 - (d / radius)^4, 0, 1)^2
 struct Light {
   glm::vec3 position;
   glm::vec3 color;
   float intensity;
+  float radius;
 
   Light(glm::vec3 pos, glm::vec3 col = glm::vec3(1.0f), float intens = 1.0f)
-      : position(pos), color(col), intensity(intens) {}
+      : position(pos), color(col), intensity(intens),
+        radius(lightRadius(intens)) {}
+  Light(glm::vec3 pos, glm::vec3 col, float intens, float rad)
+      : position(pos), color(col), intensity(intens), radius(rad) {}
 };
 
-// Function to render a cube (used for visualizing light sources)
-void renderCube();
+// World-space axis-aligned box that lights are culled against
+struct BoundingBox {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// True if the light's radius reaches into box
+inline bool lightReaches(const Light &light, const BoundingBox &box) {
+  glm::vec3 nearest = glm::clamp(light.position, box.min, box.max);
+  glm::vec3 offset = light.position - nearest;
+  return glm::dot(offset, offset) <= light.radius * light.radius;
+}
+
+// Light visualization: one static cube mesh drawn once per light in a single
+// instanced draw call, with each light's position and color in a
+// per-instance buffer
+class LightGizmos {
+public:
+  // Requires a current GL context
+  explicit LightGizmos(ShaderManager &shaders);
+  ~LightGizmos();
+
+  // Re-upload the instance buffer if lights differ from the last upload
+  void update(const std::vector<Light> &lights);
+
+  // Draw the cubes with the current fixed-function matrices
+  void render() const;
+
+private:
+  // Per-instance attributes, tightly packed
+  struct Instance {
+    glm::vec3 position;
+    glm::vec3 color;
+  };
+
+  ShaderManager &shaders;
+  int program;
+  GLuint vertexArray;
+  GLuint cubeBuffer;
+  GLuint cubeIndexBuffer;
+  GLuint instanceBuffer;
+  GLsizeiptr instanceCapacity; // Bytes allocated in instanceBuffer
+  std::vector<Instance> instances;
+
+  LightGizmos(const LightGizmos &) = delete;
+  LightGizmos &operator=(const LightGizmos &) = delete;
+};
 
-#endif // LIGHT_H
\ No newline at end of file
+#endif // LIGHT_H
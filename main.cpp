@@ -2,11 +2,21 @@
 // Main entry point for the terrain renderer application
 
 #include <GL/glew.h>
+#include "benchmark.h"
 #include "camera.h"
+#include "chunk_culling.h"
+#include "clustered_lighting.h"
+#include "deferred_shading.h"
+#include "gpu_timers.h"
 #include "input.h"
 #include "light.h"
+#include "path_planner.h"
+#include "shader_manager.h"
+#include "shadow_cascades.h"
+#include "simulation.h"
 #include "terrain.h"
 #include "window.h"
+#include <algorithm>
 #include <chrono>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -15,6 +25,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <iomanip>
 #include <iostream>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -28,6 +39,9 @@ bool wireframeKeyPressed = false;
 bool showNormals = false;
 std::vector<Light> lights;
 
+// Direction towards the sun, in world space
+const glm::vec3 sunDirection = glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f));
+
 // Callback function for window resize
 void framebufferSizeCallback(GLFWwindow *window, int width, int height) {
   glViewport(0, 0, width, height);
@@ -39,15 +53,79 @@ struct PerformanceMetrics {
   double averageFrameTime;
   double averageNormalCalcTime;
   int triangleCount;
+  double simulationUtilization; // Fraction of wall time spent working
+  double renderUtilization;
+  double averageLightChunkPairs; // Lights reaching each chunk, summed over
+                                 // all chunks, culled ones included
+  double averageSubmitTime; // CPU time of the terrain's render(), in ms
 };
 
-// Function to run performance test
+// Load the packet's camera matrices into the fixed-function stacks and aim
+// the sun (GL_LIGHT0, directional) through them
+void loadFrameMatrices(const FramePacket &frame) {
+  glMatrixMode(GL_PROJECTION);
+  glLoadMatrixf(glm::value_ptr(frame.projection));
+  glMatrixMode(GL_MODELVIEW);
+  glLoadMatrixf(glm::value_ptr(frame.view));
+  GLfloat sunPosition[] = {sunDirection.x, sunDirection.y, sunDirection.z,
+                           0.0f};
+  glLightfv(GL_LIGHT0, GL_POSITION, sunPosition);
+}
+
+// Make the terrain normals current for frame. Packets from the simulation
+// thread usually arrive with CPU normals already in a ring region;
+// otherwise they are computed here. Returns the normal calculation time in
+// ms, or a negative value if no calculation belongs to this frame.
+double prepareNormals(Terrain &terrain, const FramePacket &frame,
+                      bool freshFrame) {
+  if (frame.normalRegion >= 0) {
+    terrain.setNormalRegion(frame.normalRegion);
+    return freshFrame ? frame.normalTime : -1.0;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  terrain.computeNormals();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Upload lights for frame's view: the froxel grid and chunk light lists for
+// the forward path, only the lights for the deferred path, which needs
+// neither
+void updateLighting(ClusteredLighting &lighting, const Terrain &terrain,
+                    const std::vector<Light> &frameLights,
+                    const FramePacket &frame) {
+  if (terrain.usesDeferredShading()) {
+    lighting.updateLights(frameLights, frame.view);
+  } else {
+    lighting.update(frameLights, frame.view, frame.projection,
+                    terrain.getChunkBounds());
+  }
+}
+
+// Hand the current framebuffer size to the simulation, which builds the
+// projection of the next packets
+void updateFramebufferSize(Window &window, Simulation &simulation) {
+  int width, height;
+  glfwGetFramebufferSize(window.getWindow(), &width, &height);
+  simulation.setFramebufferSize(width, height);
+}
+
+// Function to run performance test. The simulation must be started; it is
+// stopped at the end so its utilization can be reported.
 PerformanceMetrics runPerformanceTest(Window &window, Terrain &terrain,
-                                      int duration, bool &wireframe,
-                                      bool &showNormals) {
+                                      Simulation &simulation,
+                                      ClusteredLighting &lighting,
+                                      ShadowCascades &shadows,
+                                      GpuTimers &timers, int duration,
+                                      bool &wireframe, bool &showNormals) {
   int frameCount = 0;
+  int normalCount = 0;
   double totalFrameTime = 0.0;
+  double totalSwapTime = 0.0;
   double totalNormalCalcTime = 0.0;
+  double totalLightChunkPairs = 0.0;
+  double totalSubmitTime = 0.0;
+  int terrainSection = timers.getSection("Terrain");
   auto startTime = std::chrono::high_resolution_clock::now();
 
   while (true) {
@@ -81,39 +159,46 @@ PerformanceMetrics runPerformanceTest(Window &window, Terrain &terrain,
     } else {
       normalKeyPressed = false;
     }
+    updateFramebufferSize(window, simulation);
+
+    // Take the newest packet from the simulation thread
+    bool freshFrame = simulation.acquireFrame();
+    const FramePacket &frame = simulation.getFrame();
+    terrain.pollNormalFences();
+    timers.newFrame();
+
+    double normalTime = prepareNormals(terrain, frame, freshFrame);
+    if (normalTime >= 0.0) {
+      totalNormalCalcTime += normalTime;
+      normalCount++;
+    }
 
-    window.clear();
-
-    // Set up projection matrix
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glm::mat4 projection =
-        glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
-    glLoadMatrixf(glm::value_ptr(projection));
-
-    // Set up view matrix
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glm::mat4 view = camera.GetViewMatrix();
-    glLoadMatrixf(glm::value_ptr(view));
-
-    // Compute normals and measure the time taken
-    auto normalStartTime = std::chrono::high_resolution_clock::now();
-    terrain.computeNormals();
-    auto normalEndTime = std::chrono::high_resolution_clock::now();
-    auto normalCalcDuration =
-        std::chrono::duration_cast<std::chrono::microseconds>(normalEndTime -
-                                                              normalStartTime);
-    totalNormalCalcTime += normalCalcDuration.count() / 1000000.0;
+    if (terrain.getSunShadows() == SunShadows::ShadowMaps) {
+      shadows.update(frame.view, frame.projection, sunDirection, terrain);
+      shadows.render(terrain);
+    }
 
+    window.clear();
+    loadFrameMatrices(frame);
+    updateLighting(lighting, terrain, lights, frame);
+    totalLightChunkPairs += lighting.getChunkPairCount();
+    timers.begin(terrainSection);
+    auto submitStartTime = std::chrono::high_resolution_clock::now();
     terrain.render();
+    auto submitEndTime = std::chrono::high_resolution_clock::now();
+    timers.end(terrainSection);
+    totalSubmitTime += std::chrono::duration<double, std::milli>(
+                           submitEndTime - submitStartTime)
+                           .count();
 
+    auto swapStartTime = std::chrono::high_resolution_clock::now();
     window.swapBuffers();
 
     auto frameEndTime = std::chrono::high_resolution_clock::now();
-    auto frameDuration = std::chrono::duration_cast<std::chrono::microseconds>(
-        frameEndTime - frameStartTime);
-    totalFrameTime += frameDuration.count() / 1000000.0;
+    totalFrameTime +=
+        std::chrono::duration<double>(frameEndTime - frameStartTime).count();
+    totalSwapTime +=
+        std::chrono::duration<double>(frameEndTime - swapStartTime).count();
 
     frameCount++;
 
@@ -123,6 +208,7 @@ PerformanceMetrics runPerformanceTest(Window &window, Terrain &terrain,
       break;
     }
   }
+  simulation.stop();
 
   // Calculate and return performance metrics
   PerformanceMetrics metrics;
@@ -130,24 +216,130 @@ PerformanceMetrics runPerformanceTest(Window &window, Terrain &terrain,
   metrics.averageFrameTime =
       totalFrameTime / frameCount * 1000.0; // in milliseconds
   metrics.averageNormalCalcTime =
-      totalNormalCalcTime / frameCount * 1000.0; // in milliseconds
+      normalCount > 0 ? totalNormalCalcTime / normalCount : 0.0;
   metrics.triangleCount = terrain.getTriangleCount();
+  metrics.averageLightChunkPairs = totalLightChunkPairs / frameCount;
+  metrics.averageSubmitTime = totalSubmitTime / frameCount;
+  metrics.simulationUtilization = simulation.getUtilization();
+  // Time blocked in the buffer swap is the render thread's idle time
+  metrics.renderUtilization = (totalFrameTime - totalSwapTime) / totalFrameTime;
 
   return metrics;
 }
 
+// Time frames drawn from frame's viewpoint with increasing numbers of random
+// point lights above the terrain, on the forward and the deferred path.
+// Frames are finished with glFinish so the time includes the GPU lighting
+// cost.
+void runLightingBenchmark(Window &window, Terrain &terrain,
+                          ClusteredLighting &lighting,
+                          const DeferredShading &deferred,
+                          const FramePacket &frame) {
+  const int lightCounts[] = {0, 16, 64, 256, 1024, 4096};
+  const int framesPerCount = 100;
+  std::mt19937 rng(1234);
+  float halfSize = terrain.getWorldSize() / 2.0f;
+  std::uniform_real_distribution<float> coordinate(-halfSize, halfSize);
+  std::uniform_real_distribution<float> lift(0.5f, 3.0f);
+  std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+  std::uniform_real_distribution<float> intensity(0.05f, 0.5f);
+
+  std::cout << "Clustered Lighting (" << ClusteredLighting::kTilesX << "x"
+            << ClusteredLighting::kTilesY << "x" << ClusteredLighting::kSlices
+            << " froxels) vs. Deferred Lighting ("
+            << DeferredShading::kTileSize << "x" << DeferredShading::kTileSize
+            << " pixel tiles)" << std::endl;
+  std::vector<ShadingPath> paths = {ShadingPath::Forward};
+  if (deferred.isAvailable())
+    paths.push_back(ShadingPath::Deferred);
+  ShadingPath initialPath = terrain.getShadingPath();
+
+  std::vector<Light> benchmarkLights;
+  for (int count : lightCounts) {
+    while (static_cast<int>(benchmarkLights.size()) < count) {
+      float x = coordinate(rng);
+      float z = coordinate(rng);
+      benchmarkLights.push_back(
+          Light(glm::vec3(x, terrain.sampleHeight(x, z) + lift(rng), z),
+                glm::vec3(channel(rng), channel(rng), channel(rng)),
+                intensity(rng)));
+    }
+
+    // Each path only pays for the light lists it reads: the froxel and
+    // chunk lists are built on the forward path alone
+    double frameTimes[2] = {0.0, 0.0};
+    double buildTimes[2] = {0.0, 0.0};
+    size_t indexCount = 0;
+    size_t chunkPairCount = 0;
+    for (size_t path = 0; path < paths.size(); ++path) {
+      terrain.setShadingPath(paths[path]);
+      for (int i = 0; i < framesPerCount; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        window.clear();
+        loadFrameMatrices(frame);
+        updateLighting(lighting, terrain, benchmarkLights, frame);
+        terrain.render();
+        glFinish();
+        auto end = std::chrono::high_resolution_clock::now();
+        frameTimes[path] +=
+            std::chrono::duration<double, std::milli>(end - start).count();
+        buildTimes[path] += lighting.getBuildTime();
+        window.swapBuffers();
+        window.pollEvents();
+      }
+      if (paths[path] == ShadingPath::Forward) {
+        indexCount = lighting.getIndexCount();
+        chunkPairCount = lighting.getChunkPairCount();
+      }
+    }
+    std::cout << "  " << std::setw(5) << count << " lights: forward "
+              << frameTimes[0] / framesPerCount << " ms (cluster build "
+              << buildTimes[0] / framesPerCount << " ms)";
+    if (paths.size() > 1)
+      std::cout << ", deferred " << frameTimes[1] / framesPerCount
+                << " ms (light upload " << buildTimes[1] / framesPerCount
+                << " ms)";
+    std::cout << ", " << indexCount << " light indices, " << chunkPairCount
+              << " light-chunk pairs" << std::endl;
+  }
+  terrain.setShadingPath(initialPath);
+  if (paths.size() > 1)
+    std::cout << "Deferred G-buffer: " << deferred.getWidth() << "x"
+              << deferred.getHeight() << ", " << deferred.getBytesPerPixel()
+              << " bytes per pixel ("
+              << deferred.getGBufferBytes() / 1024 << " KB)" << std::endl;
+}
+
 int main(int argc, char *argv[]) {
   // Parse command line arguments
   if (argc < 2) {
     std::cout << "Usage: " << argv[0]
-              << " <heightmap_path> [--performance] [--cpu-only]" << std::endl;
+              << " <heightmap_path> [--performance] [--cpu-only] [--bicubic]"
+              << std::endl;
     return -1;
   }
   std::string heightmapPath = argv[1];
-  bool runPerformanceMode =
-      (argc > 2 && std::string(argv[2]) == "--performance");
-  bool useCPUOnly = (argc > 2 && std::string(argv[2]) == "--cpu-only") ||
-                    (argc > 3 && std::string(argv[3]) == "--cpu-only");
+  auto hasFlag = [argc, argv](const std::string &flag) {
+    for (int i = 2; i < argc; ++i) {
+      if (flag == argv[i])
+        return true;
+    }
+    return false;
+  };
+  auto flagValue = [argc, argv](const std::string &flag,
+                                const std::string &fallback) {
+    for (int i = 2; i + 1 < argc; ++i) {
+      if (flag == argv[i])
+        return std::string(argv[i + 1]);
+    }
+    return fallback;
+  };
+  bool runPerformanceMode = hasFlag("--performance");
+  bool useCPUOnly = hasFlag("--cpu-only");
+  bool useBicubic = hasFlag("--bicubic");
+  bool useMeshCache = !hasFlag("--no-mesh-cache");
+  bool useRG8Normals = hasFlag("--rg8-normals");
+  std::string palettePath = flagValue("--palette", "terrain_palette.txt");
 
   // Initialize window
   Window window(800, 600, "Terrain Renderer");
@@ -161,19 +353,70 @@ int main(int argc, char *argv[]) {
   glfwSetCursorPosCallback(window.getWindow(), mouseCallback);
   glfwSetMouseButtonCallback(window.getWindow(), mouseButtonCallback);
   glfwSetInputMode(window.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-  glfwSetWindowUserPointer(window.getWindow(), &camera);
+
+  // Shader programs are built from source or from the on-disk binary cache
+  ShaderManager shaders;
 
   // Initialize terrain
   Terrain terrain(200);
   terrain.setUseCPUOnly(useCPUOnly);
-  if (!terrain.loadHeightmap(heightmapPath)) {
-    std::cerr << "Failed to load heightmap. Exiting." << std::endl;
-    return -1;
+  terrain.setHeightFilter(useBicubic ? HeightFilter::Bicubic
+                                     : HeightFilter::Bilinear);
+  terrain.setNormalFormat(useRG8Normals ? NormalMap::Format::RG8
+                                        : NormalMap::Format::RG16);
+  TerrainPalette palette;
+  if (!palette.load(palettePath)) {
+    std::cerr << "Using the default terrain palette" << std::endl;
   }
+  terrain.setPalette(palette);
+
+  // A cached mesh for this heightmap skips decoding and generation entirely
+  const std::string meshCacheDirectory = "mesh_cache";
+  auto loadStart = std::chrono::high_resolution_clock::now();
+  if (useMeshCache &&
+      terrain.loadCachedMesh(heightmapPath, meshCacheDirectory)) {
+    auto loadEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Terrain Load Time (mesh cache): "
+              << std::chrono::duration<double, std::milli>(loadEnd -
+                                                           loadStart)
+                     .count()
+              << " ms" << std::endl;
+  } else {
+    if (!terrain.loadHeightmap(heightmapPath)) {
+      std::cerr << "Failed to load heightmap. Exiting." << std::endl;
+      return -1;
+    }
 
-  terrain.generate();
-  terrain.initComputeShader();
+    auto generateStart = std::chrono::high_resolution_clock::now();
+    terrain.generate();
+    auto generateEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Terrain Load Time (decode + generate): "
+              << std::chrono::duration<double, std::milli>(generateEnd -
+                                                           loadStart)
+                     .count()
+              << " ms" << std::endl;
+    std::cout << "Terrain Generation Time: "
+              << std::chrono::duration<double, std::milli>(generateEnd -
+                                                           generateStart)
+                     .count()
+              << " ms" << std::endl;
+    if (useMeshCache &&
+        !terrain.saveCachedMesh(heightmapPath, meshCacheDirectory)) {
+      std::cerr << "Failed to write the mesh cache" << std::endl;
+    }
+  }
+  terrain.initShaders(shaders);
+  LightGizmos gizmos(shaders);
+  GpuTimers timers;
+  DeferredShading deferred(shaders, timers);
+  terrain.setDeferredShading(&deferred);
+  ChunkCulling culling(shaders, timers);
+  terrain.setChunkCulling(&culling);
+  std::cout << "Shader Startup Time: " << shaders.getLoadTime() << " ms ("
+            << shaders.getCompiledCount() << " compiled, "
+            << shaders.getCachedCount() << " from cache)" << std::endl;
   terrain.setShowNormals(showNormals);
+  camera.SetTerrain(&terrain);
 
   // Set up OpenGL state
   glEnable(GL_DEPTH_TEST);
@@ -181,96 +424,328 @@ int main(int argc, char *argv[]) {
   glEnable(GL_LIGHT0);
   glEnable(GL_COLOR_MATERIAL);
 
-  GLfloat lightPos[] = {50.0f, 50.0f, 50.0f, 1.0f};
-  glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
   glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
 
+  // Placed lights reach the terrain through per-froxel light lists; GL_LIGHT0
+  // remains the sun, shadowed by the horizon map built with the mesh or by
+  // cascaded shadow maps
+  ClusteredLighting lighting;
+  terrain.setLighting(&lighting);
+  ShadowCascades shadows(timers);
+  terrain.setShadows(&shadows);
+  terrain.setSunDirection(sunDirection);
+  const NormalMap &normalMap = terrain.getNormalMap();
+  std::cout << "Normal Map: " << normalMap.getWidth() << "x"
+            << normalMap.getHeight() << " built or loaded in "
+            << normalMap.getBuildTime() << " ms; VRAM RG8 "
+            << normalMap.getTextureBytes(NormalMap::Format::RG8) / 1024
+            << " KB, RG16 "
+            << normalMap.getTextureBytes(NormalMap::Format::RG16) / 1024
+            << " KB (using " << (useRG8Normals ? "RG8" : "RG16")
+            << "), RGBA32F would be "
+            << static_cast<size_t>(normalMap.getWidth()) *
+                   normalMap.getHeight() * 16 / 1024
+            << " KB" << std::endl;
+  const HorizonMap &horizonMap = terrain.getHorizonMap();
+  std::cout << "Horizon Map Build Time: " << horizonMap.getBuildTime()
+            << " ms (" << horizonMap.getDirectionCount() << " directions, "
+            << horizonMap.getTextureBytes() / 1024 << " KB)" << std::endl;
+
+  // From here on the camera belongs to the simulation thread; this thread
+  // only polls input and draws the packets it produces
+  Simulation simulation(camera, terrain, useCPUOnly);
+  updateFramebufferSize(window, simulation);
+  simulation.start();
+
   if (runPerformanceMode) {
     // Run performance test
     std::cout << "Running performance test..." << std::endl;
     std::cout << "Press 'P' to toggle wireframe mode" << std::endl;
     std::cout << "Press 'N' to toggle normal visualization" << std::endl;
-    PerformanceMetrics metrics = runPerformanceTest(
-        window, terrain, 30, wireframe, showNormals); // Run for 30 seconds
 
-    // Print performance metrics
-    std::cout << std::fixed << std::setprecision(2);
-    std::cout << "Average FPS: " << metrics.averageFPS << std::endl;
-    std::cout << "Average Frame Time: " << metrics.averageFrameTime << " ms"
-              << std::endl;
-    std::cout << "Average Normal Calculation Time: "
-              << metrics.averageNormalCalcTime << " ms" << std::endl;
-    std::cout << "Triangle Count: " << metrics.triangleCount << std::endl;
+    // Time both sun shadow techniques: the precomputed horizon map and the
+    // cascaded shadow maps rendered every frame
+    const SunShadows sunModes[] = {SunShadows::HorizonMap,
+                                   SunShadows::ShadowMaps};
+    SunShadows initialSunShadows = terrain.getSunShadows();
+    for (SunShadows sunMode : sunModes) {
+      terrain.setSunShadows(sunMode);
+      culling.resetStats();
+      timers.reset();
+      simulation.start(); // Stopped at the end of the previous segment
+      PerformanceMetrics metrics =
+          runPerformanceTest(window, terrain, simulation, lighting, shadows,
+                             timers, 15, wireframe,
+                             showNormals); // Run for 15 seconds
+
+      // Print performance metrics
+      std::cout << std::fixed << std::setprecision(2);
+      std::cout << "Sun Shadows: "
+                << (sunMode == SunShadows::HorizonMap
+                        ? "horizon map (precomputed)"
+                        : "cascaded shadow maps (per frame)")
+                << std::endl;
+      std::cout << "Average FPS: " << metrics.averageFPS << std::endl;
+      std::cout << "Average Frame Time: " << metrics.averageFrameTime << " ms"
+                << std::endl;
+      std::cout << "Average Normal Calculation Time: "
+                << metrics.averageNormalCalcTime << " ms" << std::endl;
+      std::cout << "Triangle Count: " << metrics.triangleCount << std::endl;
+      std::cout << "Average Light-Chunk Pairs: "
+                << metrics.averageLightChunkPairs << " per frame (over all "
+                << terrain.getChunkCount() << " chunks, culled included)"
+                << std::endl;
+      std::cout << "Average Terrain Submission Time (CPU): "
+                << metrics.averageSubmitTime << " ms" << std::endl;
+      if (culling.isAvailable() && !useCPUOnly) {
+        std::cout << "Average Chunks Culled: "
+                  << culling.getAverageOccluded() << " occluded, "
+                  << culling.getAverageFrustumCulled()
+                  << " outside the frustum (of " << culling.getChunkCount()
+                  << ")" << std::endl;
+        std::cout << "Average Chunks Drawn per Level of Detail:";
+        for (int lod = 0; lod < culling.getLodCount(); ++lod) {
+          std::cout << " " << culling.getAverageDrawn(lod);
+        }
+        std::cout << " (one "
+                  << (culling.hasDrawCount()
+                          ? "glMultiDrawElementsIndirectCount"
+                          : "glMultiDrawElementsIndirect")
+                  << " call)" << std::endl;
+      }
+      std::cout << "Simulation Thread Utilization: "
+                << metrics.simulationUtilization * 100.0 << " %" << std::endl;
+      std::cout << "Render Thread Utilization: "
+                << metrics.renderUtilization * 100.0 << " %" << std::endl;
+      std::cout << "GPU Timings (average per frame):" << std::endl;
+      timers.report(std::cout);
+    }
+    terrain.setSunShadows(initialSunShadows);
+
+    double coldStartup, warmStartup;
+    shaders.measureStartup(coldStartup, warmStartup);
+    std::cout << "Shader Startup (cold, from source): " << coldStartup
+              << " ms" << std::endl;
+    std::cout << "Shader Startup (warm, from binary cache): " << warmStartup
+              << " ms" << std::endl;
+
+    runLightingBenchmark(window, terrain, lighting, deferred,
+                         simulation.getFrame());
+    runTerrainBenchmarks(terrain);
   } else {
     // Normal rendering mode
+    auto plannerStart = std::chrono::high_resolution_clock::now();
+    PathPlanner planner;
+    planner.build(terrain.getHeightGrid());
+    auto plannerEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Path Planner Build Time: "
+              << std::chrono::duration<double, std::milli>(plannerEnd -
+                                                           plannerStart)
+                     .count()
+              << " ms (" << planner.getAbstractNodeCount()
+              << " entrance nodes)" << std::endl;
+    int pathStart = -1;
+
+    // Edits to shader sources are picked up without restarting
+    shaders.enableHotReload();
+
     int frameCount = 0;
+    int normalCount = 0;
     double totalNormalCalculationTime = 0.0;
     auto lastTime = std::chrono::high_resolution_clock::now();
+    InputState input;
 
     while (!window.shouldClose()) {
-      // Calculate delta time
-      float currentFrame = glfwGetTime();
-      static float lastFrame = 0.0f;
-      float deltaTime = currentFrame - lastFrame;
-      lastFrame = currentFrame;
+      // Take the newest packet from the simulation thread; tools below act
+      // on the camera it was built with
+      bool freshFrame = simulation.acquireFrame();
+      const FramePacket &frame = simulation.getFrame();
+      terrain.pollNormalFences();
 
       // Process input
-      processInput(window.getWindow(), camera, deltaTime, wireframe,
-                   wireframeKeyPressed, showNormals);
+      processInput(window.getWindow(), frame.cameraPosition, input,
+                   wireframe, wireframeKeyPressed, showNormals);
+      simulation.submitInput(input);
+      updateFramebufferSize(window, simulation);
       terrain.setShowNormals(showNormals);
+      shaders.update();
+
+      // Pick the terrain point the camera is looking at
+      static bool pickButtonPressed = false;
+      if (glfwGetMouseButton(window.getWindow(), GLFW_MOUSE_BUTTON_RIGHT) ==
+          GLFW_PRESS) {
+        if (!pickButtonPressed) {
+          RaycastHit hit =
+              terrain.raycast(frame.cameraPosition, frame.cameraFront);
+          if (hit.hit) {
+            std::cout << "Picked terrain at: " << hit.point.x << ", "
+                      << hit.point.y << ", " << hit.point.z << " (cell "
+                      << hit.cellX << ", " << hit.cellZ << ")" << std::endl;
+          } else {
+            std::cout << "No terrain under the view direction" << std::endl;
+          }
+          pickButtonPressed = true;
+        }
+      } else {
+        pickButtonPressed = false;
+      }
 
-      window.clear();
+      // Toggle the viewshed from the vertex under the camera
+      static bool viewshedKeyPressed = false;
+      static bool viewshedShown = false;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_V) == GLFW_PRESS) {
+        if (!viewshedKeyPressed) {
+          viewshedShown = !viewshedShown;
+          if (viewshedShown) {
+            glm::vec2 cell = terrain.worldToGrid(frame.cameraPosition.x,
+                                                 frame.cameraPosition.z);
+            int x = static_cast<int>(cell.x + 0.5f);
+            int z = static_cast<int>(cell.y + 0.5f);
+            x = std::min(std::max(x, 0), terrain.getGridSize() - 1);
+            z = std::min(std::max(z, 0), terrain.getGridSize() - 1);
+            float ground = terrain.gridToWorld(x, z).y;
+            Viewshed viewshed;
+            viewshed.compute(terrain.getHeightGrid(), x, z,
+                             std::max(frame.cameraPosition.y - ground, 0.1f));
+            terrain.setViewshed(viewshed);
+            std::cout << "Viewshed: " << viewshed.getVisibleCount()
+                      << " visible vertices" << std::endl;
+          } else {
+            terrain.clearViewshed();
+          }
+          viewshedKeyPressed = true;
+        }
+      } else {
+        viewshedKeyPressed = false;
+      }
 
-      // Set up projection matrix
-      glMatrixMode(GL_PROJECTION);
-      glLoadIdentity();
-      glm::mat4 projection =
-          glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
-      glLoadMatrixf(glm::value_ptr(projection));
-
-      // Set up view matrix
-      glMatrixMode(GL_MODELVIEW);
-      glLoadIdentity();
-      glm::mat4 view = camera.GetViewMatrix();
-      glLoadMatrixf(glm::value_ptr(view));
-
-      // Set up lights
-      for (size_t i = 0; i < lights.size(); ++i) {
-        GLenum lightEnum = GL_LIGHT0 + i;
-        glEnable(lightEnum);
-        GLfloat lightPos[] = {lights[i].position.x, lights[i].position.y,
-                              lights[i].position.z, 1.0f};
-        glLightfv(lightEnum, GL_POSITION, lightPos);
-        GLfloat lightColor[] = {lights[i].color.r, lights[i].color.g,
-                                lights[i].color.b, 1.0f};
-        glLightfv(lightEnum, GL_DIFFUSE, lightColor);
-        glLightf(lightEnum, GL_CONSTANT_ATTENUATION,
-                 1.0f / lights[i].intensity);
+      // Cycle the slope/aspect raster overlay
+      static bool overlayKeyPressed = false;
+      static int overlay = 0;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_O) == GLFW_PRESS) {
+        if (!overlayKeyPressed) {
+          overlay = (overlay + 1) % 3;
+          terrain.setRasterOverlay(static_cast<RasterOverlay>(overlay));
+          overlayKeyPressed = true;
+        }
+      } else {
+        overlayKeyPressed = false;
       }
 
-      // Compute normals and measure the time taken
-      auto start = std::chrono::high_resolution_clock::now();
-      terrain.computeNormals();
-      auto end = std::chrono::high_resolution_clock::now();
-      auto duration =
-          std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+      // Path planning: the first press marks the start under the camera, the
+      // second plans from there to the camera position
+      static bool pathKeyPressed = false;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_G) == GLFW_PRESS) {
+        if (!pathKeyPressed) {
+          glm::vec2 cell = terrain.worldToGrid(frame.cameraPosition.x,
+                                               frame.cameraPosition.z);
+          int x = static_cast<int>(cell.x + 0.5f);
+          int z = static_cast<int>(cell.y + 0.5f);
+          x = std::min(std::max(x, 0), terrain.getGridSize() - 1);
+          z = std::min(std::max(z, 0), terrain.getGridSize() - 1);
+          if (pathStart < 0) {
+            pathStart = z * terrain.getGridSize() + x;
+            terrain.clearPath();
+            std::cout << "Path start set" << std::endl;
+          } else {
+            auto start = std::chrono::high_resolution_clock::now();
+            PathPlanner::Result path = planner.findPath(
+                pathStart % terrain.getGridSize(),
+                pathStart / terrain.getGridSize(), x, z,
+                PathPlanner::Mode::Hierarchical);
+            auto end = std::chrono::high_resolution_clock::now();
+            if (path.found) {
+              terrain.setPath(planner.toWorld(path, 0.05f));
+              std::cout << "Path planned in "
+                        << std::chrono::duration<double, std::milli>(end -
+                                                                     start)
+                               .count()
+                        << " ms (cost " << path.cost << ")" << std::endl;
+            } else {
+              std::cout << "No path found" << std::endl;
+            }
+            pathStart = -1;
+          }
+          pathKeyPressed = true;
+        }
+      } else {
+        pathKeyPressed = false;
+      }
+
+      // Switch between forward and deferred shading
+      static bool shadingKeyPressed = false;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_R) == GLFW_PRESS) {
+        if (!shadingKeyPressed) {
+          bool forward = terrain.getShadingPath() == ShadingPath::Forward;
+          terrain.setShadingPath(forward ? ShadingPath::Deferred
+                                         : ShadingPath::Forward);
+          std::cout << "Shading: "
+                    << (forward ? "deferred (tiled compute lighting)"
+                                : "clustered forward")
+                    << std::endl;
+          shadingKeyPressed = true;
+        }
+      } else {
+        shadingKeyPressed = false;
+      }
+
+      // Switch the sun between the shadow maps and the horizon map
+      static bool sunShadowKeyPressed = false;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_H) == GLFW_PRESS) {
+        if (!sunShadowKeyPressed) {
+          bool horizon = terrain.getSunShadows() == SunShadows::HorizonMap;
+          terrain.setSunShadows(horizon ? SunShadows::ShadowMaps
+                                        : SunShadows::HorizonMap);
+          std::cout << "Sun shadows: "
+                    << (horizon ? "cascaded shadow maps" : "horizon map")
+                    << std::endl;
+          sunShadowKeyPressed = true;
+        }
+      } else {
+        sunShadowKeyPressed = false;
+      }
+
+      // Toggle the Hi-Z occlusion test of the terrain chunks
+      static bool occlusionKeyPressed = false;
+      if (glfwGetKey(window.getWindow(), GLFW_KEY_C) == GLFW_PRESS) {
+        if (!occlusionKeyPressed) {
+          bool use = !culling.getOcclusionTest();
+          culling.setOcclusionTest(use);
+          std::cout << "Occlusion test: " << (use ? "on" : "off")
+                    << std::endl;
+          occlusionKeyPressed = true;
+        }
+      } else {
+        occlusionKeyPressed = false;
+      }
 
-      totalNormalCalculationTime += duration.count();
+      // Sun shadow maps for this view
+      timers.newFrame();
+      if (terrain.getSunShadows() == SunShadows::ShadowMaps) {
+        shadows.update(frame.view, frame.projection, sunDirection, terrain);
+        shadows.render(terrain);
+      }
+
+      window.clear();
+      loadFrameMatrices(frame);
+
+      // Assign the placed lights to froxels for this view
+      updateLighting(lighting, terrain, lights, frame);
+
+      // Compute normals (or take the packet's) and record the time taken
+      double normalTime = prepareNormals(terrain, frame, freshFrame);
+      if (normalTime >= 0.0) {
+        totalNormalCalculationTime += normalTime;
+        normalCount++;
+      }
       frameCount++;
 
       // Render terrain
       terrain.render();
 
       // Render light cubes
-      glDisable(GL_LIGHTING);
-      for (const auto &light : lights) {
-        glPushMatrix();
-        glTranslatef(light.position.x, light.position.y, light.position.z);
-        glColor3f(light.color.r, light.color.g, light.color.b);
-        renderCube();
-        glPopMatrix();
-      }
-      glEnable(GL_LIGHTING);
+      gizmos.update(lights);
+      gizmos.render();
 
       window.swapBuffers();
       window.pollEvents();
@@ -282,12 +757,19 @@ int main(int argc, char *argv[]) {
 
       if (frameDuration.count() >= 1) {
         double fps = frameCount / frameDuration.count();
-        double avgNormalCalcTime = totalNormalCalculationTime / frameCount /
-                                   1000.0; // Convert to milliseconds
+        double avgNormalCalcTime =
+            normalCount > 0 ? totalNormalCalculationTime / normalCount : 0.0;
         std::cout << "FPS: " << fps
                   << " | Avg Normal Calc Time: " << avgNormalCalcTime << " ms"
-                  << std::endl;
+                  << " | Light-Chunk Pairs: " << lighting.getChunkPairCount();
+        if (culling.isAvailable() && !useCPUOnly) {
+          std::cout << " | Chunks Drawn: " << culling.getLastDrawn() << "/"
+                    << culling.getChunkCount() << " ("
+                    << culling.getLastOccluded() << " occluded)";
+        }
+        std::cout << std::endl;
         frameCount = 0;
+        normalCount = 0;
         totalNormalCalculationTime = 0;
         lastTime = currentTime;
       }
@@ -0,0 +1,156 @@
+// mesh_cache.cpp
+// Implements reading (via mmap) and writing the terrain mesh cache
+
+#include "mesh_cache.h"
+#include "hash.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const int kSectionCount = static_cast<int>(MeshCacheSection::Count);
+
+struct MeshCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t gridSize;
+  uint32_t reserved;
+  MeshCacheInfo info;
+  uint64_t sectionBytes[kSectionCount]; // Before padding
+};
+
+static_assert(sizeof(MeshCacheHeader) % 8 == 0, "cache header has padding");
+
+const char kMeshCacheMagic[4] = {'T', 'M', 'S', 'H'};
+
+// Sections start on 8-byte boundaries, so every array is aligned inside the
+// page-aligned mapping
+size_t paddedBytes(uint64_t bytes) { return (bytes + 7) & ~uint64_t(7); }
+
+// Map a whole file read-only. Returns nullptr for missing or empty files.
+void *mapFile(const std::string &path, size_t &size) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  void *mapping = nullptr;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    size = static_cast<size_t>(info.st_size);
+    mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+      mapping = nullptr;
+  }
+  ::close(fd);
+  return mapping;
+}
+
+} // namespace
+
+MeshCacheFile::MeshCacheFile() : mapping(nullptr), mappingSize(0) { close(); }
+
+MeshCacheFile::~MeshCacheFile() { close(); }
+
+bool MeshCacheFile::open(const std::string &path, uint64_t key,
+                         int gridSize) {
+  close();
+  mapping = mapFile(path, mappingSize);
+  if (!mapping)
+    return false;
+
+  const MeshCacheHeader *header =
+      static_cast<const MeshCacheHeader *>(mapping);
+  bool valid = mappingSize >= sizeof(MeshCacheHeader) &&
+               std::memcmp(header->magic, kMeshCacheMagic,
+                           sizeof(kMeshCacheMagic)) == 0 &&
+               header->version == kMeshCacheVersion && header->key == key &&
+               header->gridSize == static_cast<uint32_t>(gridSize);
+  // Bound each size first so a corrupt header cannot overflow the total
+  size_t total = sizeof(MeshCacheHeader);
+  for (int i = 0; valid && i < kSectionCount; ++i) {
+    valid = header->sectionBytes[i] <= mappingSize;
+    total += paddedBytes(header->sectionBytes[i]);
+  }
+  if (!valid || total != mappingSize) {
+    close();
+    return false;
+  }
+
+  info = header->info;
+  const char *data =
+      static_cast<const char *>(mapping) + sizeof(MeshCacheHeader);
+  for (int i = 0; i < kSectionCount; ++i) {
+    sections[i].data = data;
+    sections[i].bytes = header->sectionBytes[i];
+    data += paddedBytes(header->sectionBytes[i]);
+  }
+
+  // Every section is about to be uploaded or copied, so start paging the
+  // whole file in now
+  madvise(mapping, mappingSize, MADV_WILLNEED);
+  return true;
+}
+
+void MeshCacheFile::close() {
+  if (mapping)
+    munmap(mapping, mappingSize);
+  mapping = nullptr;
+  mappingSize = 0;
+  info = MeshCacheInfo();
+  for (MeshCacheArray &section : sections) {
+    section.data = nullptr;
+    section.bytes = 0;
+  }
+}
+
+bool writeMeshCache(const std::string &path, uint64_t key, int gridSize,
+                    const MeshCacheInfo &info,
+                    const MeshCacheArray *sections) {
+  MeshCacheHeader header;
+  std::memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+  header.version = kMeshCacheVersion;
+  header.key = key;
+  header.gridSize = static_cast<uint32_t>(gridSize);
+  header.reserved = 0;
+  header.info = info;
+  for (int i = 0; i < kSectionCount; ++i) {
+    header.sectionBytes[i] = sections[i].bytes;
+  }
+
+  // Write next to the target and rename over it, so a reader never maps a
+  // half-written file
+  std::string temporary = path + ".tmp";
+  FILE *file = std::fopen(temporary.c_str(), "wb");
+  if (!file)
+    return false;
+  const char padding[8] = {};
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  for (int i = 0; written && i < kSectionCount; ++i) {
+    size_t bytes = sections[i].bytes;
+    size_t pad = paddedBytes(bytes) - bytes;
+    written = (bytes == 0 ||
+               std::fwrite(sections[i].data, 1, bytes, file) == bytes) &&
+              std::fwrite(padding, 1, pad, file) == pad;
+  }
+  written = std::fclose(file) == 0 && written;
+  if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool hashFile(const std::string &path, uint64_t seed, uint64_t &hash) {
+  size_t size = 0;
+  void *mapping = mapFile(path, size);
+  if (!mapping)
+    return false;
+  hash = hashBytes(seed, mapping, size);
+  munmap(mapping, size);
+  return true;
+}
@@ -0,0 +1,96 @@
+// mesh_cache.h
+// Defines the on-disk cache of generated, GPU-ready terrain meshes
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Bump whenever generation output changes for the same inputs (sections,
+// normals, index order, derived structures) so stale caches are regenerated
+const uint32_t kMeshCacheVersion = 5;
+
+// Arrays stored in a cache file, in file order: everything generate()
+// produces, so a cache hit derives nothing
+enum class MeshCacheSection {
+  Vertices,      // 3 floats per vertex
+  Normals,       // 3 floats per vertex
+  Indices,       // Level 0 of every chunk
+  Heights,       // 1 float per vertex
+  NormalMap,     // Heightmap-resolution normal map texels
+  HeightBounds,  // MinMaxPyramid::store() output
+  Slope,         // TerrainRasters arrays
+  Aspect,
+  Curvature,
+  Horizons,      // HorizonMap arrays
+  Ambient,
+  HorizonLayers,
+  Chunks,        // Terrain chunk tables
+  ChunkParts,
+  ChunkMaxLods,
+  ChunkBounds,
+  LodIndices,    // Coarser chunk levels
+  Count
+};
+
+// Bytes of one section, written from or mapped at data
+struct MeshCacheArray {
+  const void *data;
+  size_t bytes;
+};
+
+// Sizes of the arrays that do not follow from the grid size
+struct MeshCacheInfo {
+  uint32_t normalMapWidth;
+  uint32_t normalMapHeight;
+  uint32_t normalMapTexelBytes;
+  uint32_t horizonDirections;
+};
+
+// Read-only memory mapping of a cache file. The file holds a fixed header
+// with the size of every section, followed by the sections, each laid out
+// exactly as it is uploaded or held in memory and padded to 8 bytes.
+class MeshCacheFile {
+public:
+  MeshCacheFile();
+  ~MeshCacheFile();
+
+  // Map path and validate it against key and gridSize. Returns false, with
+  // nothing mapped, if the file is missing, truncated, from another format
+  // version or built from different inputs. Section sizes are left to the
+  // reader to check.
+  bool open(const std::string &path, uint64_t key, int gridSize);
+  void close();
+
+  bool isOpen() const { return mapping != nullptr; }
+  const MeshCacheInfo &getInfo() const { return info; }
+  // Valid while the file stays open
+  MeshCacheArray getSection(MeshCacheSection section) const {
+    return sections[static_cast<int>(section)];
+  }
+
+private:
+  void *mapping;
+  size_t mappingSize;
+  MeshCacheInfo info;
+  MeshCacheArray sections[static_cast<int>(MeshCacheSection::Count)];
+
+  MeshCacheFile(const MeshCacheFile &) = delete;
+  MeshCacheFile &operator=(const MeshCacheFile &) = delete;
+};
+
+// Write a cache file from MeshCacheSection::Count sections in enum order.
+// Returns false on I/O failure; a partially written file is never left
+// under path.
+bool writeMeshCache(const std::string &path, uint64_t key, int gridSize,
+                    const MeshCacheInfo &info,
+                    const MeshCacheArray *sections);
+
+// Hash of a file's raw bytes, folded into seed. The heightmap is hashed
+// without decoding it, which is what makes a cache hit cheap. Returns false
+// if the file cannot be read.
+bool hashFile(const std::string &path, uint64_t seed, uint64_t &hash);
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,285 @@
+// minmax_pyramid.cpp
+// Implements building and querying the min/max height pyramid
+
+#include "minmax_pyramid.h"
+#include "parallel.h"
+#include <algorithm>
+#include <limits>
+
+void MinMaxPyramid::Range::merge(const Range &other) {
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+}
+
+// Spread the low 16 bits of v so they occupy the even bit positions
+static uint32_t partBy1(uint32_t v) {
+  v &= 0x0000ffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+uint32_t MinMaxPyramid::mortonIndex(uint32_t x, uint32_t z) {
+  return partBy1(x) | (partBy1(z) << 1);
+}
+
+// Size every level and table for a grid, leaving the entries empty
+void MinMaxPyramid::resize(int width, int height) {
+  levels.clear();
+  columnTables.clear();
+  rowTables.clear();
+  cellsX = width - 1;
+  cellsZ = height - 1;
+  if (cellsX <= 0 || cellsZ <= 0) {
+    size = 0;
+    return;
+  }
+
+  size = 1;
+  while (size < std::max(cellsX, cellsZ)) {
+    size *= 2;
+  }
+
+  const Range emptyRange = {std::numeric_limits<float>::max(),
+                            -std::numeric_limits<float>::max()};
+  for (int side = size; side >= 1; side /= 2) {
+    levels.push_back(
+        std::vector<Range>(static_cast<size_t>(side) * side, emptyRange));
+  }
+  columnTables.resize(levels.size());
+  rowTables.resize(levels.size());
+  for (int level = 1; level < getLevelCount(); ++level) {
+    size_t nodes = static_cast<size_t>(size >> level);
+    size_t block = static_cast<size_t>(level) << level;
+    columnTables[level].assign(nodes * nodes * block, emptyRange);
+    rowTables[level].assign(nodes * nodes * block, emptyRange);
+  }
+}
+
+void MinMaxPyramid::build(const float *heights, int width, int height) {
+  resize(heights ? width : 0, height);
+  if (levels.empty())
+    return;
+
+  // Level 0: bounds of each cell's four corners, padding left empty
+  std::vector<Range> &base = levels[0];
+  parallelFor(0, cellsZ, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      const float *row0 = heights + static_cast<size_t>(z) * width;
+      const float *row1 = row0 + width;
+      for (int x = 0; x < cellsX; ++x) {
+        Range &cell = base[mortonIndex(x, z)];
+        cell.min = std::min(std::min(row0[x], row0[x + 1]),
+                            std::min(row1[x], row1[x + 1]));
+        cell.max = std::max(std::max(row0[x], row0[x + 1]),
+                            std::max(row1[x], row1[x + 1]));
+      }
+    }
+  });
+
+  // Coarser levels: in Morton order the children of entry i are 4i..4i+3
+  for (int level = 1; level < getLevelCount(); ++level) {
+    const std::vector<Range> &children = levels[level - 1];
+    std::vector<Range> &parents = levels[level];
+    parallelFor(0, static_cast<int>(parents.size()), [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        Range r = children[4 * i];
+        r.merge(children[4 * i + 1]);
+        r.merge(children[4 * i + 2]);
+        r.merge(children[4 * i + 3]);
+        parents[i] = r;
+      }
+    });
+    buildTables(level);
+  }
+}
+
+// Column and row tables of every node at a level, from its children's
+void MinMaxPyramid::buildTables(int level) {
+  int side = 1 << level;
+  int half = side / 2;
+  int nodes = size >> level;
+  size_t block = static_cast<size_t>(level) * side;
+  std::vector<Range> &columns = columnTables[level];
+  std::vector<Range> &rows = rowTables[level];
+
+  // Bounds of column (or row) offset of child node index, one level down
+  auto childLine = [this, level, half](
+                       const std::vector<std::vector<Range>> &tables,
+                       size_t index, int offset) -> const Range & {
+    if (level == 1)
+      return levels[0][index];
+    return tables[level - 1][index * (level - 1) * half + offset];
+  };
+
+  parallelFor(0, nodes * nodes, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      size_t children = 4 * static_cast<size_t>(i);
+      Range *column = &columns[i * block];
+      Range *row = &rows[i * block];
+      // Children 0 and 1 are the low z row, 0 and 2 the low x column
+      for (int offset = 0; offset < side; ++offset) {
+        int high = offset / half;
+        int inner = offset % half;
+        column[offset] = childLine(columnTables, children + high, inner);
+        column[offset].merge(
+            childLine(columnTables, children + high + 2, inner));
+        row[offset] = childLine(rowTables, children + 2 * high, inner);
+        row[offset].merge(childLine(rowTables, children + 2 * high + 1, inner));
+      }
+      for (int j = 1; j < level; ++j) {
+        int length = 1 << j;
+        for (int offset = 0; offset + length <= side; ++offset) {
+          Range *c = column + j * side + offset;
+          *c = *(c - side);
+          c->merge(*(c - side + length / 2));
+          Range *r = row + j * side + offset;
+          *r = *(r - side);
+          r->merge(*(r - side + length / 2));
+        }
+      }
+    }
+  });
+}
+
+size_t MinMaxPyramid::getStoredCount() const {
+  size_t count = 0;
+  for (size_t level = 0; level < levels.size(); ++level) {
+    count += levels[level].size() + columnTables[level].size() +
+             rowTables[level].size();
+  }
+  return count;
+}
+
+void MinMaxPyramid::store(Range *out) const {
+  for (size_t level = 0; level < levels.size(); ++level) {
+    for (const std::vector<Range> *part :
+         {&levels[level], &columnTables[level], &rowTables[level]}) {
+      out = std::copy(part->begin(), part->end(), out);
+    }
+  }
+}
+
+bool MinMaxPyramid::load(const Range *data, size_t count, int width,
+                         int height) {
+  resize(width, height);
+  if (count != getStoredCount()) {
+    resize(0, 0);
+    return false;
+  }
+  for (size_t level = 0; level < levels.size(); ++level) {
+    for (std::vector<Range> *part :
+         {&levels[level], &columnTables[level], &rowTables[level]}) {
+      std::copy(data, data + part->size(), part->begin());
+      data += part->size();
+    }
+  }
+  return true;
+}
+
+MinMaxPyramid::Range MinMaxPyramid::query(int x0, int z0, int x1,
+                                          int z1) const {
+  Range result = {std::numeric_limits<float>::max(),
+                  -std::numeric_limits<float>::max()};
+  if (levels.empty())
+    return result;
+
+  x0 = std::max(x0, 0);
+  z0 = std::max(z0, 0);
+  x1 = std::min(x1, cellsX - 1);
+  z1 = std::min(z1, cellsZ - 1);
+  if (x0 > x1 || z0 > z1)
+    return result;
+
+  queryNode(getLevelCount() - 1, 0, 0, x0, z0, x1, z1, result);
+  return result;
+}
+
+void MinMaxPyramid::queryNode(int level, int x, int z, int x0, int z0, int x1,
+                              int z1, Range &result) const {
+  // Cell extent covered by this node
+  int nx0 = x << level;
+  int nz0 = z << level;
+  int nx1 = nx0 + (1 << level) - 1;
+  int nz1 = nz0 + (1 << level) - 1;
+
+  if (nx1 < x0 || nx0 > x1 || nz1 < z0 || nz0 > z1)
+    return;
+
+  const Range &r = node(level, x, z);
+  if (r.empty())
+    return;
+
+  // Fully inside, or tighter bounds would not change the merged result
+  bool spansX = nx0 >= x0 && nx1 <= x1;
+  bool spansZ = nz0 >= z0 && nz1 <= z1;
+  if ((spansX && spansZ) || (r.min >= result.min && r.max <= result.max)) {
+    result.merge(r);
+    return;
+  }
+
+  // Spanned along one axis: the covered columns or rows of the node
+  uint32_t index = mortonIndex(x, z);
+  if (spansZ) {
+    result.merge(tableRange(columnTables, level, index,
+                            std::max(x0, nx0) - nx0, std::min(x1, nx1) - nx0));
+    return;
+  }
+  if (spansX) {
+    result.merge(tableRange(rowTables, level, index, std::max(z0, nz0) - nz0,
+                            std::min(z1, nz1) - nz0));
+    return;
+  }
+
+  for (int child = 0; child < 4; ++child) {
+    queryNode(level - 1, 2 * x + (child & 1), 2 * z + (child >> 1), x0, z0,
+              x1, z1, result);
+  }
+}
+
+// Bounds of the node's columns (or rows) first..last, fewer than all of
+// them, from two overlapping table entries
+MinMaxPyramid::Range MinMaxPyramid::tableRange(
+    const std::vector<std::vector<Range>> &tables, int level, uint32_t index,
+    int first, int last) const {
+  int side = 1 << level;
+  int j = 0;
+  while ((2 << j) <= last - first + 1) {
+    ++j;
+  }
+  const Range *row =
+      &tables[level][(static_cast<size_t>(index) * level + j) * side];
+  Range result = row[first];
+  result.merge(row[last - (1 << j) + 1]);
+  return result;
+}
+
+MinMaxPyramid::Range MinMaxPyramid::queryConservative(int x0, int z0, int x1,
+                                                      int z1) const {
+  Range result = {std::numeric_limits<float>::max(),
+                  -std::numeric_limits<float>::max()};
+  if (levels.empty())
+    return result;
+
+  x0 = std::max(x0, 0);
+  z0 = std::max(z0, 0);
+  x1 = std::min(x1, cellsX - 1);
+  z1 = std::min(z1, cellsZ - 1);
+  if (x0 > x1 || z0 > z1)
+    return result;
+
+  int level = 0;
+  while ((x1 >> level) - (x0 >> level) > 1 ||
+         (z1 >> level) - (z0 >> level) > 1) {
+    ++level;
+  }
+
+  for (int z = z0 >> level; z <= z1 >> level; ++z) {
+    for (int x = x0 >> level; x <= x1 >> level; ++x) {
+      result.merge(node(level, x, z));
+    }
+  }
+  return result;
+}
@@ -0,0 +1,82 @@
+// minmax_pyramid.h
+// Defines the MinMaxPyramid class, a min/max height mip pyramid over the
+// terrain grid used to answer region bounds queries without scanning samples
+
+#ifndef MINMAX_PYRAMID_H
+#define MINMAX_PYRAMID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class MinMaxPyramid {
+public:
+  // Height bounds of a region. An empty region has min > max.
+  struct Range {
+    float min;
+    float max;
+
+    bool empty() const { return min > max; }
+    void merge(const Range &other);
+  };
+
+  // Build from a row-major grid of vertex heights. Level 0 holds one entry
+  // per grid cell (the bounds of its four corners), padded to a power of two
+  // and stored in Morton order so the four children of entry i at one level
+  // are entries 4i..4i+3 of the level below. Every coarser node also keeps
+  // sparse tables over the bounds of its cell columns and cell rows, about
+  // four times level 0 in all.
+  void build(const float *heights, int width, int height);
+
+  // Flat copy of every level and table, for the mesh cache. load() takes
+  // one back for a grid of the same size, returning false (and leaving the
+  // pyramid empty) if count does not match it.
+  size_t getStoredCount() const;
+  void store(Range *out) const;
+  bool load(const Range *data, size_t count, int width, int height);
+
+  bool empty() const { return levels.empty(); }
+  int getLevelCount() const { return static_cast<int>(levels.size()); }
+  // Side length of level 0 in cells, after padding
+  int getSize() const { return size; }
+  int getCellsX() const { return cellsX; }
+  int getCellsZ() const { return cellsZ; }
+
+  // Bounds of node (x, z) at a level, where level 0 nodes are single cells
+  const Range &node(int level, int x, int z) const {
+    return levels[level][mortonIndex(x, z)];
+  }
+  const Range &root() const { return levels.back()[0]; }
+
+  // Exact bounds of cells [x0, x1] x [z0, z1] (inclusive) in O(log n).
+  // Nodes fully inside the region are taken whole and nodes it spans along
+  // one axis come from their column or row table in constant time; only
+  // nodes holding a corner of the region are split, at most four per level.
+  Range query(int x0, int z0, int x1, int z1) const;
+
+  // Conservative bounds in constant time: merges the at most 2x2 nodes of the
+  // coarsest level that still separates the region's corners
+  Range queryConservative(int x0, int z0, int x1, int z1) const;
+
+  static uint32_t mortonIndex(uint32_t x, uint32_t z);
+
+private:
+  int size = 0;
+  int cellsX = 0;
+  int cellsZ = 0;
+  std::vector<std::vector<Range>> levels;
+  // Per level from 1: for each node (in Morton order), level rows of 2^level
+  // entries, row j holding the bounds of 2^j adjacent cell columns (or cell
+  // rows) of the node starting at each offset
+  std::vector<std::vector<Range>> columnTables;
+  std::vector<std::vector<Range>> rowTables;
+
+  void resize(int width, int height);
+  Range tableRange(const std::vector<std::vector<Range>> &tables, int level,
+                   uint32_t index, int first, int last) const;
+  void buildTables(int level);
+  void queryNode(int level, int x, int z, int x0, int z0, int x1, int z1,
+                 Range &result) const;
+};
+
+#endif // MINMAX_PYRAMID_H
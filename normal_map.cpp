@@ -0,0 +1,93 @@
+// normal_map.cpp
+// Implements normal map generation and its signed normalized encodings
+
+#include "normal_map.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Round a component in [-1, 1] to a signed normalized integer of scale
+// 127 or 32767
+template <typename T> inline T quantize(float value, float scale) {
+  return static_cast<T>(
+      std::lrint(std::min(std::max(value, -1.0f), 1.0f) * scale));
+}
+
+} // namespace
+
+NormalMap::NormalMap()
+    : width(0), height(0), format(Format::RG16), buildTime(0.0) {}
+
+void NormalMap::build(const HeightmapPyramid::Level &level, float worldSize,
+                      float heightScale, Format format) {
+  build(level.texels.data(), level.width, level.height,
+        worldSize / std::max(level.width - 1, 1),
+        worldSize / std::max(level.height - 1, 1), heightScale, format);
+}
+
+void NormalMap::build(const HeightGrid &grid, Format format) {
+  build(grid.heights, grid.gridSize, grid.gridSize, grid.step, grid.step,
+        1.0f, format);
+}
+
+void NormalMap::assign(const uint8_t *texels, int width, int height,
+                       Format format) {
+  auto start = std::chrono::high_resolution_clock::now();
+  this->width = width;
+  this->height = height;
+  this->format = format;
+  this->texels.assign(texels, texels + static_cast<size_t>(width) * height *
+                                           bytesPerTexel(format));
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void NormalMap::build(const float *heights, int width, int height,
+                      float stepX, float stepZ, float heightScale,
+                      Format format) {
+  auto start = std::chrono::high_resolution_clock::now();
+  this->width = width;
+  this->height = height;
+  this->format = format;
+  texels.resize(static_cast<size_t>(width) * height * bytesPerTexel(format));
+
+  parallelFor(0, height, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      // One-sided differences at the edges
+      int z0 = std::max(z - 1, 0);
+      int z1 = std::min(z + 1, height - 1);
+      const float *above = heights + static_cast<size_t>(z0) * width;
+      const float *row = heights + static_cast<size_t>(z) * width;
+      const float *below = heights + static_cast<size_t>(z1) * width;
+      float spanZ = std::max(z1 - z0, 1) * stepZ;
+      for (int x = 0; x < width; ++x) {
+        int x0 = std::max(x - 1, 0);
+        int x1 = std::min(x + 1, width - 1);
+        float dx =
+            (row[x1] - row[x0]) * heightScale / (std::max(x1 - x0, 1) * stepX);
+        float dz = (below[x] - above[x]) * heightScale / spanZ;
+        float length = std::sqrt(dx * dx + 1.0f + dz * dz);
+        float nx = -dx / length;
+        float nz = -dz / length;
+
+        size_t texel = static_cast<size_t>(z) * width + x;
+        if (format == Format::RG8) {
+          int8_t pair[2] = {quantize<int8_t>(nx, 127.0f),
+                            quantize<int8_t>(nz, 127.0f)};
+          std::memcpy(&texels[texel * 2], pair, sizeof(pair));
+        } else {
+          int16_t pair[2] = {quantize<int16_t>(nx, 32767.0f),
+                             quantize<int16_t>(nz, 32767.0f)};
+          std::memcpy(&texels[texel * 4], pair, sizeof(pair));
+        }
+      }
+    }
+  });
+
+  auto end = std::chrono::high_resolution_clock::now();
+  buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+}
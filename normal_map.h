@@ -0,0 +1,66 @@
+// normal_map.h
+// Defines the NormalMap class holding two-component surface normals derived
+// once from the heightmap for per-fragment lighting
+
+#ifndef NORMAL_MAP_H
+#define NORMAL_MAP_H
+
+#include "height_grid.h"
+#include "heightmap_pyramid.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Unit normals of a height field at its own resolution, independent of the
+// mesh density. Terrain normals always point up, so only x and z are kept,
+// as signed normalized pairs; y = sqrt(1 - x^2 - z^2) is reconstructed
+// when sampled.
+class NormalMap {
+public:
+  enum class Format { RG8, RG16 }; // 2 or 4 bytes per texel
+
+  NormalMap();
+
+  // Central-difference normals of a heightmap level (heights in [0, 1],
+  // scaled by heightScale) stretched over worldSize on x and z. Rows are
+  // split across worker threads.
+  void build(const HeightmapPyramid::Level &level, float worldSize,
+             float heightScale, Format format);
+
+  // The same at the resolution of the generated grid, for when the
+  // heightmap itself is not loaded
+  void build(const HeightGrid &grid, Format format);
+
+  // Take texels a previous build produced, such as a copy in the mesh
+  // cache, instead of building them again
+  void assign(const uint8_t *texels, int width, int height, Format format);
+
+  bool empty() const { return texels.empty(); }
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  Format getFormat() const { return format; }
+
+  // Row-major texel data in the build format (GL_BYTE or GL_SHORT pairs)
+  const std::vector<uint8_t> &getTexels() const { return texels; }
+
+  static size_t bytesPerTexel(Format format) {
+    return format == Format::RG8 ? 2 : 4;
+  }
+  // Texture size of this map's resolution in a format
+  size_t getTextureBytes(Format format) const {
+    return static_cast<size_t>(width) * height * bytesPerTexel(format);
+  }
+  double getBuildTime() const { return buildTime; } // Milliseconds
+
+private:
+  int width;
+  int height;
+  Format format;
+  std::vector<uint8_t> texels;
+  double buildTime;
+
+  void build(const float *heights, int width, int height, float stepX,
+             float stepZ, float heightScale, Format format);
+};
+
+#endif // NORMAL_MAP_H
@@ -0,0 +1,28 @@
+// parallel.h
+// Declares a small parallel-for helper that splits a row range across threads
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "job_system.h"
+#include <algorithm>
+
+// Run fn(rowBegin, rowEnd) over [begin, end) split into contiguous bands of
+// about one band per worker, on the shared job system. The calling thread
+// works on the bands too.
+template <typename Fn> void parallelFor(int begin, int end, Fn fn) {
+  int count = end - begin;
+  if (count <= 0)
+    return;
+
+  int threads = std::min(workerCount(), count);
+  if (threads == 1) {
+    fn(begin, end);
+    return;
+  }
+
+  int band = (count + threads - 1) / threads;
+  JobSystem::shared().parallelFor(begin, end, band, fn);
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,688 @@
+// path_planner.cpp
+// Implements grid A*, Theta* and HPA* route planning over the height grid
+
+#include "path_planner.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+static const float kInfinity = std::numeric_limits<float>::infinity();
+
+// Heights bilinearly interpolated at continuous grid coordinates
+static float sampleHeight(const HeightGrid &grid, float fx, float fz) {
+  int x0 = std::min(static_cast<int>(fx), grid.gridSize - 2);
+  int z0 = std::min(static_cast<int>(fz), grid.gridSize - 2);
+  float tx = fx - x0;
+  float tz = fz - z0;
+  const float *row0 = grid.heights + static_cast<size_t>(z0) * grid.gridSize;
+  const float *row1 = row0 + grid.gridSize;
+  float top = row0[x0] * (1.0f - tx) + row0[x0 + 1] * tx;
+  float bottom = row1[x0] * (1.0f - tx) + row1[x0 + 1] * tx;
+  return top * (1.0f - tz) + bottom * tz;
+}
+
+// ---- SearchState ----
+
+void PathPlanner::SearchState::reset(size_t count) {
+  if (stamp.size() < count) {
+    g.resize(count);
+    f.resize(count);
+    parent.resize(count);
+    heapIndex.resize(count);
+    stamp.resize(count, 0);
+  }
+  ++generation;
+  if (generation == 0) {
+    // Stamp wrapped around; clear so stale entries cannot match
+    std::fill(stamp.begin(), stamp.end(), 0);
+    generation = 1;
+  }
+  heap.clear();
+}
+
+void PathPlanner::SearchState::touch(int i) {
+  stamp[i] = generation;
+  g[i] = kInfinity;
+  f[i] = kInfinity;
+  parent[i] = -1;
+  heapIndex[i] = -1;
+}
+
+void PathPlanner::SearchState::siftUp(int position) {
+  int item = heap[position];
+  while (position > 0) {
+    int up = (position - 1) / 2;
+    if (f[heap[up]] <= f[item])
+      break;
+    heap[position] = heap[up];
+    heapIndex[heap[position]] = position;
+    position = up;
+  }
+  heap[position] = item;
+  heapIndex[item] = position;
+}
+
+void PathPlanner::SearchState::siftDown(int position) {
+  int count = static_cast<int>(heap.size());
+  int item = heap[position];
+  while (true) {
+    int child = 2 * position + 1;
+    if (child >= count)
+      break;
+    if (child + 1 < count && f[heap[child + 1]] < f[heap[child]])
+      ++child;
+    if (f[item] <= f[heap[child]])
+      break;
+    heap[position] = heap[child];
+    heapIndex[heap[position]] = position;
+    position = child;
+  }
+  heap[position] = item;
+  heapIndex[item] = position;
+}
+
+void PathPlanner::SearchState::push(int i) {
+  heap.push_back(i);
+  siftUp(static_cast<int>(heap.size()) - 1);
+}
+
+void PathPlanner::SearchState::decrease(int i) { siftUp(heapIndex[i]); }
+
+int PathPlanner::SearchState::pop() {
+  int top = heap[0];
+  heap[0] = heap.back();
+  heap.pop_back();
+  if (!heap.empty())
+    siftDown(0);
+  heapIndex[top] = -2;
+  return top;
+}
+
+// ---- PathPlanner ----
+
+PathPlanner::PathPlanner()
+    : grid(), minHeight(0.0f), heightRange(1.0f), clustersX(0),
+      clustersZ(0) {}
+
+// Cost of moving between two heights a horizontal distance apart. Symmetric,
+// so costs from a Dijkstra search are also costs to its source.
+float PathPlanner::stepCost(float h0, float h1, float distance) const {
+  float slope = std::fabs(h1 - h0) / distance;
+  if (slope > settings.maxSlope)
+    return kInfinity;
+  float altitude = ((h0 + h1) * 0.5f - minHeight) / heightRange;
+  return distance * (1.0f + settings.slopeWeight * slope +
+                     settings.altitudeWeight * altitude);
+}
+
+// Cost along the straight line between two vertices, infinite if any step
+// of it is too steep. Used for Theta* line of sight and path smoothing.
+float PathPlanner::lineCost(int fromX, int fromZ, int toX, int toZ) const {
+  int dx = toX - fromX;
+  int dz = toZ - fromZ;
+  int steps = std::max(std::abs(dx), std::abs(dz));
+  if (steps == 0)
+    return 0.0f;
+
+  float segment =
+      std::sqrt(static_cast<float>(dx * dx + dz * dz)) / steps * grid.step;
+  float previous = height(fromX, fromZ);
+  float cost = 0.0f;
+  for (int i = 1; i <= steps; ++i) {
+    float t = static_cast<float>(i) / steps;
+    float h = sampleHeight(grid, fromX + dx * t, fromZ + dz * t);
+    cost += stepCost(previous, h, segment);
+    if (cost == kInfinity)
+      return kInfinity;
+    previous = h;
+  }
+  return cost;
+}
+
+PathPlanner::Rect PathPlanner::clusterRect(int cluster) const {
+  int size = settings.clusterSize;
+  Rect rect;
+  rect.x0 = (cluster % clustersX) * size;
+  rect.z0 = (cluster / clustersX) * size;
+  rect.x1 = std::min(rect.x0 + size - 1, grid.gridSize - 1);
+  rect.z1 = std::min(rect.z0 + size - 1, grid.gridSize - 1);
+  return rect;
+}
+
+int PathPlanner::clusterOf(int x, int z) const {
+  return (z / settings.clusterSize) * clustersX + x / settings.clusterSize;
+}
+
+float PathPlanner::search(SearchState &state, const Rect &rect, int start,
+                          int goal, bool anyAngle, const int *targets,
+                          int targetCount, int &expanded) const {
+  int n = grid.gridSize;
+  int width = rect.width();
+  auto local = [&](int vertex) {
+    return (vertex / n - rect.z0) * width + (vertex % n - rect.x0);
+  };
+  state.reset(static_cast<size_t>(width) * (rect.z1 - rect.z0 + 1));
+
+  int goalX = goal >= 0 ? goal % n : 0;
+  int goalZ = goal >= 0 ? goal / n : 0;
+  auto heuristic = [&](int x, int z) {
+    if (goal < 0)
+      return 0.0f;
+    float dx = static_cast<float>(x - goalX);
+    float dz = static_cast<float>(z - goalZ);
+    return std::sqrt(dx * dx + dz * dz) * grid.step;
+  };
+
+  int startLocal = local(start);
+  state.touch(startLocal);
+  state.g[startLocal] = 0.0f;
+  state.f[startLocal] = heuristic(start % n, start / n);
+  state.push(startLocal);
+
+  int goalLocal = goal >= 0 ? local(goal) : -1;
+  int remaining = targetCount;
+  static const int offsetX[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+  static const int offsetZ[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+  const float diagonal = std::sqrt(2.0f) * grid.step;
+
+  while (!state.heap.empty()) {
+    int current = state.pop();
+    ++expanded;
+    if (current == goalLocal)
+      return state.g[current];
+
+    int cx = rect.x0 + current % width;
+    int cz = rect.z0 + current / width;
+    if (goal < 0) {
+      int vertex = cz * n + cx;
+      for (int t = 0; t < targetCount; ++t) {
+        if (targets[t] == vertex)
+          --remaining;
+      }
+      if (remaining <= 0)
+        break;
+    }
+
+    float currentHeight = height(cx, cz);
+    int parent = state.parent[current];
+    int parentX = parent >= 0 ? rect.x0 + parent % width : 0;
+    int parentZ = parent >= 0 ? rect.z0 + parent / width : 0;
+
+    for (int k = 0; k < 8; ++k) {
+      int x = cx + offsetX[k];
+      int z = cz + offsetZ[k];
+      if (!rect.contains(x, z))
+        continue;
+      int neighbor = (z - rect.z0) * width + (x - rect.x0);
+      if (!state.seen(neighbor)) {
+        state.touch(neighbor);
+      } else if (state.heapIndex[neighbor] == -2) {
+        continue;
+      }
+
+      float distance = k < 4 ? grid.step : diagonal;
+      float candidate =
+          state.g[current] + stepCost(currentHeight, height(x, z), distance);
+      int candidateParent = current;
+
+      // Theta*: connect straight to the grandparent when the line is cheaper
+      if (anyAngle && parent >= 0) {
+        float direct = state.g[parent] + lineCost(parentX, parentZ, x, z);
+        if (direct < candidate) {
+          candidate = direct;
+          candidateParent = parent;
+        }
+      }
+
+      if (candidate < state.g[neighbor]) {
+        state.g[neighbor] = candidate;
+        state.f[neighbor] = candidate + heuristic(x, z);
+        state.parent[neighbor] = candidateParent;
+        if (state.heapIndex[neighbor] == -1) {
+          state.push(neighbor);
+        } else {
+          state.decrease(neighbor);
+        }
+      }
+    }
+  }
+  return goal >= 0 ? kInfinity : 0.0f;
+}
+
+// Append the vertices of the searched path ending at goal (global index)
+void PathPlanner::appendPath(const SearchState &state, const Rect &rect,
+                             int goal, std::vector<int> &out) const {
+  int n = grid.gridSize;
+  int width = rect.width();
+  size_t first = out.size();
+  int current = (goal / n - rect.z0) * width + (goal % n - rect.x0);
+  while (current >= 0) {
+    out.push_back((rect.z0 + current / width) * n + rect.x0 + current % width);
+    current = state.parent[current];
+  }
+  std::reverse(out.begin() + first, out.end());
+
+  // Segments share their joining vertex
+  if (first > 0 && out[first - 1] == out[first]) {
+    out.erase(out.begin() + first);
+  }
+}
+
+void PathPlanner::build(const HeightGrid &heightGrid,
+                        const Settings &plannerSettings) {
+  grid = heightGrid;
+  settings = plannerSettings;
+  int n = grid.gridSize;
+  size_t vertexCount = static_cast<size_t>(n) * n;
+
+  minHeight = *std::min_element(grid.heights, grid.heights + vertexCount);
+  float maxHeight = *std::max_element(grid.heights, grid.heights + vertexCount);
+  heightRange = std::max(maxHeight - minHeight, 1e-6f);
+
+  int size = settings.clusterSize;
+  clustersX = (n + size - 1) / size;
+  clustersZ = clustersX;
+
+  // Entrances: one node per side of each passable border crossing, one
+  // crossing in the middle of short passable runs and one at each end of
+  // long runs
+  abstractVertex.clear();
+  std::unordered_map<int, int> nodeOfVertex;
+  std::vector<std::vector<Edge>> adjacency;
+  auto addNode = [&](int vertex) {
+    auto found = nodeOfVertex.find(vertex);
+    if (found != nodeOfVertex.end())
+      return found->second;
+    int id = static_cast<int>(abstractVertex.size());
+    nodeOfVertex[vertex] = id;
+    abstractVertex.push_back(vertex);
+    adjacency.push_back(std::vector<Edge>());
+    return id;
+  };
+  auto addCrossing = [&](int a, int b) {
+    float cost = stepCost(grid.heights[a], grid.heights[b], grid.step);
+    int u = addNode(a);
+    int v = addNode(b);
+    adjacency[u].push_back({v, cost});
+    adjacency[v].push_back({u, cost});
+  };
+  auto addBorder = [&](int along0, int along1, bool vertical, int across) {
+    // Vertices (across, along) | (across + 1, along) for vertical borders,
+    // (along, across) / (along, across + 1) for horizontal ones
+    auto pair = [&](int along, int &a, int &b) {
+      a = vertical ? along * n + across : across * n + along;
+      b = vertical ? a + 1 : a + n;
+    };
+    int runStart = -1;
+    for (int along = along0; along <= along1 + 1; ++along) {
+      bool passable = false;
+      if (along <= along1) {
+        int a, b;
+        pair(along, a, b);
+        passable = stepCost(grid.heights[a], grid.heights[b], grid.step) <
+                   kInfinity;
+      }
+      if (passable && runStart < 0) {
+        runStart = along;
+      } else if (!passable && runStart >= 0) {
+        int runEnd = along - 1;
+        int a, b;
+        if (runEnd - runStart + 1 < 6) {
+          pair((runStart + runEnd) / 2, a, b);
+          addCrossing(a, b);
+        } else {
+          pair(runStart, a, b);
+          addCrossing(a, b);
+          pair(runEnd, a, b);
+          addCrossing(a, b);
+        }
+        runStart = -1;
+      }
+    }
+  };
+  for (int cz = 0; cz < clustersZ; ++cz) {
+    for (int cx = 0; cx < clustersX; ++cx) {
+      Rect rect = clusterRect(cz * clustersX + cx);
+      if (cx + 1 < clustersX)
+        addBorder(rect.z0, rect.z1, true, rect.x1);
+      if (cz + 1 < clustersZ)
+        addBorder(rect.x0, rect.x1, false, rect.z1);
+    }
+  }
+
+  // Group nodes by cluster
+  int clusterCount = clustersX * clustersZ;
+  int nodeCount = static_cast<int>(abstractVertex.size());
+  abstractCluster.resize(nodeCount);
+  clusterNodeOffsets.assign(clusterCount + 1, 0);
+  for (int i = 0; i < nodeCount; ++i) {
+    int vertex = abstractVertex[i];
+    abstractCluster[i] = clusterOf(vertex % n, vertex / n);
+    ++clusterNodeOffsets[abstractCluster[i] + 1];
+  }
+  for (int c = 0; c < clusterCount; ++c) {
+    clusterNodeOffsets[c + 1] += clusterNodeOffsets[c];
+  }
+  clusterNodes.resize(nodeCount);
+  std::vector<int> fill(clusterNodeOffsets.begin(), clusterNodeOffsets.end());
+  size_t maxClusterNodes = 0;
+  for (int i = 0; i < nodeCount; ++i) {
+    clusterNodes[fill[abstractCluster[i]]++] = i;
+  }
+  for (int c = 0; c < clusterCount; ++c) {
+    size_t count = clusterNodeOffsets[c + 1] - clusterNodeOffsets[c];
+    maxClusterNodes = std::max(maxClusterNodes, count);
+  }
+
+  // Intra-cluster edges from a Dijkstra search per entrance. Each node only
+  // appends to its own adjacency list, so clusters run in parallel.
+  parallelFor(0, clusterCount, [&](int begin, int end) {
+    SearchState state;
+    std::vector<int> targets;
+    for (int c = begin; c < end; ++c) {
+      int first = clusterNodeOffsets[c];
+      int count = clusterNodeOffsets[c + 1] - first;
+      if (count < 2)
+        continue;
+      Rect rect = clusterRect(c);
+      int width = rect.width();
+      targets.clear();
+      for (int i = 0; i < count; ++i) {
+        targets.push_back(abstractVertex[clusterNodes[first + i]]);
+      }
+      for (int i = 0; i < count; ++i) {
+        int expanded = 0;
+        search(state, rect, targets[i], -1, false, targets.data(), count,
+               expanded);
+        for (int j = 0; j < count; ++j) {
+          if (j == i)
+            continue;
+          int local = (targets[j] / n - rect.z0) * width +
+                      (targets[j] % n - rect.x0);
+          if (state.seen(local) && state.g[local] < kInfinity) {
+            adjacency[clusterNodes[first + i]].push_back(
+                {clusterNodes[first + j], state.g[local]});
+          }
+        }
+      }
+    }
+  });
+
+  // Flatten into compressed rows
+  edgeOffsets.assign(nodeCount + 1, 0);
+  edges.clear();
+  for (int i = 0; i < nodeCount; ++i) {
+    edges.insert(edges.end(), adjacency[i].begin(), adjacency[i].end());
+    edgeOffsets[i + 1] = static_cast<int>(edges.size());
+  }
+
+  startCosts.assign(maxClusterNodes, kInfinity);
+  goalCosts.assign(maxClusterNodes, kInfinity);
+  connectTargets.assign(maxClusterNodes, 0);
+}
+
+PathPlanner::Result PathPlanner::findPath(int startX, int startZ, int goalX,
+                                          int goalZ, Mode mode) {
+  Result result;
+  if (!grid.heights)
+    return result;
+
+  int n = grid.gridSize;
+  startX = std::min(std::max(startX, 0), n - 1);
+  startZ = std::min(std::max(startZ, 0), n - 1);
+  goalX = std::min(std::max(goalX, 0), n - 1);
+  goalZ = std::min(std::max(goalZ, 0), n - 1);
+  int start = startZ * n + startX;
+  int goal = goalZ * n + goalX;
+
+  if (mode == Mode::Hierarchical)
+    return findHierarchicalPath(start, goal);
+  return findGridPath(start, goal, mode == Mode::ThetaStar);
+}
+
+PathPlanner::Result PathPlanner::findGridPath(int start, int goal,
+                                              bool anyAngle) {
+  Result result;
+  Rect rect = {0, 0, grid.gridSize - 1, grid.gridSize - 1};
+  float cost =
+      search(gridState, rect, start, goal, anyAngle, nullptr, 0,
+             result.expanded);
+  if (cost == kInfinity)
+    return result;
+
+  result.found = true;
+  result.cost = cost;
+  appendPath(gridState, rect, goal, result.vertices);
+  return result;
+}
+
+PathPlanner::Result PathPlanner::findHierarchicalPath(int start, int goal) {
+  Result result;
+  int n = grid.gridSize;
+  int startCluster = clusterOf(start % n, start / n);
+  int goalCluster = clusterOf(goal % n, goal / n);
+
+  // Routes inside one cluster are searched directly
+  if (startCluster == goalCluster) {
+    Rect rect = clusterRect(startCluster);
+    float cost = search(clusterState, rect, start, goal, false, nullptr, 0,
+                        result.expanded);
+    if (cost < kInfinity) {
+      result.found = true;
+      appendPath(clusterState, rect, goal, result.vertices);
+      smooth(result.vertices);
+      result.cost = pathCost(result.vertices);
+      return result;
+    }
+  }
+
+  // Costs from start and to goal for the entrances of their clusters
+  auto connect = [&](int vertex, int cluster, std::vector<float> &costs) {
+    Rect rect = clusterRect(cluster);
+    int width = rect.width();
+    int first = clusterNodeOffsets[cluster];
+    int count = clusterNodeOffsets[cluster + 1] - first;
+    std::fill(costs.begin(), costs.end(), kInfinity);
+    if (count == 0)
+      return;
+    std::vector<int> &targets = connectTargets;
+    for (int i = 0; i < count; ++i) {
+      targets[i] = abstractVertex[clusterNodes[first + i]];
+    }
+    search(clusterState, rect, vertex, -1, false, targets.data(), count,
+           result.expanded);
+    for (int i = 0; i < count; ++i) {
+      int local = (targets[i] / n - rect.z0) * width +
+                  (targets[i] % n - rect.x0);
+      if (clusterState.seen(local))
+        costs[i] = clusterState.g[local];
+    }
+  };
+  connect(start, startCluster, startCosts);
+  connect(goal, goalCluster, goalCosts);
+
+  // A* over the abstract graph plus two temporary nodes for start and goal
+  int nodeCount = getAbstractNodeCount();
+  int startNode = nodeCount;
+  int goalNode = nodeCount + 1;
+  SearchState &state = abstractState;
+  state.reset(nodeCount + 2);
+
+  int goalX = goal % n;
+  int goalZ = goal / n;
+  auto heuristic = [&](int node) {
+    int vertex = node == startNode ? start
+                 : node == goalNode ? goal
+                                    : abstractVertex[node];
+    float dx = static_cast<float>(vertex % n - goalX);
+    float dz = static_cast<float>(vertex / n - goalZ);
+    return std::sqrt(dx * dx + dz * dz) * grid.step;
+  };
+  auto relax = [&](int from, int to, float cost) {
+    if (cost == kInfinity)
+      return;
+    if (!state.seen(to)) {
+      state.touch(to);
+    } else if (state.heapIndex[to] == -2) {
+      return;
+    }
+    float candidate = state.g[from] + cost;
+    if (candidate < state.g[to]) {
+      state.g[to] = candidate;
+      state.f[to] = candidate + heuristic(to);
+      state.parent[to] = from;
+      if (state.heapIndex[to] == -1) {
+        state.push(to);
+      } else {
+        state.decrease(to);
+      }
+    }
+  };
+
+  state.touch(startNode);
+  state.g[startNode] = 0.0f;
+  state.f[startNode] = heuristic(startNode);
+  state.push(startNode);
+
+  int startFirst = clusterNodeOffsets[startCluster];
+  int startCount = clusterNodeOffsets[startCluster + 1] - startFirst;
+  int goalFirst = clusterNodeOffsets[goalCluster];
+  int goalCount = clusterNodeOffsets[goalCluster + 1] - goalFirst;
+
+  bool reached = false;
+  while (!state.heap.empty()) {
+    int current = state.pop();
+    ++result.expanded;
+    if (current == goalNode) {
+      reached = true;
+      break;
+    }
+    if (current == startNode) {
+      for (int i = 0; i < startCount; ++i) {
+        relax(current, clusterNodes[startFirst + i], startCosts[i]);
+      }
+      continue;
+    }
+    for (int e = edgeOffsets[current]; e < edgeOffsets[current + 1]; ++e) {
+      relax(current, edges[e].to, edges[e].cost);
+    }
+    if (abstractCluster[current] == goalCluster) {
+      for (int i = 0; i < goalCount; ++i) {
+        if (clusterNodes[goalFirst + i] == current)
+          relax(current, goalNode, goalCosts[i]);
+      }
+    }
+  }
+  if (!reached)
+    return result;
+
+  // Abstract route as grid vertices, start to goal
+  std::vector<int> waypoints;
+  for (int node = goalNode; node >= 0; node = state.parent[node]) {
+    waypoints.push_back(node == startNode  ? start
+                        : node == goalNode ? goal
+                                           : abstractVertex[node]);
+  }
+  std::reverse(waypoints.begin(), waypoints.end());
+
+  // Refine each leg: border crossings are single steps, everything else is
+  // a search confined to the cluster both ends share
+  result.vertices.push_back(start);
+  for (size_t i = 1; i < waypoints.size(); ++i) {
+    int from = waypoints[i - 1];
+    int to = waypoints[i];
+    int fromCluster = clusterOf(from % n, from / n);
+    if (fromCluster != clusterOf(to % n, to / n)) {
+      result.vertices.push_back(to);
+      continue;
+    }
+    Rect rect = clusterRect(fromCluster);
+    if (search(clusterState, rect, from, to, false, nullptr, 0,
+               result.expanded) == kInfinity)
+      return Result();
+    appendPath(clusterState, rect, to, result.vertices);
+  }
+
+  result.found = true;
+  smooth(result.vertices);
+  result.cost = pathCost(result.vertices);
+  return result;
+}
+
+// Total cost of the straight segments joining a vertex list
+float PathPlanner::pathCost(const std::vector<int> &vertices) const {
+  int n = grid.gridSize;
+  float cost = 0.0f;
+  for (size_t i = 1; i < vertices.size(); ++i) {
+    cost += lineCost(vertices[i - 1] % n, vertices[i - 1] / n,
+                     vertices[i] % n, vertices[i] / n);
+  }
+  return cost;
+}
+
+// Replace runs of vertices with straight lines wherever the line is passable
+// and no more expensive than the run it replaces
+void PathPlanner::smooth(std::vector<int> &vertices) const {
+  if (vertices.size() < 3)
+    return;
+
+  int n = grid.gridSize;
+  std::vector<float> prefix(vertices.size(), 0.0f);
+  for (size_t i = 1; i < vertices.size(); ++i) {
+    prefix[i] = prefix[i - 1] + lineCost(vertices[i - 1] % n,
+                                         vertices[i - 1] / n, vertices[i] % n,
+                                         vertices[i] / n);
+  }
+
+  const size_t lookahead = 64;
+  std::vector<int> smoothed;
+  smoothed.push_back(vertices[0]);
+  size_t anchor = 0;
+  while (anchor + 1 < vertices.size()) {
+    size_t next = anchor + 1;
+    size_t farthest = std::min(vertices.size() - 1, anchor + lookahead);
+    for (size_t j = farthest; j > anchor + 1; --j) {
+      float direct = lineCost(vertices[anchor] % n, vertices[anchor] / n,
+                              vertices[j] % n, vertices[j] / n);
+      if (direct <= prefix[j] - prefix[anchor] + 1e-4f) {
+        next = j;
+        break;
+      }
+    }
+    smoothed.push_back(vertices[next]);
+    anchor = next;
+  }
+  vertices.swap(smoothed);
+}
+
+std::vector<glm::vec3> PathPlanner::toWorld(const Result &result,
+                                            float lift) const {
+  std::vector<glm::vec3> points;
+  if (!result.found || result.vertices.empty())
+    return points;
+
+  int n = grid.gridSize;
+  auto world = [&](float fx, float fz) {
+    return glm::vec3(grid.offset + fx * grid.step,
+                     sampleHeight(grid, fx, fz) + lift,
+                     grid.offset + fz * grid.step);
+  };
+
+  int vertex = result.vertices[0];
+  points.push_back(world(static_cast<float>(vertex % n),
+                         static_cast<float>(vertex / n)));
+  for (size_t i = 1; i < result.vertices.size(); ++i) {
+    int fromX = result.vertices[i - 1] % n;
+    int fromZ = result.vertices[i - 1] / n;
+    int dx = result.vertices[i] % n - fromX;
+    int dz = result.vertices[i] / n - fromZ;
+    int steps = std::max(std::max(std::abs(dx), std::abs(dz)), 1);
+    for (int s = 1; s <= steps; ++s) {
+      float t = static_cast<float>(s) / steps;
+      points.push_back(world(fromX + dx * t, fromZ + dz * t));
+    }
+  }
+  return points;
+}
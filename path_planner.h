@@ -0,0 +1,140 @@
+// path_planner.h
+// Defines the PathPlanner class for slope- and altitude-aware route planning
+// over the terrain height grid
+
+#ifndef PATH_PLANNER_H
+#define PATH_PLANNER_H
+
+#include "height_grid.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+class PathPlanner {
+public:
+  enum class Mode {
+    AStar,       // 8-connected grid A*
+    ThetaStar,   // Any-angle A* with line-of-sight parent shortcuts
+    Hierarchical // HPA*: abstract search over cluster entrances, refined
+  };
+
+  struct Settings {
+    float slopeWeight;    // Extra cost per unit of rise over run
+    float altitudeWeight; // Extra cost at the top of the height range
+    float maxSlope;       // Steeper steps are impassable
+    int clusterSize;      // HPA* cluster side, in vertices
+
+    Settings()
+        : slopeWeight(4.0f), altitudeWeight(0.5f), maxSlope(2.0f),
+          clusterSize(32) {}
+  };
+
+  struct Result {
+    bool found;
+    float cost;
+    int expanded;              // Nodes closed across every search involved
+    std::vector<int> vertices; // Grid vertex indices from start to goal
+
+    Result() : found(false), cost(0.0f), expanded(0) {}
+  };
+
+  PathPlanner();
+
+  // Take the height grid and build the HPA* abstraction: entrances along
+  // every cluster border and intra-cluster edge costs between them
+  void build(const HeightGrid &grid, const Settings &settings = Settings());
+
+  Result findPath(int startX, int startZ, int goalX, int goalZ, Mode mode);
+
+  // World-space polyline for a result, following the terrain surface between
+  // path vertices and lifted slightly so it draws on top
+  std::vector<glm::vec3> toWorld(const Result &result, float lift) const;
+
+  int getAbstractNodeCount() const {
+    return static_cast<int>(abstractVertex.size());
+  }
+  int getAbstractEdgeCount() const { return static_cast<int>(edges.size()); }
+
+private:
+  // Inclusive vertex rectangle a search is confined to
+  struct Rect {
+    int x0, z0, x1, z1;
+    int width() const { return x1 - x0 + 1; }
+    bool contains(int x, int z) const {
+      return x >= x0 && x <= x1 && z >= z0 && z <= z1;
+    }
+  };
+
+  // Flat per-search arrays with a binary heap open list. Entries are lazily
+  // reset through a generation stamp, so searches allocate nothing once the
+  // arrays have grown to the largest search area.
+  struct SearchState {
+    std::vector<float> g;
+    std::vector<float> f;
+    std::vector<int> parent;
+    std::vector<int> heapIndex; // -1 not open, -2 closed
+    std::vector<uint32_t> stamp;
+    std::vector<int> heap;
+    uint32_t generation;
+
+    SearchState() : generation(0) {}
+    void reset(size_t count);
+    bool seen(int i) const { return stamp[i] == generation; }
+    void touch(int i);
+    void push(int i);
+    int pop();
+    void decrease(int i);
+    void siftUp(int position);
+    void siftDown(int position);
+  };
+
+  struct Edge {
+    int to;
+    float cost;
+  };
+
+  HeightGrid grid;
+  Settings settings;
+  float minHeight;
+  float heightRange;
+
+  // HPA* abstraction, adjacency in compressed rows
+  int clustersX;
+  int clustersZ;
+  std::vector<int> abstractVertex;  // Node -> grid vertex
+  std::vector<int> abstractCluster; // Node -> cluster
+  std::vector<int> clusterNodeOffsets;
+  std::vector<int> clusterNodes;
+  std::vector<int> edgeOffsets;
+  std::vector<Edge> edges;
+
+  SearchState gridState;
+  SearchState clusterState;
+  SearchState abstractState;
+  std::vector<float> startCosts;
+  std::vector<float> goalCosts;
+  std::vector<int> connectTargets;
+
+  float height(int x, int z) const {
+    return grid.heights[static_cast<size_t>(z) * grid.gridSize + x];
+  }
+  float stepCost(float h0, float h1, float distance) const;
+  float lineCost(int fromX, int fromZ, int toX, int toZ) const;
+  Rect clusterRect(int cluster) const;
+  int clusterOf(int x, int z) const;
+
+  // A* from start to goal (goal >= 0) or Dijkstra until every target is
+  // closed (goal < 0), confined to rect. Vertices are global indices.
+  float search(SearchState &state, const Rect &rect, int start, int goal,
+               bool anyAngle, const int *targets, int targetCount,
+               int &expanded) const;
+  void appendPath(const SearchState &state, const Rect &rect, int goal,
+                  std::vector<int> &out) const;
+
+  Result findGridPath(int start, int goal, bool anyAngle);
+  Result findHierarchicalPath(int start, int goal);
+  float pathCost(const std::vector<int> &vertices) const;
+  void smooth(std::vector<int> &vertices) const;
+};
+
+#endif // PATH_PLANNER_H
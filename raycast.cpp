@@ -0,0 +1,214 @@
+// raycast.cpp
+// Implements hierarchical ray/height grid intersection
+
+#include "raycast.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Ray in grid space, where cells are unit squares and y is world height
+struct GridRay {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  glm::vec3 inverse;
+};
+
+struct Traversal {
+  const HeightGrid &grid;
+  const MinMaxPyramid &bounds;
+  GridRay ray;
+  float bestT;
+  int bestX;
+  int bestZ;
+  bool bestUpper; // Hit the (TR, BL, BR) triangle of the cell
+};
+
+// Slab test against an axis-aligned box, clipped to [0, tMax]
+bool intersectBox(const GridRay &ray, const glm::vec3 &lo, const glm::vec3 &hi,
+                  float tMax, float &tEnter) {
+  float t0 = 0.0f;
+  float t1 = tMax;
+  for (int axis = 0; axis < 3; ++axis) {
+    float tNear = (lo[axis] - ray.origin[axis]) * ray.inverse[axis];
+    float tFar = (hi[axis] - ray.origin[axis]) * ray.inverse[axis];
+    if (tNear > tFar)
+      std::swap(tNear, tFar);
+    t0 = std::max(t0, tNear);
+    t1 = std::min(t1, tFar);
+    if (t0 > t1)
+      return false;
+  }
+  tEnter = t0;
+  return true;
+}
+
+// Moller-Trumbore ray/triangle test, returning t through tHit
+bool intersectTriangle(const GridRay &ray, const glm::vec3 &v0,
+                       const glm::vec3 &v1, const glm::vec3 &v2,
+                       float &tHit) {
+  const float epsilon = 1e-7f;
+  glm::vec3 edge1 = v1 - v0;
+  glm::vec3 edge2 = v2 - v0;
+  glm::vec3 p = glm::cross(ray.direction, edge2);
+  float det = glm::dot(edge1, p);
+  if (std::fabs(det) < epsilon)
+    return false;
+
+  float invDet = 1.0f / det;
+  glm::vec3 s = ray.origin - v0;
+  float u = glm::dot(s, p) * invDet;
+  if (u < 0.0f || u > 1.0f)
+    return false;
+
+  glm::vec3 q = glm::cross(s, edge1);
+  float v = glm::dot(ray.direction, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f)
+    return false;
+
+  tHit = glm::dot(edge2, q) * invDet;
+  return tHit >= 0.0f;
+}
+
+void testCell(Traversal &traversal, int x, int z) {
+  const HeightGrid &grid = traversal.grid;
+  if (x >= grid.gridSize - 1 || z >= grid.gridSize - 1)
+    return;
+
+  const float *row0 = grid.heights + static_cast<size_t>(z) * grid.gridSize;
+  const float *row1 = row0 + grid.gridSize;
+  glm::vec3 topLeft(x, row0[x], z);
+  glm::vec3 topRight(x + 1, row0[x + 1], z);
+  glm::vec3 bottomLeft(x, row1[x], z + 1);
+  glm::vec3 bottomRight(x + 1, row1[x + 1], z + 1);
+
+  float t;
+  if (intersectTriangle(traversal.ray, topLeft, bottomLeft, topRight, t) &&
+      t < traversal.bestT) {
+    traversal.bestT = t;
+    traversal.bestX = x;
+    traversal.bestZ = z;
+    traversal.bestUpper = false;
+  }
+  if (intersectTriangle(traversal.ray, topRight, bottomLeft, bottomRight, t) &&
+      t < traversal.bestT) {
+    traversal.bestT = t;
+    traversal.bestX = x;
+    traversal.bestZ = z;
+    traversal.bestUpper = true;
+  }
+}
+
+// Visit a node the ray is known to enter, children nearest first
+void descend(Traversal &traversal, int level, int x, int z) {
+  if (level == 0) {
+    testCell(traversal, x, z);
+    return;
+  }
+
+  struct Candidate {
+    float tEnter;
+    int x;
+    int z;
+  };
+  Candidate candidates[4];
+  int count = 0;
+
+  int childLevel = level - 1;
+  float side = static_cast<float>(1 << childLevel);
+  for (int child = 0; child < 4; ++child) {
+    int cx = 2 * x + (child & 1);
+    int cz = 2 * z + (child >> 1);
+    const MinMaxPyramid::Range &range =
+        traversal.bounds.node(childLevel, cx, cz);
+    if (range.empty())
+      continue;
+
+    glm::vec3 lo(cx * side, range.min, cz * side);
+    glm::vec3 hi((cx + 1) * side, range.max, (cz + 1) * side);
+    float tEnter;
+    if (!intersectBox(traversal.ray, lo, hi, traversal.bestT, tEnter))
+      continue;
+
+    // Insertion sort by entry distance
+    int i = count++;
+    while (i > 0 && candidates[i - 1].tEnter > tEnter) {
+      candidates[i] = candidates[i - 1];
+      --i;
+    }
+    candidates[i].tEnter = tEnter;
+    candidates[i].x = cx;
+    candidates[i].z = cz;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    if (candidates[i].tEnter > traversal.bestT)
+      break;
+    descend(traversal, childLevel, candidates[i].x, candidates[i].z);
+  }
+}
+
+} // namespace
+
+RaycastHit raycastHeightGrid(const HeightGrid &grid,
+                             const MinMaxPyramid &bounds,
+                             const glm::vec3 &origin,
+                             const glm::vec3 &direction, float maxDistance) {
+  RaycastHit result;
+  if (bounds.empty() || !grid.heights)
+    return result;
+
+  // Grid space is an axis scale and offset of world space, so t is shared
+  Traversal traversal = {grid, bounds, GridRay(), maxDistance, -1, -1, false};
+  GridRay &ray = traversal.ray;
+  ray.origin = glm::vec3((origin.x - grid.offset) / grid.step, origin.y,
+                         (origin.z - grid.offset) / grid.step);
+  ray.direction =
+      glm::vec3(direction.x / grid.step, direction.y, direction.z / grid.step);
+  for (int axis = 0; axis < 3; ++axis) {
+    // Avoid 0 * inf in the slab test for axis-parallel rays
+    float d = ray.direction[axis];
+    ray.inverse[axis] = std::fabs(d) > 1e-12f ? 1.0f / d : 1e30f;
+  }
+
+  int top = bounds.getLevelCount() - 1;
+  const MinMaxPyramid::Range &root = bounds.root();
+  float side = static_cast<float>(bounds.getSize());
+  float tEnter;
+  if (root.empty() ||
+      !intersectBox(ray, glm::vec3(0.0f, root.min, 0.0f),
+                    glm::vec3(side, root.max, side), maxDistance, tEnter))
+    return result;
+
+  descend(traversal, top, 0, 0);
+  if (traversal.bestX < 0)
+    return result;
+
+  // Rebuild the hit triangle in world space for the normal
+  int x = traversal.bestX;
+  int z = traversal.bestZ;
+  auto world = [&grid](int vx, int vz) {
+    return glm::vec3(
+        grid.offset + vx * grid.step,
+        grid.heights[static_cast<size_t>(vz) * grid.gridSize + vx],
+        grid.offset + vz * grid.step);
+  };
+  glm::vec3 topRight = world(x + 1, z);
+  glm::vec3 bottomLeft = world(x, z + 1);
+  glm::vec3 normal;
+  if (traversal.bestUpper) {
+    glm::vec3 bottomRight = world(x + 1, z + 1);
+    normal = glm::cross(bottomLeft - topRight, bottomRight - topRight);
+  } else {
+    glm::vec3 topLeft = world(x, z);
+    normal = glm::cross(bottomLeft - topLeft, topRight - topLeft);
+  }
+
+  result.hit = true;
+  result.distance = traversal.bestT;
+  result.point = origin + direction * traversal.bestT;
+  result.normal = glm::normalize(normal);
+  result.cellX = x;
+  result.cellZ = z;
+  return result;
+}
@@ -0,0 +1,34 @@
+// raycast.h
+// Declares ray/terrain intersection over a height grid accelerated by its
+// min/max height pyramid
+
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include "height_grid.h"
+#include "minmax_pyramid.h"
+#include <glm/glm.hpp>
+
+// Result of a terrain ray cast
+struct RaycastHit {
+  bool hit;
+  float distance;  // Ray parameter t, in units of the direction's length
+  glm::vec3 point; // World-space hit point
+  glm::vec3 normal;
+  int cellX;
+  int cellZ;
+
+  RaycastHit()
+      : hit(false), distance(0.0f), point(0.0f), normal(0.0f), cellX(-1),
+        cellZ(-1) {}
+};
+
+// Cast a ray against the grid's triangles. Descends the pyramid front to back,
+// skipping every node whose bounding box the ray misses, and tests the two
+// triangles of each reached cell exactly.
+RaycastHit raycastHeightGrid(const HeightGrid &grid,
+                             const MinMaxPyramid &bounds,
+                             const glm::vec3 &origin,
+                             const glm::vec3 &direction, float maxDistance);
+
+#endif // RAYCAST_H
@@ -0,0 +1,479 @@
+// shader_manager.cpp
+// Implements shader compilation, error logging, the program binary cache and
+// inotify-driven hot reloading
+
+#include "shader_manager.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Header at the start of every cached binary
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
+
+const char kCacheMagic[4] = {'T', 'S', 'H', 'B'};
+const uint32_t kCacheVersion = 1;
+
+std::string glString(GLenum name) {
+  const GLubyte *value = glGetString(name);
+  return value ? reinterpret_cast<const char *>(value) : "";
+}
+
+bool checkShader(GLuint shader, const std::string &path) {
+  GLint status = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status == GL_TRUE)
+    return true;
+
+  GLint length = 0;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+  std::string log(length > 0 ? length : 1, '\0');
+  glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), nullptr,
+                     &log[0]);
+  std::cerr << "Failed to compile shader " << path << ":\n"
+            << log.c_str() << std::endl;
+  return false;
+}
+
+bool checkProgram(GLuint program, const std::string &name, bool logErrors) {
+  GLint status = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status == GL_TRUE)
+    return true;
+
+  if (logErrors) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    std::string log(length > 0 ? length : 1, '\0');
+    glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), nullptr,
+                        &log[0]);
+    std::cerr << "Failed to link program " << name << ":\n"
+              << log.c_str() << std::endl;
+  }
+  return false;
+}
+
+double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+ShaderManager::ShaderManager(const std::string &cacheDirectory)
+    : cacheDirectory(cacheDirectory), binarySupported(false), loadTime(0.0),
+      compiledCount(0), cachedCount(0), parallelCompile(false),
+      inotifyFd(-1) {
+  driver = glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" +
+           glString(GL_VERSION);
+
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  binarySupported = formats > 0;
+
+  // Let the driver pick how many background compiler threads to use
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    parallelCompile = true;
+  }
+}
+
+ShaderManager::~ShaderManager() {
+  for (Rebuild &rebuild : rebuilds) {
+    for (GLuint shader : rebuild.shaders) {
+      glDeleteShader(shader);
+    }
+    glDeleteProgram(rebuild.program);
+  }
+  for (const Program &program : programs) {
+    glDeleteProgram(program.id);
+  }
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+}
+
+int ShaderManager::loadProgram(const std::string &name,
+                               const std::vector<Stage> &stages) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  std::vector<std::string> sources;
+  if (!readSources(stages, sources))
+    return -1;
+
+  Program program;
+  program.name = name;
+  program.stages = stages;
+  program.key = hashSources(stages, sources);
+  program.id = loadBinary(program);
+  if (program.id != 0) {
+    ++cachedCount;
+  } else {
+    program.id = compileProgram(name, stages, sources);
+    if (program.id == 0)
+      return -1;
+    saveBinary(program);
+    ++compiledCount;
+  }
+
+  programs.push_back(program);
+  loadTime += millisecondsSince(start);
+  return static_cast<int>(programs.size()) - 1;
+}
+
+GLuint ShaderManager::getProgram(int handle) const {
+  if (handle < 0 || handle >= static_cast<int>(programs.size()))
+    return 0;
+  return programs[handle].id;
+}
+
+bool ShaderManager::enableHotReload() {
+  if (inotifyFd < 0) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+      std::cerr << "Failed to initialize inotify, shader hot reload disabled"
+                << std::endl;
+      return false;
+    }
+  }
+
+  // Watch directories rather than files: editors often save by writing a
+  // new file and renaming it over the old one, which drops a file watch
+  for (const Program &program : programs) {
+    for (const Stage &stage : program.stages) {
+      size_t slash = stage.path.rfind('/');
+      std::string directory =
+          slash == std::string::npos ? "." : stage.path.substr(0, slash);
+      bool watched = false;
+      for (const Watch &watch : watches) {
+        watched = watched || watch.directory == directory;
+      }
+      if (watched)
+        continue;
+
+      int descriptor = inotify_add_watch(inotifyFd, directory.c_str(),
+                                         IN_CLOSE_WRITE | IN_MOVED_TO);
+      if (descriptor < 0) {
+        std::cerr << "Failed to watch shader directory: " << directory
+                  << std::endl;
+        return false;
+      }
+      watches.push_back({descriptor, directory});
+    }
+  }
+  return true;
+}
+
+void ShaderManager::update() {
+  std::vector<int> changed;
+  collectChangedPrograms(changed);
+  for (int handle : changed) {
+    startRebuild(handle);
+  }
+
+  for (size_t i = 0; i < rebuilds.size();) {
+    if (finishRebuild(rebuilds[i])) {
+      rebuilds.erase(rebuilds.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+void ShaderManager::measureStartup(double &coldTime, double &warmTime) const {
+  coldTime = 0.0;
+  warmTime = 0.0;
+  for (const Program &program : programs) {
+    std::vector<std::string> sources;
+    if (!readSources(program.stages, sources))
+      continue;
+
+    // Querying the link status waits for the driver to finish
+    auto start = std::chrono::high_resolution_clock::now();
+    GLuint compiled = compileProgram(program.name, program.stages, sources);
+    double cold = millisecondsSince(start);
+    coldTime += cold;
+
+    GLint length = 0;
+    if (compiled != 0 && binarySupported)
+      glGetProgramiv(compiled, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+      warmTime += cold;
+      glDeleteProgram(compiled);
+      continue;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(compiled, length, nullptr, &format, binary.data());
+    glDeleteProgram(compiled);
+
+    start = std::chrono::high_resolution_clock::now();
+    GLuint loaded = glCreateProgram();
+    glProgramBinary(loaded, format, binary.data(), length);
+    checkProgram(loaded, program.name, false);
+    warmTime += millisecondsSince(start);
+    glDeleteProgram(loaded);
+  }
+}
+
+bool ShaderManager::readFile(const std::string &path, std::string &contents) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open shader file: " << path << std::endl;
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  contents = buffer.str();
+  return true;
+}
+
+bool ShaderManager::readSources(const std::vector<Stage> &stages,
+                                std::vector<std::string> &sources) const {
+  sources.resize(stages.size());
+  for (size_t i = 0; i < stages.size(); ++i) {
+    if (!readFile(stages[i].path, sources[i]))
+      return false;
+  }
+  return true;
+}
+
+uint64_t
+ShaderManager::hashSources(const std::vector<Stage> &stages,
+                           const std::vector<std::string> &sources) const {
+  uint64_t hash = kHashSeed;
+  hash = hashBytes(hash, driver.data(), driver.size());
+  for (size_t i = 0; i < stages.size(); ++i) {
+    hash = hashBytes(hash, &stages[i].type, sizeof(stages[i].type));
+    hash = hashBytes(hash, sources[i].data(), sources[i].size());
+  }
+  return hash;
+}
+
+GLuint
+ShaderManager::compileProgram(const std::string &name,
+                              const std::vector<Stage> &stages,
+                              const std::vector<std::string> &sources) const {
+  GLuint program = glCreateProgram();
+  std::vector<GLuint> shaders;
+  bool compiled = true;
+  for (size_t i = 0; i < stages.size(); ++i) {
+    GLuint shader = glCreateShader(stages[i].type);
+    const char *source = sources[i].c_str();
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    compiled = checkShader(shader, stages[i].path) && compiled;
+    glAttachShader(program, shader);
+    shaders.push_back(shader);
+  }
+
+  if (compiled) {
+    if (binarySupported)
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                          GL_TRUE);
+    glLinkProgram(program);
+  }
+
+  for (GLuint shader : shaders) {
+    glDetachShader(program, shader);
+    glDeleteShader(shader);
+  }
+
+  if (!compiled || !checkProgram(program, name, true)) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+// Link a program from its cached binary. Returns 0 when there is no cache
+// entry, the key does not match (sources or driver changed) or the driver
+// rejects the binary.
+GLuint ShaderManager::loadBinary(const Program &program) const {
+  if (!binarySupported)
+    return 0;
+
+  std::ifstream file(cachePath(program.name), std::ios::binary);
+  if (!file.is_open())
+    return 0;
+
+  CacheHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header.version != kCacheVersion || header.key != program.key ||
+      header.length == 0)
+    return 0;
+
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), binary.size()))
+    return 0;
+
+  GLuint id = glCreateProgram();
+  glProgramBinary(id, header.format, binary.data(),
+                  static_cast<GLsizei>(binary.size()));
+  if (!checkProgram(id, program.name, false)) {
+    std::cout << "Cached binary for " << program.name
+              << " rejected by the driver, recompiling" << std::endl;
+    glDeleteProgram(id);
+    return 0;
+  }
+  return id;
+}
+
+void ShaderManager::saveBinary(const Program &program) const {
+  if (!binarySupported)
+    return;
+
+  GLint length = 0;
+  glGetProgramiv(program.id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  CacheHeader header;
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.key = program.key;
+  header.length = static_cast<uint32_t>(length);
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program.id, length, nullptr, &format, binary.data());
+  header.format = format;
+
+  mkdir(cacheDirectory.c_str(), 0755);
+  std::ofstream file(cachePath(program.name), std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Failed to write shader cache for " << program.name
+              << std::endl;
+    return;
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(binary.data(), binary.size());
+}
+
+std::string ShaderManager::cachePath(const std::string &name) const {
+  return cacheDirectory + "/" + name + ".bin";
+}
+
+// Drain pending inotify events and list each program with a changed stage
+void ShaderManager::collectChangedPrograms(std::vector<int> &handles) {
+  if (inotifyFd < 0)
+    return;
+
+  alignas(inotify_event) char buffer[4096];
+  ssize_t length;
+  while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+    for (char *cursor = buffer; cursor < buffer + length;) {
+      const inotify_event *event =
+          reinterpret_cast<const inotify_event *>(cursor);
+      cursor += sizeof(inotify_event) + event->len;
+      if (event->len == 0)
+        continue;
+
+      std::string path = event->name;
+      for (const Watch &watch : watches) {
+        if (watch.descriptor == event->wd && watch.directory != ".")
+          path = watch.directory + "/" + path;
+      }
+      for (size_t handle = 0; handle < programs.size(); ++handle) {
+        for (const Stage &stage : programs[handle].stages) {
+          if (stage.path == path &&
+              std::find(handles.begin(), handles.end(), handle) ==
+                  handles.end())
+            handles.push_back(static_cast<int>(handle));
+        }
+      }
+    }
+  }
+}
+
+// Issue the compile and link for a changed program without waiting on them
+void ShaderManager::startRebuild(int handle) {
+  const Program &program = programs[handle];
+  std::vector<std::string> sources;
+  if (!readSources(program.stages, sources))
+    return;
+
+  // A newer edit supersedes a rebuild still in flight
+  for (size_t i = 0; i < rebuilds.size(); ++i) {
+    if (rebuilds[i].handle == handle) {
+      for (GLuint shader : rebuilds[i].shaders) {
+        glDeleteShader(shader);
+      }
+      glDeleteProgram(rebuilds[i].program);
+      rebuilds.erase(rebuilds.begin() + i);
+      break;
+    }
+  }
+
+  Rebuild rebuild;
+  rebuild.handle = handle;
+  rebuild.key = hashSources(program.stages, sources);
+  rebuild.start = std::chrono::high_resolution_clock::now();
+  rebuild.program = glCreateProgram();
+  for (size_t i = 0; i < program.stages.size(); ++i) {
+    GLuint shader = glCreateShader(program.stages[i].type);
+    const char *source = sources[i].c_str();
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    glAttachShader(rebuild.program, shader);
+    rebuild.shaders.push_back(shader);
+  }
+  if (binarySupported)
+    glProgramParameteri(rebuild.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  glLinkProgram(rebuild.program);
+  rebuilds.push_back(rebuild);
+  std::cout << "Reloading " << program.name << "..." << std::endl;
+}
+
+// Returns false while the driver is still working on the rebuild. Once it is
+// done, a successful link replaces the live program in one assignment, so
+// callers see either the old program or the new one and never a half-built
+// one.
+bool ShaderManager::finishRebuild(Rebuild &rebuild) {
+  if (parallelCompile) {
+    GLint done = GL_FALSE;
+    glGetProgramiv(rebuild.program, GL_COMPLETION_STATUS_KHR, &done);
+    if (done != GL_TRUE)
+      return false;
+  }
+
+  Program &program = programs[rebuild.handle];
+  bool compiled = true;
+  for (size_t i = 0; i < rebuild.shaders.size(); ++i) {
+    compiled = checkShader(rebuild.shaders[i], program.stages[i].path) &&
+               compiled;
+    glDetachShader(rebuild.program, rebuild.shaders[i]);
+    glDeleteShader(rebuild.shaders[i]);
+  }
+
+  if (!compiled || !checkProgram(rebuild.program, program.name, true)) {
+    std::cerr << "Keeping the previous " << program.name << " program"
+              << std::endl;
+    glDeleteProgram(rebuild.program);
+    return true;
+  }
+
+  GLuint previous = program.id;
+  program.id = rebuild.program;
+  program.key = rebuild.key;
+  glDeleteProgram(previous);
+  saveBinary(program);
+  std::cout << "Reloaded " << program.name << " in "
+            << millisecondsSince(rebuild.start) << " ms" << std::endl;
+  return true;
+}
@@ -0,0 +1,109 @@
+// shader_manager.h
+// Defines the ShaderManager class, which builds GLSL programs from source
+// files, caches their linked binaries on disk and hot-reloads edited sources
+
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ShaderManager {
+public:
+  struct Stage {
+    GLenum type; // GL_VERTEX_SHADER, GL_COMPUTE_SHADER, ...
+    std::string path;
+  };
+
+  // Requires a current GL context. Binaries are cached in cacheDirectory,
+  // which is created on first use.
+  explicit ShaderManager(const std::string &cacheDirectory = "shader_cache");
+  ~ShaderManager();
+
+  // Build a program from its stages. A cached binary is used when its key
+  // (hash of every stage's source plus the GL vendor, renderer and version)
+  // matches; otherwise the sources are compiled, linked and the result is
+  // cached. Compile and link errors are logged. Returns a handle for
+  // getProgram(), or -1 if the program could not be built.
+  int loadProgram(const std::string &name, const std::vector<Stage> &stages);
+
+  // Linked program for a handle, 0 for an invalid handle. Look it up each
+  // time it is used: hot reloading replaces the program behind a handle.
+  GLuint getProgram(int handle) const;
+
+  // Watch the source files of every loaded program with inotify. Returns
+  // false if the watches could not be set up.
+  bool enableHotReload();
+
+  // Call once per frame. Starts rebuilding programs whose sources changed
+  // and swaps in each rebuilt program once it has linked; until then, and
+  // for good if the new sources fail to build, the previous program stays
+  // in use. With GL_KHR_parallel_shader_compile the driver compiles in the
+  // background and this never waits on it; without it a rebuild is finished
+  // in the frame it starts.
+  void update();
+
+  // Totals over every loadProgram call
+  double getLoadTime() const { return loadTime; } // Milliseconds
+  int getCompiledCount() const { return compiledCount; }
+  int getCachedCount() const { return cachedCount; }
+
+  // Rebuild every loaded program once from source (cold) and once from its
+  // binary (warm) into scratch programs and report the total times in
+  // milliseconds. Warm equals cold when the driver has no binary formats.
+  void measureStartup(double &coldTime, double &warmTime) const;
+
+private:
+  struct Program {
+    std::string name;
+    std::vector<Stage> stages;
+    GLuint id;
+    uint64_t key;
+  };
+
+  // An in-flight rebuild of programs[handle]
+  struct Rebuild {
+    int handle;
+    GLuint program;
+    std::vector<GLuint> shaders;
+    uint64_t key;
+    std::chrono::high_resolution_clock::time_point start;
+  };
+
+  struct Watch {
+    int descriptor;
+    std::string directory;
+  };
+
+  std::string cacheDirectory;
+  std::string driver;
+  bool binarySupported;
+  std::vector<Program> programs;
+  double loadTime;
+  int compiledCount;
+  int cachedCount;
+  bool parallelCompile;
+  int inotifyFd;
+  std::vector<Watch> watches;
+  std::vector<Rebuild> rebuilds;
+
+  static bool readFile(const std::string &path, std::string &contents);
+  bool readSources(const std::vector<Stage> &stages,
+                   std::vector<std::string> &sources) const;
+  uint64_t hashSources(const std::vector<Stage> &stages,
+                       const std::vector<std::string> &sources) const;
+  GLuint compileProgram(const std::string &name,
+                        const std::vector<Stage> &stages,
+                        const std::vector<std::string> &sources) const;
+  GLuint loadBinary(const Program &program) const;
+  void saveBinary(const Program &program) const;
+  std::string cachePath(const std::string &name) const;
+  void collectChangedPrograms(std::vector<int> &handles);
+  void startRebuild(int handle);
+  bool finishRebuild(Rebuild &rebuild);
+};
+
+#endif // SHADER_MANAGER_H
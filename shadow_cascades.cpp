@@ -0,0 +1,212 @@
+// shadow_cascades.cpp
+// Implements cascade fitting and shadow map rendering
+
+#include "shadow_cascades.h"
+#include "terrain.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <limits>
+#include <string>
+
+namespace {
+
+// Blend between logarithmic (1) and uniform (0) split distances
+const float kSplitLambda = 0.75f;
+
+// Caster level of detail per cascade
+const int kCascadeLods[ShadowCascades::kCascades] = {0, 1, 2, 2};
+
+} // namespace
+
+ShadowCascades::ShadowCascades(GpuTimers &timers)
+    : timers(timers), depthTexture(0), framebuffer(0), cascadeMask(0) {
+  for (int i = 0; i < kCascades; ++i) {
+    timerSections[i] =
+        timers.getSection("Shadow cascade " + std::to_string(i));
+    cascadeFar[i] = 0.0f;
+  }
+
+  // Hardware depth comparison with bilinear filtering gives 2x2 PCF, and
+  // lookups outside a cascade compare against the far plane (unshadowed)
+  glGenTextures(1, &depthTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, kResolution,
+               kResolution, kCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,
+                  GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,
+                  GL_CLAMP_TO_BORDER);
+  GLfloat border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+  glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                  GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowCascades::~ShadowCascades() {
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteTextures(1, &depthTexture);
+}
+
+void ShadowCascades::update(const glm::mat4 &view,
+                            const glm::mat4 &projection,
+                            const glm::vec3 &sunDirection,
+                            const Terrain &terrain) {
+  cascadeMask = 0;
+  const std::vector<BoundingBox> &chunks = terrain.getChunkBounds();
+  if (chunks.empty())
+    return;
+
+  // Shadows are only needed as far as the farthest corner of the terrain
+  float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+  glm::vec3 eye(glm::inverse(view)[3]);
+  BoundingBox terrainBounds = chunks[0];
+  for (const BoundingBox &box : chunks) {
+    terrainBounds.min = glm::min(terrainBounds.min, box.min);
+    terrainBounds.max = glm::max(terrainBounds.max, box.max);
+  }
+  float terrainFar = 0.0f;
+  for (int corner = 0; corner < 8; ++corner) {
+    glm::vec3 point((corner & 1) ? terrainBounds.max.x : terrainBounds.min.x,
+                    (corner & 2) ? terrainBounds.max.y : terrainBounds.min.y,
+                    (corner & 4) ? terrainBounds.max.z : terrainBounds.min.z);
+    terrainFar = std::max(terrainFar, glm::length(point - eye));
+  }
+  float shadowFar = std::min(farPlane, terrainFar);
+  if (shadowFar <= nearPlane)
+    return;
+
+  // Light space: a rotation looking down the sun direction
+  glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(0, 0, 1)
+                                                  : glm::vec3(0, 1, 0);
+  glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -sunDirection, up);
+  std::vector<glm::vec2> chunkMin(chunks.size());
+  std::vector<glm::vec2> chunkMax(chunks.size());
+  std::vector<float> chunkNear(chunks.size()); // Largest light-space z
+  std::vector<float> chunkFar(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; ++corner) {
+      glm::vec3 point((corner & 1) ? chunks[i].max.x : chunks[i].min.x,
+                      (corner & 2) ? chunks[i].max.y : chunks[i].min.y,
+                      (corner & 4) ? chunks[i].max.z : chunks[i].min.z);
+      glm::vec3 light(lightView * glm::vec4(point, 1.0f));
+      lo = glm::min(lo, light);
+      hi = glm::max(hi, light);
+    }
+    chunkMin[i] = glm::vec2(lo.x, lo.y);
+    chunkMax[i] = glm::vec2(hi.x, hi.y);
+    chunkNear[i] = hi.z;
+    chunkFar[i] = lo.z;
+  }
+
+  // Spread of the frustum's corners per unit of view depth
+  float spread = std::sqrt(1.0f / (projection[0][0] * projection[0][0]) +
+                           1.0f / (projection[1][1] * projection[1][1]));
+  glm::mat4 inverseView = glm::inverse(view);
+  glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) *
+                   glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+
+  float sliceNear = nearPlane;
+  for (int cascade = 0; cascade < kCascades; ++cascade) {
+    float t = static_cast<float>(cascade + 1) / kCascades;
+    float logSplit = nearPlane * std::pow(shadowFar / nearPlane, t);
+    float uniformSplit = nearPlane + (shadowFar - nearPlane) * t;
+    float sliceFar =
+        kSplitLambda * logSplit + (1.0f - kSplitLambda) * uniformSplit;
+    cascadeFar[cascade] = sliceFar;
+
+    // Smallest sphere around the slice; it depends only on the slice depths
+    // and the field of view, so the cascade's size never changes
+    float k2 = spread * spread;
+    float centerDepth = std::min(
+        (sliceNear + sliceFar) * (1.0f + k2) / 2.0f, sliceFar);
+    float radius =
+        std::sqrt((centerDepth - sliceNear) * (centerDepth - sliceNear) +
+                  sliceNear * sliceNear * k2);
+    radius = std::max(radius, sliceFar * spread);
+    glm::vec3 center(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+    sliceNear = sliceFar;
+
+    // Snap the light-space center to whole texels
+    glm::vec3 lightCenter(lightView * glm::vec4(center, 1.0f));
+    float texel = 2.0f * radius / kResolution;
+    lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+    lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+    glm::vec2 lo(lightCenter.x - radius, lightCenter.y - radius);
+    glm::vec2 hi(lightCenter.x + radius, lightCenter.y + radius);
+
+    // Depth range of the chunks under the cascade
+    float nearZ = -std::numeric_limits<float>::max();
+    float farZ = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      if (chunkMax[i].x < lo.x || chunkMin[i].x > hi.x ||
+          chunkMax[i].y < lo.y || chunkMin[i].y > hi.y)
+        continue;
+      nearZ = std::max(nearZ, chunkNear[i]);
+      farZ = std::min(farZ, chunkFar[i]);
+    }
+    if (nearZ < farZ)
+      continue;
+    float margin = 0.01f * (nearZ - farZ) + 0.01f;
+
+    glm::mat4 ortho = glm::ortho(lo.x, hi.x, lo.y, hi.y, -nearZ - margin,
+                                 -farZ + margin);
+    casterMatrices[cascade] = ortho * lightView;
+    shadowMatrices[cascade] = bias * casterMatrices[cascade];
+    cascadeMask |= 1u << cascade;
+  }
+}
+
+void ShadowCascades::render(const Terrain &terrain) const {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint polygonMode[2];
+  glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, kResolution, kResolution);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+  for (int cascade = 0; cascade < kCascades; ++cascade) {
+    if ((cascadeMask & (1u << cascade)) == 0)
+      continue;
+    timers.begin(timerSections[cascade]);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              depthTexture, 0, cascade);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    terrain.renderShadowCasters(casterMatrices[cascade],
+                                kCascadeLods[cascade]);
+    timers.end(timerSections[cascade]);
+  }
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void ShadowCascades::bind(GLuint program) const {
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glUniformMatrix4fv(glGetUniformLocation(program, "shadowMatrices"),
+                     kCascades, GL_FALSE, glm::value_ptr(shadowMatrices[0]));
+  glUniform1fv(glGetUniformLocation(program, "cascadeFar"), kCascades,
+               cascadeFar);
+  glUniform1ui(glGetUniformLocation(program, "cascadeMask"), cascadeMask);
+}
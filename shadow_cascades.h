@@ -0,0 +1,58 @@
+// shadow_cascades.h
+// Defines cascaded shadow maps for the directional sun over the terrain
+
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include "gpu_timers.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+class Terrain;
+
+// Splits the view frustum, up to where the terrain ends, into kCascades
+// depth slices and renders a sun shadow map for each into one layer of a
+// depth texture array. Each cascade's orthographic volume is fitted to the
+// bounding sphere of its slice (stable as the camera turns, snapped to
+// whole texels as it moves) and its depth range to the chunk bounds it
+// covers, so no depth precision is spent above or below the terrain.
+// Casters are drawn at coarser chunk levels of detail in farther cascades.
+class ShadowCascades {
+public:
+  static const int kCascades = 4;
+  static const int kResolution = 1024;
+
+  // Requires a current GL context. Each cascade's render time is measured
+  // as a section of timers.
+  explicit ShadowCascades(GpuTimers &timers);
+  ~ShadowCascades();
+
+  // Fit the cascades to the view frustum of view and projection (a
+  // perspective projection); sunDirection points towards the sun
+  void update(const glm::mat4 &view, const glm::mat4 &projection,
+              const glm::vec3 &sunDirection, const Terrain &terrain);
+
+  // Render the terrain into every cascade in use. Restores the default
+  // framebuffer, the viewport and the polygon mode.
+  void render(const Terrain &terrain) const;
+
+  // Bind the shadow map to texture unit 2 and set the cascade uniforms of
+  // a lit program (which must be in use)
+  void bind(GLuint program) const;
+
+private:
+  GpuTimers &timers;
+  int timerSections[kCascades];
+  GLuint depthTexture; // Depth array, one layer per cascade
+  GLuint framebuffer;
+
+  glm::mat4 casterMatrices[kCascades]; // World to cascade clip space
+  glm::mat4 shadowMatrices[kCascades]; // World to shadow map coordinates
+  float cascadeFar[kCascades];         // View depth where each cascade ends
+  unsigned int cascadeMask;            // Bit per cascade covering terrain
+
+  ShadowCascades(const ShadowCascades &) = delete;
+  ShadowCascades &operator=(const ShadowCascades &) = delete;
+};
+
+#endif // SHADOW_CASCADES_H
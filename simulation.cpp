@@ -0,0 +1,152 @@
+// simulation.cpp
+// Implements the simulation thread and frame packet production
+
+#include "simulation.h"
+#include <iostream>
+
+namespace {
+
+// Sleep in short slices until ready() holds. Returns false if running is
+// cleared first.
+template <typename Ready>
+bool waitFor(const std::atomic<bool> &running, Ready ready) {
+  while (!ready()) {
+    if (!running.load(std::memory_order_acquire))
+      return false;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return true;
+}
+
+} // namespace
+
+Simulation::Simulation(Camera &camera, Terrain &terrain, bool cpuNormals)
+    : camera(camera), terrain(terrain),
+      cpuNormals(cpuNormals && terrain.getNormalRegionCount() ==
+                                   TripleBuffer<FramePacket>::kSlots),
+      running(false), aspect(1.0f), busyTime(0.0), frameIndex(0),
+      lastLookX(0.0f), lastLookY(0.0f), followToggles(0) {}
+
+Simulation::~Simulation() { stop(); }
+
+void Simulation::start() {
+  if (thread.joinable())
+    return;
+  // The first packet is built here, where nothing else polls the fences:
+  // a region drawn since the last poll would never turn idle for step()
+  if (cpuNormals)
+    terrain.waitNormalFences();
+  running.store(true);
+  busyTime = 0.0;
+  startTime = lastStep = Clock::now();
+  step();
+  thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+  if (!thread.joinable())
+    return;
+  running.store(false);
+  thread.join();
+  stopTime = Clock::now();
+}
+
+void Simulation::submitInput(const InputState &input) {
+  inputs.writeSlot() = input;
+  inputs.publish();
+}
+
+void Simulation::setFramebufferSize(int width, int height) {
+  if (width > 0 && height > 0)
+    aspect.store(static_cast<float>(width) / height,
+                 std::memory_order_relaxed);
+}
+
+double Simulation::getUtilization() const {
+  double wall = std::chrono::duration<double>(stopTime - startTime).count();
+  return wall > 0.0 ? busyTime / wall : 0.0;
+}
+
+void Simulation::run() {
+  while (running.load(std::memory_order_acquire)) {
+    // Pace to the renderer: build the next packet once the last is taken
+    if (!waitFor(running, [this] { return !frames.pending(); }))
+      break;
+    if (!step())
+      break;
+  }
+}
+
+// Build and publish one packet. Returns false if stopped while waiting for
+// a normal region.
+bool Simulation::step() {
+  Clock::time_point stepStart = Clock::now();
+  float deltaTime =
+      std::chrono::duration<float>(stepStart - lastStep).count();
+  lastStep = stepStart;
+
+  inputs.acquire();
+  applyInput(inputs.readSlot(), deltaTime);
+
+  FramePacket &packet = frames.writeSlot();
+  packet.frame = ++frameIndex;
+  packet.projection =
+      glm::perspective(glm::radians(45.0f),
+                       aspect.load(std::memory_order_relaxed), 0.1f, 100.0f);
+  packet.view = camera.GetViewMatrix();
+  packet.cameraPosition = camera.Position;
+  packet.cameraFront = camera.Front;
+  packet.normalRegion = -1;
+  packet.normalTime = 0.0;
+
+  Clock::time_point workEnd = Clock::now();
+  double busy = std::chrono::duration<double>(workEnd - stepStart).count();
+
+  if (cpuNormals) {
+    // The region was drawn at most a couple of frames ago; waiting for its
+    // fence is idle time, not work
+    int region = frames.writeIndex();
+    if (!waitFor(running,
+                 [this, region] { return terrain.isNormalRegionIdle(region); }))
+      return false;
+    Clock::time_point normalStart = Clock::now();
+    terrain.writeNormalRegion(region);
+    workEnd = Clock::now();
+    double normalTime =
+        std::chrono::duration<double>(workEnd - normalStart).count();
+    packet.normalRegion = region;
+    packet.normalTime = normalTime * 1000.0;
+    busy += normalTime;
+  }
+
+  busyTime += busy;
+  frames.publish();
+  return true;
+}
+
+void Simulation::applyInput(const InputState &input, float deltaTime) {
+  float cameraSpeed = 2.5f * deltaTime;
+  if (input.forward)
+    camera.ProcessKeyboard(cameraSpeed, true, false, false, false);
+  if (input.backward)
+    camera.ProcessKeyboard(cameraSpeed, false, true, false, false);
+  if (input.left)
+    camera.ProcessKeyboard(cameraSpeed, false, false, true, false);
+  if (input.right)
+    camera.ProcessKeyboard(cameraSpeed, false, false, false, true);
+
+  float lookX = input.lookX - lastLookX;
+  float lookY = input.lookY - lastLookY;
+  lastLookX = input.lookX;
+  lastLookY = input.lookY;
+  if (lookX != 0.0f || lookY != 0.0f)
+    camera.ProcessMouseMovement(lookX, lookY);
+
+  // An odd number of presses since the last step flips following
+  if ((input.followToggles - followToggles) & 1u) {
+    camera.SetFollowTerrain(!camera.FollowTerrain);
+    std::cout << "Terrain following " << (camera.FollowTerrain ? "on" : "off")
+              << std::endl;
+  }
+  followToggles = input.followToggles;
+}
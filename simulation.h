@@ -0,0 +1,95 @@
+// simulation.h
+// Defines the simulation thread and the frame packets it hands to the
+// render thread
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "camera.h"
+#include "input.h"
+#include "terrain.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <chrono>
+#include <glm/glm.hpp>
+#include <thread>
+
+// Everything the render thread needs to draw one frame. A packet is built
+// by the simulation thread and never modified after it is published.
+struct FramePacket {
+  unsigned long long frame; // Simulation step that produced the packet
+  glm::mat4 projection;
+  glm::mat4 view;
+  glm::vec3 cameraPosition;
+  glm::vec3 cameraFront;
+  int normalRegion;  // Normal ring region filled for this frame, or -1 when
+                     // the render thread computes normals itself
+  double normalTime; // Time spent on CPU normals for the packet, in ms
+
+  FramePacket() : frame(0), normalRegion(-1), normalTime(0.0) {}
+};
+
+// Runs input handling, camera and terrain-following updates and CPU-side
+// frame preparation on its own thread. Input goes in and frame packets
+// come out through lock-free triple buffers, so neither thread blocks the
+// other. The simulation builds one packet per packet the renderer takes,
+// overlapping the CPU work for the next frame with the drawing of this one.
+class Simulation {
+public:
+  // With cpuNormals the CPU normal kernel runs here, writing straight into
+  // the terrain's persistently mapped normal ring: packet slot i fills ring
+  // region i once the GPU has finished drawing it. Without a ring, normals
+  // are left to the render thread.
+  Simulation(Camera &camera, Terrain &terrain, bool cpuNormals);
+  ~Simulation();
+
+  // Build the first packet on the calling thread, then start the thread.
+  // Call on the render thread: with cpuNormals it first waits out the
+  // fences of the regions drawn before a restart.
+  void start();
+  void stop();
+
+  // Render thread side. acquireFrame() returns true when a newer packet
+  // replaced the one returned by getFrame().
+  void submitInput(const InputState &input);
+  // Size the packets' projection is built for. A zero size (a minimized
+  // window) keeps the previous aspect ratio.
+  void setFramebufferSize(int width, int height);
+  bool acquireFrame() { return frames.acquire(); }
+  const FramePacket &getFrame() const { return frames.readSlot(); }
+
+  // Fraction of the time between start() and stop() the thread spent
+  // working rather than waiting for the renderer. Valid after stop().
+  double getUtilization() const;
+
+private:
+  typedef std::chrono::high_resolution_clock Clock;
+
+  Camera &camera;
+  Terrain &terrain;
+  bool cpuNormals;
+
+  TripleBuffer<InputState> inputs;
+  TripleBuffer<FramePacket> frames;
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<float> aspect; // Framebuffer width over height
+
+  Clock::time_point startTime;
+  Clock::time_point stopTime;
+  Clock::time_point lastStep;
+  double busyTime; // Seconds
+  unsigned long long frameIndex;
+  float lastLookX;
+  float lastLookY;
+  unsigned int followToggles;
+
+  void run();
+  bool step();
+  void applyInput(const InputState &input, float deltaTime);
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+};
+
+#endif // SIMULATION_H
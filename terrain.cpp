@@ -2,38 +2,189 @@
 // Implements the Terrain class methods for generating and rendering 3D terrain
 
 #include "terrain.h"
+#include "hash.h"
+#include "height_sampler.h"
+#include "mesh_cache.h"
+#include "parallel.h"
+#include <algorithm>
 #include <cmath>
-#include <fstream>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <sys/stat.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// World units per unit of normalized heightmap height
+static const float kHeightScale = 10.0f;
+
 // Constructor
 Terrain::Terrain(int gridSize)
-    : showNormals(false), gridSize(gridSize), heightmapWidth(0),
-      heightmapHeight(0), computeProgram(0), heightMapTexture(0),
-      normalMapTexture(0), useCPUOnly(false) {}
+    : showNormals(false), gridSize(gridSize), worldSize(50.0f), mesh(),
+      heightmapWidth(0), heightmapHeight(0),
+      heightFilter(HeightFilter::Bilinear), heightmapLevel(0), shaders(nullptr),
+      normalsProgram(-1), litProgram(-1), gbufferProgram(-1), lighting(nullptr),
+      deferred(nullptr), shadingPath(ShadingPath::Forward), culling(nullptr),
+      shadows(nullptr), sunShadows(SunShadows::HorizonMap),
+      sunDirection(glm::normalize(glm::vec3(1.0f))), heightMapTexture(0),
+      normalMapTexture(0), viewshedTexture(0), showViewshed(false),
+      slopeTexture(0), aspectTexture(0), curvatureTexture(0), horizonTexture(0),
+      normalFormat(NormalMap::Format::RG16), rasterOverlay(RasterOverlay::None),
+      vertexBuffer(0), indexBuffer(0), normalBuffer(0), chunkIdBuffer(0),
+      paletteTexture(0), normalRing(nullptr), normalRegionStride(0),
+      normalRegion(0), normalFences(),
+      idleNormalRegions((1u << kNormalRegions) - 1), useCPUOnly(false) {}
 
 // Destructor
 Terrain::~Terrain() {
   // Clean up OpenGL resources
-  glDeleteProgram(computeProgram);
   glDeleteTextures(1, &heightMapTexture);
   glDeleteTextures(1, &normalMapTexture);
+  glDeleteTextures(1, &viewshedTexture);
+  glDeleteTextures(1, &slopeTexture);
+  glDeleteTextures(1, &aspectTexture);
+  glDeleteTextures(1, &curvatureTexture);
+  glDeleteTextures(1, &horizonTexture);
   glDeleteBuffers(1, &vertexBuffer);
   glDeleteBuffers(1, &indexBuffer);
-  glDeleteBuffers(1, &normalBuffer);
+  releaseNormalRing();
+  glDeleteBuffers(1, &chunkIdBuffer);
+  glDeleteTextures(1, &paletteTexture);
 }
 
 // Set whether to show normal vectors
 void Terrain::setShowNormals(bool show) { showNormals = show; }
 
+// Upload a viewshed as a tint texture; hidden vertices are drawn darkened
+void Terrain::setViewshed(const Viewshed &viewshed) {
+  if (viewshed.getGridSize() != gridSize)
+    return;
+
+  std::vector<unsigned char> tint(static_cast<size_t>(gridSize) * gridSize *
+                                  3);
+  parallelFor(0, gridSize, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      unsigned char *texel = &tint[static_cast<size_t>(z) * gridSize * 3];
+      for (int x = 0; x < gridSize; ++x) {
+        bool visible = viewshed.isVisible(x, z);
+        texel[0] = visible ? 255 : 140;
+        texel[1] = visible ? 255 : 90;
+        texel[2] = visible ? 255 : 90;
+        texel += 3;
+      }
+    }
+  });
+
+  if (viewshedTexture == 0) {
+    glGenTextures(1, &viewshedTexture);
+  }
+  glBindTexture(GL_TEXTURE_2D, viewshedTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, gridSize, gridSize, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, tint.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  showViewshed = true;
+}
+
+// Upload the derived rasters in their compact formats. Each is swizzled to
+// grayscale so it can be drawn directly as an overlay. The horizon map goes
+// to an RGBA8 array texture, one layer per pair of directions, and the
+// normal map to a two-channel signed normalized texture.
+void Terrain::uploadRasterTextures() {
+  struct Upload {
+    GLuint *texture;
+    GLenum internalFormat;
+    GLenum type;
+    const void *data;
+  };
+  const Upload uploads[] = {
+      {&slopeTexture, GL_R8, GL_UNSIGNED_BYTE, rasters.getSlope().data()},
+      {&aspectTexture, GL_R16, GL_UNSIGNED_SHORT, rasters.getAspect().data()},
+      {&curvatureTexture, GL_R16_SNORM, GL_SHORT,
+       rasters.getCurvature().data()},
+  };
+  const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (const Upload &upload : uploads) {
+    if (*upload.texture == 0) {
+      glGenTextures(1, upload.texture);
+    }
+    glBindTexture(GL_TEXTURE_2D, *upload.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, upload.internalFormat, gridSize, gridSize,
+                 0, GL_RED, upload.type, upload.data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (horizonMap.empty())
+    return;
+  if (horizonTexture == 0) {
+    glGenTextures(1, &horizonTexture);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, horizonTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, gridSize, gridSize,
+               horizonMap.getLayerCount(), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               horizonMap.getLayers().data());
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  if (normalMap.empty())
+    return;
+  bool rg8 = normalMap.getFormat() == NormalMap::Format::RG8;
+  if (normalMapTexture == 0) {
+    glGenTextures(1, &normalMapTexture);
+  }
+  glBindTexture(GL_TEXTURE_2D, normalMapTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, rg8 ? 2 : 4);
+  glTexImage2D(GL_TEXTURE_2D, 0, rg8 ? GL_RG8_SNORM : GL_RG16_SNORM,
+               normalMap.getWidth(), normalMap.getHeight(), 0, GL_RG,
+               rg8 ? GL_BYTE : GL_SHORT, normalMap.getTexels().data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  uploadPalette();
+}
+
+// Bake the palette into a 1D RGB8 texture indexed by normalized height
+void Terrain::uploadPalette() {
+  std::vector<uint8_t> texels = palette.bake();
+  if (paletteTexture == 0) {
+    glGenTextures(1, &paletteTexture);
+  }
+  glBindTexture(GL_TEXTURE_1D, paletteTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, TerrainPalette::kTextureSize, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, texels.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_1D, 0);
+}
+
 // Get the number of triangles in the terrain
-int Terrain::getTriangleCount() const { return indices.size() / 3; }
+int Terrain::getTriangleCount() const {
+  return static_cast<int>(mesh.indexCount / 3);
+}
 
 // Load heightmap from an image file
 bool Terrain::loadHeightmap(const std::string &filename) {
@@ -48,9 +199,19 @@ bool Terrain::loadHeightmap(const std::string &filename) {
   heightmapData =
       std::vector<unsigned char>(data, data + heightmapWidth * heightmapHeight);
   stbi_image_free(data);
+
+  // Prefilter once so any grid resolution can be resampled without aliasing
+  heightmapPyramid.build(heightmapData.data(), heightmapWidth,
+                         heightmapHeight);
   return true;
 }
 
+// Rows per job for the generation stages. Normal bands recompute the face
+// normals of the row above them, so they are kept coarser.
+static const int kVertexRowGrain = 8;
+static const int kIndexRowGrain = 32;
+static const int kNormalRowGrain = 16;
+
 // Generate terrain mesh from heightmap data
 void Terrain::generate() {
   if (heightmapData.empty()) {
@@ -59,170 +220,1017 @@ void Terrain::generate() {
     return;
   }
 
-  float size = 50.0f;
+  int cells = gridSize - 1;
+
+  // Sample the pyramid level whose texel spacing matches the grid spacing
+  float footprint = static_cast<float>(std::max(heightmapWidth,
+                                                heightmapHeight)) /
+                    static_cast<float>(cells);
+  heightmapLevel = heightmapPyramid.selectLevel(footprint);
+
+  // Size every array up front so jobs can fill disjoint rows
+  heights.resize(static_cast<size_t>(gridSize) * gridSize);
+  vertices.resize(static_cast<size_t>(gridSize) * gridSize * 3);
+  normals.resize(vertices.size());
+  indices.resize(static_cast<size_t>(cells) * cells * 6);
+  meshCache.close();
+  mesh.heights = heights.data();
+  mesh.vertices = vertices.data();
+  mesh.indices = indices.data();
+  mesh.indexCount = indices.size();
+
+  // Vertices and indices are independent; normals and the query structures
+  // need the vertices. Only the GL uploads stay on this thread.
+  JobSystem &jobs = JobSystem::shared();
+  JobRef vertexJob = jobs.createJob([this, &jobs] {
+    generateVertices(jobs, vertices.data(), heights.data());
+  });
+  JobRef indexJob = jobs.createJob(
+      [this, &jobs] { generateIndices(jobs, indices.data()); });
+  JobRef normalJob = jobs.createJob(
+      [this, &jobs] { calculateNormals(jobs, normals.data()); });
+  JobRef queryJob = jobs.createJob([this] { buildQueryStructures(); });
+  JobRef meshJob = jobs.createJob(nullptr);
+  jobs.addDependency(normalJob, vertexJob);
+  jobs.addDependency(queryJob, vertexJob);
+  jobs.addDependency(meshJob, indexJob);
+  jobs.addDependency(meshJob, normalJob);
+  jobs.addDependency(meshJob, queryJob);
+  for (const JobRef &job : {vertexJob, indexJob, normalJob, queryJob,
+                            meshJob}) {
+    jobs.submit(job);
+  }
+  jobs.wait(meshJob);
+
+  mesh.lodIndices = lodIndices.data();
+  mesh.lodIndexCount = lodIndices.size();
+  setupBuffers(normals.data());
+  uploadRasterTextures();
+}
+
+// Resample the heightmap into vertex positions and heights
+void Terrain::generateVertices(JobSystem &jobs, float *vertexOut,
+                               float *heightOut) const {
+  float size = worldSize;
   float step = size / static_cast<float>(gridSize - 1);
 
-  vertices.clear();
-  indices.clear();
+  jobs.parallelFor(0, gridSize, kVertexRowGrain, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      float *vertex = &vertexOut[static_cast<size_t>(z) * gridSize * 3];
+      for (int x = 0; x < gridSize; ++x) {
+        float yPos = getHeight(x, z);
+        heightOut[static_cast<size_t>(z) * gridSize + x] = yPos;
+        vertex[0] = x * step - size / 2.0f;
+        vertex[1] = yPos;
+        vertex[2] = z * step - size / 2.0f;
+        vertex += 3;
+      }
+    }
+  });
+}
+
+// Position of a chunk's first index. Every chunk row above it is full
+// width, and the chunks to its left in its own row share its height.
+size_t Terrain::chunkFirstIndex(int chunkX, int chunkZ) const {
+  int cells = gridSize - 1;
+  int z0 = chunkZ * kChunkCells;
+  int height = std::min(kChunkCells, cells - z0);
+  return (static_cast<size_t>(z0) * cells +
+          static_cast<size_t>(height) * chunkX * kChunkCells) *
+         6;
+}
+
+// Generate indices for triangles, grouped by chunk
+void Terrain::generateIndices(JobSystem &jobs, unsigned int *indexOut) const {
+  int cells = gridSize - 1;
+  int chunksX = (cells + kChunkCells - 1) / kChunkCells;
+  jobs.parallelFor(0, cells, kIndexRowGrain, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      int chunkZ = z / kChunkCells;
+      int chunkRow = z - chunkZ * kChunkCells;
+      for (int chunkX = 0; chunkX < chunksX; ++chunkX) {
+        int x0 = chunkX * kChunkCells;
+        int width = std::min(kChunkCells, cells - x0);
+        unsigned int *index =
+            &indexOut[chunkFirstIndex(chunkX, chunkZ) +
+                      static_cast<size_t>(chunkRow) * width * 6];
+        for (int x = x0; x < x0 + width; ++x) {
+          unsigned int topLeft = z * gridSize + x;
+          unsigned int topRight = topLeft + 1;
+          unsigned int bottomLeft = (z + 1) * gridSize + x;
+          unsigned int bottomRight = bottomLeft + 1;
+
+          index[0] = topLeft;
+          index[1] = bottomLeft;
+          index[2] = topRight;
+
+          index[3] = topRight;
+          index[4] = bottomLeft;
+          index[5] = bottomRight;
+          index += 6;
+        }
+      }
+    }
+  });
+}
+
+// Vertex rows or columns a level of detail keeps in cells [first, end): every
+// step-th one plus the far edge
+static void lodSamples(int first, int end, int step, std::vector<int> &out) {
+  out.clear();
+  for (int i = first; i < end; i += step) {
+    out.push_back(i);
+  }
+  out.push_back(end);
+}
+
+// Append a triangle of grid vertices, wound like the level 0 quads
+static void addGridTriangle(glm::ivec2 a, glm::ivec2 b, glm::ivec2 c,
+                            int gridSize, std::vector<unsigned int> &out) {
+  int cross = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  if (cross > 0)
+    std::swap(b, c);
+  out.push_back(a.y * gridSize + a.x);
+  out.push_back(b.y * gridSize + b.x);
+  out.push_back(c.y * gridSize + c.x);
+}
 
-  // Generate vertices
-  for (int z = 0; z < gridSize; ++z) {
-    for (int x = 0; x < gridSize; ++x) {
-      float xPos = x * step - size / 2.0f;
-      float zPos = z * step - size / 2.0f;
-      float yPos = getHeight(x, z);
-      vertices.push_back(xPos);
-      vertices.push_back(yPos);
-      vertices.push_back(zPos);
+// Triangulate the strip between a chunk edge (outer) and the vertex line
+// one level step inside it (inner), both ordered along axis, by zipping
+// them in order of position. The outer line may hold more vertices than
+// the inner one; the two ends join the corners of the inner line.
+static void addEdgeStrip(const std::vector<glm::ivec2> &outer,
+                         const std::vector<glm::ivec2> &inner, int axis,
+                         int gridSize, std::vector<unsigned int> &out) {
+  size_t i = 0;
+  size_t j = 0;
+  while (i + 1 < outer.size() || j + 1 < inner.size()) {
+    if (j + 1 == inner.size() ||
+        (i + 1 < outer.size() && outer[i + 1][axis] <= inner[j + 1][axis])) {
+      addGridTriangle(outer[i], outer[i + 1], inner[j], gridSize, out);
+      ++i;
+    } else {
+      addGridTriangle(outer[i], inner[j + 1], inner[j], gridSize, out);
+      ++j;
     }
   }
+}
 
-  // Generate indices for triangles
-  for (int z = 0; z < gridSize - 1; ++z) {
-    for (int x = 0; x < gridSize - 1; ++x) {
-      unsigned int topLeft = z * gridSize + x;
-      unsigned int topRight = topLeft + 1;
-      unsigned int bottomLeft = (z + 1) * gridSize + x;
-      unsigned int bottomRight = bottomLeft + 1;
+// Draw ranges and world bounds of the chunks, from the height pyramid, and
+// the coarser levels of detail of every chunk
+void Terrain::buildChunks() {
+  int cells = gridSize - 1;
+  int chunksPerSide = (cells + kChunkCells - 1) / kChunkCells;
+  chunks.clear();
+  chunkBounds.clear();
+  lodIndices.clear();
+  for (int chunkZ = 0; chunkZ < chunksPerSide; ++chunkZ) {
+    for (int chunkX = 0; chunkX < chunksPerSide; ++chunkX) {
+      int x0 = chunkX * kChunkCells;
+      int z0 = chunkZ * kChunkCells;
+      int x1 = std::min(x0 + kChunkCells, cells) - 1; // Last cell
+      int z1 = std::min(z0 + kChunkCells, cells) - 1;
 
-      indices.push_back(topLeft);
-      indices.push_back(bottomLeft);
-      indices.push_back(topRight);
+      Chunk chunk;
+      chunk.firstIndex =
+          static_cast<unsigned int>(chunkFirstIndex(chunkX, chunkZ));
+      chunk.indexCount = (x1 - x0 + 1) * (z1 - z0 + 1) * 6;
+      chunk.minVertex = z0 * gridSize + x0;
+      chunk.maxVertex = (z1 + 1) * gridSize + x1 + 1;
+      chunks.push_back(chunk);
 
-      indices.push_back(topRight);
-      indices.push_back(bottomLeft);
-      indices.push_back(bottomRight);
+      MinMaxPyramid::Range range = heightBounds.query(x0, z0, x1, z1);
+      glm::vec3 lo = gridToWorld(x0, z0);
+      glm::vec3 hi = gridToWorld(x1 + 1, z1 + 1);
+      BoundingBox bounds;
+      bounds.min = glm::vec3(lo.x, range.min, lo.z);
+      bounds.max = glm::vec3(hi.x, range.max, hi.z);
+      chunkBounds.push_back(bounds);
+    }
+  }
+
+  size_t chunkCount = chunkBounds.size();
+  chunkMaxLods.assign(chunkCount, kChunkLods - 1);
+  chunkParts.assign(kChunkLods * chunkCount * kChunkParts, IndexRange());
+  for (size_t i = 0; i < chunkCount; ++i) {
+    IndexRange whole = {chunks[i].firstIndex, chunks[i].indexCount};
+    chunkParts[i * kChunkParts] = whole;
+  }
+  auto cursor = [this] {
+    return static_cast<unsigned int>(indices.size() + lodIndices.size());
+  };
+
+  std::vector<int> xs, zs, edgeSamples;
+  std::vector<glm::ivec2> outer, inner;
+  for (int lod = 1; lod < kChunkLods; ++lod) {
+    for (size_t i = 0; i < chunkCount; ++i) {
+      const Chunk &base = chunks[i];
+      int x0 = base.minVertex % gridSize;
+      int z0 = base.minVertex / gridSize;
+      int x1 = base.maxVertex % gridSize;
+      int z1 = base.maxVertex / gridSize;
+      lodSamples(x0, x1, 1 << lod, xs);
+      lodSamples(z0, z1, 1 << lod, zs);
+      IndexRange *parts = &chunkParts[(lod * chunkCount + i) * kChunkParts];
+
+      // Chunks at the grid's far border can be too narrow for an interior
+      // and edges at this level; they stay at the previous one
+      int m = static_cast<int>(xs.size()) - 1;
+      int n = static_cast<int>(zs.size()) - 1;
+      if (m < 2 || n < 2) {
+        if (chunkMaxLods[i] > lod - 1)
+          chunkMaxLods[i] = lod - 1;
+        chunks.push_back(chunks[(lod - 1) * chunkCount + i]);
+        const IndexRange *previous = parts - chunkCount * kChunkParts;
+        std::copy(previous, previous + kChunkParts, parts);
+        continue;
+      }
+
+      Chunk chunk = base;
+      chunk.firstIndex = cursor();
+      for (int row = 1; row + 1 < n; ++row) {
+        for (int column = 1; column + 1 < m; ++column) {
+          unsigned int topLeft = zs[row] * gridSize + xs[column];
+          unsigned int topRight = zs[row] * gridSize + xs[column + 1];
+          unsigned int bottomLeft = zs[row + 1] * gridSize + xs[column];
+          unsigned int bottomRight = zs[row + 1] * gridSize + xs[column + 1];
+          unsigned int quad[] = {topLeft,  bottomLeft, topRight,
+                                 topRight, bottomLeft, bottomRight};
+          lodIndices.insert(lodIndices.end(), quad, quad + 6);
+        }
+      }
+      parts[0].firstIndex = chunk.firstIndex;
+      parts[0].indexCount = cursor() - chunk.firstIndex;
+
+      // Every edge as it is first, so the interior and those four make up
+      // the whole chunk, then refined to each finer level
+      for (int target = lod; target >= 0; --target) {
+        for (int edge = 0; edge < 4; ++edge) {
+          bool alongX = edge < 2;
+          int side = edge % 2; // 0 at the low end of the chunk, 1 at the high
+          const std::vector<int> &along = alongX ? xs : zs;
+          const std::vector<int> &across = alongX ? zs : xs;
+          int edgeLine = side == 0 ? across.front() : across.back();
+          int innerLine = side == 0 ? across[1] : across[across.size() - 2];
+          lodSamples(along.front(), along.back(), 1 << target, edgeSamples);
+          outer.clear();
+          for (int t : edgeSamples) {
+            outer.push_back(alongX ? glm::ivec2(t, edgeLine)
+                                   : glm::ivec2(edgeLine, t));
+          }
+          inner.clear();
+          for (size_t k = 1; k + 1 < along.size(); ++k) {
+            inner.push_back(alongX ? glm::ivec2(along[k], innerLine)
+                                   : glm::ivec2(innerLine, along[k]));
+          }
+          IndexRange &part = parts[1 + edge * kChunkLods + target];
+          part.firstIndex = cursor();
+          addEdgeStrip(outer, inner, alongX ? 0 : 1, gridSize, lodIndices);
+          part.indexCount = cursor() - part.firstIndex;
+        }
+        if (target == lod) {
+          chunk.indexCount = cursor() - chunk.firstIndex;
+          chunks.push_back(chunk);
+        }
+      }
     }
   }
-  calculateNormals();
-  setupBuffers();
 }
 
-// Set up OpenGL buffers for vertices, indices, and normals
-void Terrain::setupBuffers() {
-  // Set up vertex buffer
-  glGenBuffers(1, &vertexBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
-               vertices.data(), GL_STATIC_DRAW);
+// Bounds pyramid, derived rasters, horizon map, normal map and chunk bounds
+// for queries and shading over the generated grid. The normal map has the
+// heightmap's resolution and only falls back to the grid's when the
+// heightmap is missing. A mesh cache hit restores all of these instead.
+void Terrain::buildQueryStructures() {
+  heightBounds.build(heights.data(), gridSize, gridSize);
+  rasters.build(getHeightGrid());
+  horizonMap.build(getHeightGrid());
+  if (!heightmapPyramid.empty()) {
+    normalMap.build(heightmapPyramid.getLevel(0), worldSize, kHeightScale,
+                    normalFormat);
+  } else if (normalMap.empty()) {
+    normalMap.build(getHeightGrid(), normalFormat);
+  }
+  buildChunks();
+}
+
+// Cache section of a generated array
+template <typename T>
+static MeshCacheArray cacheArray(const std::vector<T> &array) {
+  MeshCacheArray section = {array.data(), array.size() * sizeof(T)};
+  return section;
+}
+
+// Map the cache file and take everything generate() would produce from it.
+// The mesh arrays are uploaded and read in place; only the query structures
+// are copied out, each with a single copy.
+bool Terrain::loadCachedMesh(const std::string &heightmapPath,
+                             const std::string &cacheDirectory) {
+  uint64_t key;
+  if (!meshCacheKey(heightmapPath, key) ||
+      !meshCache.open(meshCachePath(cacheDirectory, key), key, gridSize))
+    return false;
+
+  // Every section must have the size this grid and format produce
+  typedef MeshCacheSection Section;
+  const MeshCacheInfo &info = meshCache.getInfo();
+  size_t vertexCount = static_cast<size_t>(gridSize) * gridSize;
+  size_t cells = static_cast<size_t>(gridSize - 1);
+  size_t chunksPerSide = (cells + kChunkCells - 1) / kChunkCells;
+  size_t chunkCount = chunksPerSide * chunksPerSide;
+  size_t directions = info.horizonDirections;
+  size_t lods = kChunkLods;
+  const size_t expected[] = {
+      vertexCount * 3 * sizeof(float),
+      vertexCount * 3 * sizeof(float),
+      cells * cells * 6 * sizeof(unsigned int),
+      vertexCount * sizeof(float),
+      static_cast<size_t>(info.normalMapWidth) * info.normalMapHeight *
+          info.normalMapTexelBytes,
+      0, // Checked by MinMaxPyramid::load()
+      vertexCount * sizeof(uint8_t),
+      vertexCount * sizeof(uint16_t),
+      vertexCount * sizeof(int16_t),
+      vertexCount * directions,
+      vertexCount,
+      vertexCount * 4 * (directions / 2),
+      lods * chunkCount * sizeof(Chunk),
+      lods * chunkCount * kChunkParts * sizeof(IndexRange),
+      chunkCount * sizeof(int),
+      chunkCount * sizeof(BoundingBox),
+      0, // Any number of coarser level indices
+  };
+  static_assert(sizeof(expected) / sizeof(expected[0]) ==
+                    static_cast<size_t>(Section::Count),
+                "one expected size per cache section");
+  bool valid = info.normalMapWidth > 0 && info.normalMapWidth <= 65536 &&
+               info.normalMapHeight > 0 && info.normalMapHeight <= 65536 &&
+               info.normalMapTexelBytes ==
+                   NormalMap::bytesPerTexel(normalFormat) &&
+               directions >= 2 && directions <= 256 && directions % 2 == 0;
+  for (int i = 0; valid && i < static_cast<int>(Section::Count); ++i) {
+    size_t bytes = meshCache.getSection(static_cast<Section>(i)).bytes;
+    valid = expected[i] != 0 ? bytes == expected[i] : bytes % 4 == 0;
+  }
+  MeshCacheArray bounds = meshCache.getSection(Section::HeightBounds);
+  valid = valid && bounds.bytes % sizeof(MinMaxPyramid::Range) == 0 &&
+          heightBounds.load(
+              static_cast<const MinMaxPyramid::Range *>(bounds.data),
+              bounds.bytes / sizeof(MinMaxPyramid::Range), gridSize,
+              gridSize);
+  if (!valid) {
+    meshCache.close();
+    return false;
+  }
+
+  auto section = [this](Section which) {
+    return meshCache.getSection(which).data;
+  };
+  heights.clear();
+  vertices.clear();
+  indices.clear();
+  lodIndices.clear();
+  normals.clear();
+  mesh.heights = static_cast<const float *>(section(Section::Heights));
+  mesh.vertices = static_cast<const float *>(section(Section::Vertices));
+  mesh.indices =
+      static_cast<const unsigned int *>(section(Section::Indices));
+  mesh.indexCount = cells * cells * 6;
+  mesh.lodIndices =
+      static_cast<const unsigned int *>(section(Section::LodIndices));
+  mesh.lodIndexCount =
+      meshCache.getSection(Section::LodIndices).bytes / sizeof(unsigned int);
+
+  normalMap.assign(static_cast<const uint8_t *>(section(Section::NormalMap)),
+                   info.normalMapWidth, info.normalMapHeight, normalFormat);
+  rasters.assign(gridSize,
+                 static_cast<const uint8_t *>(section(Section::Slope)),
+                 static_cast<const uint16_t *>(section(Section::Aspect)),
+                 static_cast<const int16_t *>(section(Section::Curvature)));
+  horizonMap.assign(
+      gridSize, static_cast<int>(directions),
+      static_cast<const uint8_t *>(section(Section::Horizons)),
+      static_cast<const uint8_t *>(section(Section::Ambient)),
+      static_cast<const uint8_t *>(section(Section::HorizonLayers)));
+  const Chunk *cachedChunks =
+      static_cast<const Chunk *>(section(Section::Chunks));
+  chunks.assign(cachedChunks, cachedChunks + lods * chunkCount);
+  const IndexRange *parts =
+      static_cast<const IndexRange *>(section(Section::ChunkParts));
+  chunkParts.assign(parts, parts + lods * chunkCount * kChunkParts);
+  const int *maxLods = static_cast<const int *>(section(Section::ChunkMaxLods));
+  chunkMaxLods.assign(maxLods, maxLods + chunkCount);
+  const BoundingBox *boxes =
+      static_cast<const BoundingBox *>(section(Section::ChunkBounds));
+  chunkBounds.assign(boxes, boxes + chunkCount);
+
+  setupBuffers(static_cast<const float *>(section(Section::Normals)));
+  uploadRasterTextures();
+  return true;
+}
+
+bool Terrain::saveCachedMesh(const std::string &heightmapPath,
+                             const std::string &cacheDirectory) const {
+  uint64_t key;
+  if (vertices.empty() || normalMap.empty() || horizonMap.empty() ||
+      !meshCacheKey(heightmapPath, key))
+    return false;
+  mkdir(cacheDirectory.c_str(), 0755);
+
+  std::vector<MinMaxPyramid::Range> bounds(heightBounds.getStoredCount());
+  heightBounds.store(bounds.data());
+  // In MeshCacheSection order
+  const MeshCacheArray sections[] = {
+      cacheArray(vertices),
+      cacheArray(normals),
+      cacheArray(indices),
+      cacheArray(heights),
+      cacheArray(normalMap.getTexels()),
+      cacheArray(bounds),
+      cacheArray(rasters.getSlope()),
+      cacheArray(rasters.getAspect()),
+      cacheArray(rasters.getCurvature()),
+      cacheArray(horizonMap.getHorizons()),
+      cacheArray(horizonMap.getAmbient()),
+      cacheArray(horizonMap.getLayers()),
+      cacheArray(chunks),
+      cacheArray(chunkParts),
+      cacheArray(chunkMaxLods),
+      cacheArray(chunkBounds),
+      cacheArray(lodIndices),
+  };
+  static_assert(sizeof(sections) / sizeof(sections[0]) ==
+                    static_cast<size_t>(MeshCacheSection::Count),
+                "one array per cache section");
+  MeshCacheInfo info = {
+      static_cast<uint32_t>(normalMap.getWidth()),
+      static_cast<uint32_t>(normalMap.getHeight()),
+      static_cast<uint32_t>(NormalMap::bytesPerTexel(normalMap.getFormat())),
+      static_cast<uint32_t>(horizonMap.getDirectionCount())};
+  return writeMeshCache(meshCachePath(cacheDirectory, key), key, gridSize,
+                        info, sections);
+}
+
+// Hash of the heightmap file and every parameter that changes the mesh
+bool Terrain::meshCacheKey(const std::string &heightmapPath,
+                           uint64_t &key) const {
+  if (!hashFile(heightmapPath, kHashSeed, key))
+    return false;
+  int filter = static_cast<int>(heightFilter);
+  int format = static_cast<int>(normalFormat);
+  key = hashBytes(key, &kMeshCacheVersion, sizeof(kMeshCacheVersion));
+  key = hashBytes(key, &gridSize, sizeof(gridSize));
+  key = hashBytes(key, &worldSize, sizeof(worldSize));
+  key = hashBytes(key, &filter, sizeof(filter));
+  key = hashBytes(key, &format, sizeof(format));
+  return true;
+}
+
+std::string Terrain::meshCachePath(const std::string &cacheDirectory,
+                                   uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/%016llx.mesh",
+                static_cast<unsigned long long>(key));
+  return cacheDirectory + name;
+}
+
+// Convert world x/z to continuous grid coordinates
+glm::vec2 Terrain::worldToGrid(float x, float z) const {
+  float scale = static_cast<float>(gridSize - 1) / worldSize;
+  return glm::vec2((x + worldSize / 2.0f) * scale,
+                   (z + worldSize / 2.0f) * scale);
+}
+
+// World position of grid vertex (x, z)
+glm::vec3 Terrain::gridToWorld(int x, int z) const {
+  float step = worldSize / static_cast<float>(gridSize - 1);
+  float y = mesh.heights ? mesh.heights[static_cast<size_t>(z) * gridSize + x]
+                        : 0.0f;
+  return glm::vec3(x * step - worldSize / 2.0f, y,
+                   z * step - worldSize / 2.0f);
+}
+
+// Height bounds of grid cells [x0, x1] x [z0, z1]
+MinMaxPyramid::Range Terrain::getCellHeightRange(int x0, int z0, int x1,
+                                                 int z1) const {
+  return heightBounds.query(x0, z0, x1, z1);
+}
+
+// Height bounds of the terrain inside a world-space rectangle. Returns false
+// if the rectangle does not overlap the terrain.
+bool Terrain::getHeightRange(float minX, float minZ, float maxX, float maxZ,
+                             float &minHeight, float &maxHeight) const {
+  glm::vec2 lo = worldToGrid(minX, minZ);
+  glm::vec2 hi = worldToGrid(maxX, maxZ);
+  MinMaxPyramid::Range range = heightBounds.query(
+      static_cast<int>(std::floor(lo.x)), static_cast<int>(std::floor(lo.y)),
+      static_cast<int>(std::floor(hi.x)), static_cast<int>(std::floor(hi.y)));
+  if (range.empty())
+    return false;
+  minHeight = range.min;
+  maxHeight = range.max;
+  return true;
+}
+
+// Describe the generated height grid for the query modules
+HeightGrid Terrain::getHeightGrid() const {
+  HeightGrid grid;
+  grid.heights = mesh.heights;
+  grid.gridSize = gridSize;
+  grid.step = worldSize / static_cast<float>(gridSize - 1);
+  grid.offset = -worldSize / 2.0f;
+  return grid;
+}
+
+float Terrain::sampleHeight(float x, float z) const {
+  return sampleHeightGrid(getHeightGrid(), x, z);
+}
 
-  // Set up index buffer
-  glGenBuffers(1, &indexBuffer);
+void Terrain::sampleHeights(const float *xs, const float *zs, float *out,
+                            int count) const {
+  sampleHeightGridBatch(getHeightGrid(), xs, zs, out, count);
+}
+
+// Cast a single ray against the terrain
+RaycastHit Terrain::raycast(const glm::vec3 &origin,
+                            const glm::vec3 &direction,
+                            float maxDistance) const {
+  return raycastHeightGrid(getHeightGrid(), heightBounds, origin, direction,
+                           maxDistance);
+}
+
+// Cast many rays, split across worker threads
+void Terrain::raycastBatch(const glm::vec3 *origins,
+                           const glm::vec3 *directions, RaycastHit *hits,
+                           int count, float maxDistance) const {
+  HeightGrid grid = getHeightGrid();
+  parallelFor(0, count, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      hits[i] = raycastHeightGrid(grid, heightBounds, origins[i],
+                                  directions[i], maxDistance);
+    }
+  });
+}
+
+// Allocate storage for a buffer and fill it through a write-only mapping that
+// invalidates the previous contents, so the driver never waits on the GPU
+static void uploadBuffer(GLenum target, GLuint buffer, const void *data,
+                         size_t bytes, GLenum usage) {
+  glBindBuffer(target, buffer);
+  glBufferData(target, bytes, nullptr, usage);
+  void *mapped = glMapBufferRange(
+      target, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped) {
+    std::memcpy(mapped, data, bytes);
+    glUnmapBuffer(target);
+  } else {
+    glBufferSubData(target, 0, bytes, data);
+  }
+}
+
+// Set up OpenGL buffers for vertices, indices and normals. Buffer names
+// are created once and their storage is respecified on regeneration. The
+// sources are either the generated arrays or a mapped mesh cache file.
+void Terrain::setupBuffers(const float *normalData) {
+  if (vertexBuffer == 0) {
+    glGenBuffers(1, &vertexBuffer);
+    glGenBuffers(1, &indexBuffer);
+    glGenBuffers(1, &chunkIdBuffer);
+  }
+
+  size_t vertexBytes = static_cast<size_t>(gridSize) * gridSize * 3 *
+                       sizeof(float);
+  uploadBuffer(GL_ARRAY_BUFFER, vertexBuffer, mesh.vertices, vertexBytes,
+               GL_STATIC_DRAW);
+  // Level 0 of every chunk, then the coarser levels
+  size_t indexBytes = mesh.indexCount * sizeof(unsigned int);
+  size_t lodBytes = mesh.lodIndexCount * sizeof(unsigned int);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-               indices.data(), GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes + lodBytes, nullptr,
+               GL_STATIC_DRAW);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexBytes, mesh.indices);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, lodBytes,
+                  mesh.lodIndices);
+  setupNormalRing(normalData);
 
-  // Set up normal buffer
-  glGenBuffers(1, &normalBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), nullptr,
-               GL_DYNAMIC_DRAW);
+  std::vector<unsigned int> chunkIds(chunkBounds.size());
+  for (size_t i = 0; i < chunkIds.size(); ++i) {
+    chunkIds[i] = static_cast<unsigned int>(i);
+  }
+  uploadBuffer(GL_ARRAY_BUFFER, chunkIdBuffer, chunkIds.data(),
+               chunkIds.size() * sizeof(unsigned int), GL_STATIC_DRAW);
+  uploadChunkCommands();
 }
 
-// Calculate normal vectors for the terrain (CPU version)
-void Terrain::calculateNormals() {
-  normals.clear();
-  normals.resize(vertices.size(), 0.0f);
+void Terrain::setChunkCulling(ChunkCulling *culling) {
+  this->culling = culling;
+  uploadChunkCommands();
+}
 
-  // Calculate normals for each triangle
-  for (size_t i = 0; i < indices.size(); i += 3) {
-    unsigned int i0 = indices[i] * 3;
-    unsigned int i1 = indices[i + 1] * 3;
-    unsigned int i2 = indices[i + 2] * 3;
+// Draw commands of every part of every chunk at every level of detail, their
+// base instance selecting the chunk index, for the GPU culling. Level 1
+// starts two chunk widths away.
+void Terrain::uploadChunkCommands() {
+  if (!culling)
+    return;
+  int chunkCount = getChunkCount();
+  std::vector<ChunkCulling::DrawCommand> commands;
+  for (int lod = 0; lod < kChunkLods && lod < ChunkCulling::kMaxLods;
+       ++lod) {
+    for (int i = 0; i < chunkCount; ++i) {
+      const IndexRange *parts =
+          &chunkParts[(static_cast<size_t>(lod) * chunkCount + i) *
+                      kChunkParts];
+      GLuint chunk = static_cast<GLuint>(i);
+      ChunkCulling::DrawCommand interior = {
+          parts[0].indexCount, 1, parts[0].firstIndex, 0, chunk};
+      commands.push_back(interior);
+      for (int edge = 0; edge < 4; ++edge) {
+        for (int target = 0; target < ChunkCulling::kMaxLods; ++target) {
+          ChunkCulling::DrawCommand command = {0, 1, 0, 0, chunk};
+          if (target < kChunkLods) {
+            const IndexRange &part = parts[1 + edge * kChunkLods + target];
+            command.count = part.indexCount;
+            command.firstIndex = part.firstIndex;
+          }
+          commands.push_back(command);
+        }
+      }
+    }
+  }
+  int columns = (gridSize - 1 + kChunkCells - 1) / kChunkCells;
+  culling->setChunks(chunkBounds, columns, chunkMaxLods, commands);
+  float chunkWidth = kChunkCells * worldSize / (gridSize - 1);
+  culling->setLodDistance(2.0f * chunkWidth);
+}
 
-    glm::vec3 v1(vertices[i0], vertices[i0 + 1], vertices[i0 + 2]);
-    glm::vec3 v2(vertices[i1], vertices[i1 + 1], vertices[i1 + 2]);
-    glm::vec3 v3(vertices[i2], vertices[i2 + 1], vertices[i2 + 2]);
+// (Re)create the normal buffer, seeding every region with normalData. Buffer
+// storage is immutable, so the buffer is replaced rather than respecified.
+// Without ARB_buffer_storage there is a single plain dynamic region.
+void Terrain::setupNormalRing(const float *normalData) {
+  releaseNormalRing();
+  size_t bytes = static_cast<size_t>(gridSize) * gridSize * 3 * sizeof(float);
+  normalRegion = 0;
+  normalRegionStride = bytes;
 
-    glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+  glGenBuffers(1, &normalBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+  if (GLEW_ARB_buffer_storage) {
+    // Regions double as compute shader output ranges, so keep them aligned
+    GLint alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    normalRegionStride = (bytes + alignment - 1) / alignment * alignment;
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, normalRegionStride * kNormalRegions,
+                    nullptr, flags);
+    normalRing = static_cast<char *>(glMapBufferRange(
+        GL_ARRAY_BUFFER, 0, normalRegionStride * kNormalRegions, flags));
+    if (!normalRing) {
+      glDeleteBuffers(1, &normalBuffer);
+      glGenBuffers(1, &normalBuffer);
+      normalRegionStride = bytes;
+    }
+  }
 
-    // Accumulate normals for each vertex
-    for (int j = 0; j < 3; ++j) {
-      normals[i0 + j] += normal[j];
-      normals[i1 + j] += normal[j];
-      normals[i2 + j] += normal[j];
+  if (normalRing) {
+    for (int region = 0; region < kNormalRegions; ++region) {
+      std::memcpy(normalRing + region * normalRegionStride, normalData, bytes);
     }
+  } else {
+    uploadBuffer(GL_ARRAY_BUFFER, normalBuffer, normalData, bytes,
+                 GL_DYNAMIC_DRAW);
   }
+}
 
-  // Normalize the accumulated normals
-  for (size_t i = 0; i < normals.size(); i += 3) {
-    glm::vec3 n(normals[i], normals[i + 1], normals[i + 2]);
-    n = glm::normalize(n);
-    normals[i] = n.x;
-    normals[i + 1] = n.y;
-    normals[i + 2] = n.z;
+void Terrain::releaseNormalRing() {
+  for (GLsync &fence : normalFences) {
+    if (fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  idleNormalRegions.store((1u << kNormalRegions) - 1);
+  if (normalRing) {
+    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    normalRing = nullptr;
   }
+  glDeleteBuffers(1, &normalBuffer);
+  normalBuffer = 0;
+}
+
+// Compute the face normals of quad row qz. Quad (qx, qz) holds triangles
+// (TL, BL, TR) and (TR, BL, BR), stored at out[2 * qx] and out[2 * qx + 1].
+void Terrain::faceNormalsRow(int qz, glm::vec3 *out) const {
+  auto position = [this](int px, int pz) {
+    const float *v =
+        mesh.vertices + (static_cast<size_t>(pz) * gridSize + px) * 3;
+    return glm::vec3(v[0], v[1], v[2]);
+  };
+
+  for (int qx = 0; qx < gridSize - 1; ++qx) {
+    glm::vec3 topLeft = position(qx, qz);
+    glm::vec3 topRight = position(qx + 1, qz);
+    glm::vec3 bottomLeft = position(qx, qz + 1);
+    glm::vec3 bottomRight = position(qx + 1, qz + 1);
+    out[2 * qx] =
+        glm::normalize(glm::cross(bottomLeft - topLeft, topRight - topLeft));
+    out[2 * qx + 1] = glm::normalize(
+        glm::cross(bottomLeft - topRight, bottomRight - topRight));
+  }
+}
+
+// Calculate normal vectors for the terrain into out (3 floats per vertex).
+// Each job's band of rows keeps the face normals of the two quad rows around
+// the current vertex row, so every face normal is computed once per band and
+// vertices only gather from their (up to six) adjacent triangles. Each
+// normal is written exactly once and never read back, which keeps the
+// writes cheap when out points into write-combined mapped memory.
+void Terrain::calculateNormals(JobSystem &jobs, float *out) const {
+  int cells = gridSize - 1;
+
+  jobs.parallelFor(0, gridSize, kNormalRowGrain, [&](int zBegin, int zEnd) {
+    std::vector<glm::vec3> above(2 * cells), below(2 * cells);
+    if (zBegin > 0)
+      faceNormalsRow(zBegin - 1, above.data());
+
+    for (int z = zBegin; z < zEnd; ++z) {
+      if (z < cells)
+        faceNormalsRow(z, below.data());
+
+      for (int x = 0; x < gridSize; ++x) {
+        glm::vec3 n(0.0f);
+        if (z > 0) {
+          // Vertex is the bottom-right of quad x-1 and bottom-left of quad x
+          if (x > 0)
+            n += above[2 * (x - 1) + 1];
+          if (x < cells)
+            n += above[2 * x] + above[2 * x + 1];
+        }
+        if (z < cells) {
+          // Vertex is the top-right of quad x-1 and top-left of quad x
+          if (x > 0)
+            n += below[2 * (x - 1)] + below[2 * (x - 1) + 1];
+          if (x < cells)
+            n += below[2 * x];
+        }
+        n = glm::normalize(n);
+
+        size_t i = (static_cast<size_t>(z) * gridSize + x) * 3;
+        out[i] = n.x;
+        out[i + 1] = n.y;
+        out[i + 2] = n.z;
+      }
+      std::swap(above, below);
+    }
+  });
 }
 
-// Get height value from heightmap data
+// Get height value at a grid vertex by resampling the heightmap pyramid
 float Terrain::getHeight(int x, int z) const {
   if (x < 0 || x >= gridSize || z < 0 || z >= gridSize) {
     return 0.0f;
   }
 
-  // Map grid coordinates to heightmap coordinates
-  int heightmapX =
-      static_cast<int>((static_cast<float>(x) / gridSize) * heightmapWidth);
-  int heightmapZ =
-      static_cast<int>((static_cast<float>(z) / gridSize) * heightmapHeight);
+  // Map grid coordinates to normalized heightmap coordinates
+  float u = static_cast<float>(x) / static_cast<float>(gridSize - 1);
+  float v = static_cast<float>(z) / static_cast<float>(gridSize - 1);
+
+  return heightmapPyramid.sample(heightmapLevel, u, v, heightFilter) *
+         kHeightScale;
+}
+
+// Scale and bias mapping world x/z to the texel centers of a gridSize x
+// gridSize texture
+glm::vec2 Terrain::gridTexCoordScaleBias() const {
+  float step = worldSize / static_cast<float>(gridSize - 1);
+  return glm::vec2(1.0f / (step * gridSize),
+                   (worldSize / 2.0f / step + 0.5f) / gridSize);
+}
 
-  int index = heightmapZ * heightmapWidth + heightmapX;
-  return static_cast<float>(heightmapData[index]) / 255.0f *
-         10.0f; // Scale height
+// Enable modulating texturing on the active unit with world x/z mapped to the
+// centers of a gridSize x gridSize texture
+void Terrain::enableGridTexGen() const {
+  glm::vec2 scaleBias = gridTexCoordScaleBias();
+  float scale = scaleBias.x;
+  float bias = scaleBias.y;
+  GLfloat planeS[] = {scale, 0.0f, 0.0f, bias};
+  GLfloat planeT[] = {0.0f, 0.0f, scale, bias};
+  glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+  glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+  glTexGenfv(GL_S, GL_OBJECT_PLANE, planeS);
+  glTexGenfv(GL_T, GL_OBJECT_PLANE, planeT);
+  glEnable(GL_TEXTURE_GEN_S);
+  glEnable(GL_TEXTURE_GEN_T);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glEnable(GL_TEXTURE_2D);
 }
 
-// Calculate color based on terrain height
-glm::vec3 Terrain::calculateColor(float height) const {
-  // Simple color gradient based on height
-  if (height < 1.0f)
-    return glm::vec3(0.2f, 0.2f, 0.8f); // Water
-  if (height < 3.0f)
-    return glm::vec3(0.8f, 0.7f, 0.4f); // Sand
-  if (height < 6.0f)
-    return glm::vec3(0.4f, 0.8f, 0.4f); // Grass
-  if (height < 8.0f)
-    return glm::vec3(0.5f, 0.5f, 0.5f); // Rock
-  return glm::vec3(1.0f, 1.0f, 1.0f);   // Snow
+bool Terrain::usesDeferredShading() const {
+  return lighting && shaders && shaders->getProgram(litProgram) != 0 &&
+         shaders->getProgram(gbufferProgram) != 0 &&
+         shadingPath == ShadingPath::Deferred && deferred &&
+         deferred->isAvailable();
 }
 
-// Render the terrain
+// Render the terrain, with the clustered lighting program when lighting is
+// set and the program is available, else with fixed-function lighting. On
+// the deferred path the same draws fill the G-buffer, which is then lit.
 void Terrain::render() const {
+  GLuint program =
+      lighting && shaders ? shaders->getProgram(litProgram) : 0;
+  GLuint gbuffer =
+      usesDeferredShading() ? shaders->getProgram(gbufferProgram) : 0;
+  if (gbuffer != 0) {
+    program = gbuffer;
+    deferred->begin();
+  }
   glEnable(GL_LIGHTING);
 
   glEnableClientState(GL_VERTEX_ARRAY);
   glEnableClientState(GL_NORMAL_ARRAY);
-  glEnableClientState(GL_COLOR_ARRAY);
 
   // Bind vertex buffer
   glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
   glVertexPointer(3, GL_FLOAT, 0, nullptr);
 
-  // Bind normal buffer
+  // Bind normal buffer at the current ring region
   glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-  glNormalPointer(GL_FLOAT, 0, nullptr);
+  glNormalPointer(GL_FLOAT, 0,
+                  reinterpret_cast<const void *>(normalRegion *
+                                                 normalRegionStride));
 
-  // Generate and bind color buffer
-  std::vector<glm::vec3> colors(vertices.size() / 3);
-  for (size_t i = 0; i < vertices.size(); i += 3) {
-    colors[i / 3] = calculateColor(vertices[i + 1]);
-  }
-  GLuint colorBuffer;
-  glGenBuffers(1, &colorBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-  glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3),
-               colors.data(), GL_STATIC_DRAW);
-  glColorPointer(3, GL_FLOAT, 0, nullptr);
+  // Colors come from the palette; the material itself is white
+  glColor3f(1.0f, 1.0f, 1.0f);
 
-  // Bind index buffer and draw
+  // Cull the chunks and pick their levels of detail on the GPU
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
+  bool gpuCulling = culling && !useCPUOnly && culling->isAvailable();
+  if (gpuCulling)
+    culling->cull();
+
+  // Tint by the viewshed on unit 0 and the raster overlay on unit 1
+  GLuint overlayTexture = rasterOverlay == RasterOverlay::Slope ? slopeTexture
+                          : rasterOverlay == RasterOverlay::Aspect
+                              ? aspectTexture
+                              : 0;
+  if (program != 0) {
+    glUseProgram(program);
+    lighting->bind(program);
+    glBindBuffer(GL_ARRAY_BUFFER, chunkIdBuffer);
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, 0, nullptr);
+    glVertexAttribDivisor(7, 1);
+    glEnableVertexAttribArray(7);
+    glm::vec2 scaleBias = gridTexCoordScaleBias();
+    glUniform2f(glGetUniformLocation(program, "gridScaleBias"), scaleBias.x,
+                scaleBias.y);
+    glUniform1i(glGetUniformLocation(program, "useViewshed"), showViewshed);
+    glUniform1i(glGetUniformLocation(program, "useOverlay"),
+                overlayTexture != 0);
+    glUniform1i(glGetUniformLocation(program, "viewshedMap"), 0);
+    glUniform1i(glGetUniformLocation(program, "overlayMap"), 1);
+    glUniform1i(glGetUniformLocation(program, "shadowMap"), 2);
+    glUniform1i(glGetUniformLocation(program, "horizonMap"), 3);
+    bool useShadowMaps =
+        shadows != nullptr && sunShadows == SunShadows::ShadowMaps;
+    glUniform1i(glGetUniformLocation(program, "useShadows"), useShadowMaps);
+    if (useShadowMaps)
+      shadows->bind(program);
+
+    // The horizon texel of the sun's azimuth and its elevation
+    int horizonLayer = 0;
+    glm::vec3 horizonWeights(0.0f);
+    if (horizonTexture != 0)
+      horizonMap.sunLookup(sunDirection, horizonLayer, horizonWeights);
+    glUniform1i(glGetUniformLocation(program, "useHorizon"),
+                horizonTexture != 0);
+    glUniform1i(glGetUniformLocation(program, "useHorizonShadows"),
+                horizonTexture != 0 && sunShadows == SunShadows::HorizonMap);
+    glUniform1f(glGetUniformLocation(program, "horizonLayer"),
+                static_cast<float>(horizonLayer));
+    glUniform3f(glGetUniformLocation(program, "horizonWeights"),
+                horizonWeights.x, horizonWeights.y, horizonWeights.z);
+    glUniform1f(glGetUniformLocation(program, "sunSine"), sunDirection.y);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, horizonTexture);
+
+    // Normal map texel centers span the world like the heightmap's
+    glm::vec2 normalScale(0.0f);
+    if (!normalMap.empty()) {
+      normalScale.x = (normalMap.getWidth() - 1.0f) /
+                      (normalMap.getWidth() * worldSize);
+      normalScale.y = (normalMap.getHeight() - 1.0f) /
+                      (normalMap.getHeight() * worldSize);
+    }
+    glUniform1i(glGetUniformLocation(program, "normalMap"), 4);
+    glUniform1i(glGetUniformLocation(program, "useNormalMap"),
+                normalMapTexture != 0);
+    glUniform2f(glGetUniformLocation(program, "normalScale"), normalScale.x,
+                normalScale.y);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, normalMapTexture);
+
+    // Height palette with the snow and rock blends
+    glm::vec3 snowColor = palette.getSnowColor();
+    glm::vec2 snowHeights = palette.getSnowHeights();
+    glm::vec3 rockColor = palette.getRockColor();
+    glm::vec2 rockSlopes = glm::radians(palette.getRockSlopes());
+    glUniform1i(glGetUniformLocation(program, "paletteMap"), 5);
+    glUniform1f(glGetUniformLocation(program, "paletteHeightScale"),
+                1.0f / kHeightScale);
+    glUniform3f(glGetUniformLocation(program, "snowColor"), snowColor.r,
+                snowColor.g, snowColor.b);
+    glUniform2f(glGetUniformLocation(program, "snowHeights"), snowHeights.x,
+                snowHeights.y);
+    glUniform3f(glGetUniformLocation(program, "rockColor"), rockColor.r,
+                rockColor.g, rockColor.b);
+    glUniform2f(glGetUniformLocation(program, "rockSlopes"),
+                std::sin(rockSlopes.x), std::sin(rockSlopes.y));
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_1D, paletteTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, showViewshed ? viewshedTexture : 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, overlayTexture);
+    glActiveTexture(GL_TEXTURE0);
+  } else {
+    // The palette by height alone on unit 2
+    glActiveTexture(GL_TEXTURE2);
+    GLfloat planeS[] = {0.0f, 1.0f / kHeightScale, 0.0f, 0.0f};
+    glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+    glTexGenfv(GL_S, GL_OBJECT_PLANE, planeS);
+    glEnable(GL_TEXTURE_GEN_S);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glEnable(GL_TEXTURE_1D);
+    glBindTexture(GL_TEXTURE_1D, paletteTexture);
+    glActiveTexture(GL_TEXTURE0);
+    if (showViewshed) {
+      enableGridTexGen();
+      glBindTexture(GL_TEXTURE_2D, viewshedTexture);
+    }
+    if (overlayTexture != 0) {
+      glActiveTexture(GL_TEXTURE1);
+      enableGridTexGen();
+      glBindTexture(GL_TEXTURE_2D, overlayTexture);
+      glActiveTexture(GL_TEXTURE0);
+    }
+  }
+
+  // Draw the surviving chunks with one call, else chunk by chunk with each
+  // chunk's index as its base instance when lit by the program
+  if (gpuCulling) {
+    culling->draw();
+  } else if (program != 0) {
+    for (int i = 0; i < getChunkCount(); ++i) {
+      const Chunk &chunk = getChunk(i);
+      glDrawElementsInstancedBaseInstance(
+          GL_TRIANGLES, chunk.indexCount, GL_UNSIGNED_INT,
+          reinterpret_cast<void *>(chunk.firstIndex * sizeof(unsigned int)),
+          1, static_cast<GLuint>(i));
+    }
+  } else {
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount),
+                   GL_UNSIGNED_INT, nullptr);
+  }
+
+  // Mark the last draw reading this normal region
+  if (normalRing) {
+    GLsync &fence = normalFences[normalRegion];
+    if (fence)
+      glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    idleNormalRegions.fetch_and(~(1u << normalRegion),
+                                std::memory_order_relaxed);
+  }
+
+  if (program != 0) {
+    glDisableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 0);
+    glUseProgram(0);
+    if (gbuffer != 0)
+      deferred->resolve(*lighting);
+  } else {
+    glActiveTexture(GL_TEXTURE2);
+    glDisable(GL_TEXTURE_1D);
+    glDisable(GL_TEXTURE_GEN_S);
+    glActiveTexture(GL_TEXTURE0);
+    if (overlayTexture != 0) {
+      glActiveTexture(GL_TEXTURE1);
+      glDisable(GL_TEXTURE_2D);
+      glDisable(GL_TEXTURE_GEN_S);
+      glDisable(GL_TEXTURE_GEN_T);
+      glActiveTexture(GL_TEXTURE0);
+    }
+    if (showViewshed) {
+      glDisable(GL_TEXTURE_2D);
+      glDisable(GL_TEXTURE_GEN_S);
+      glDisable(GL_TEXTURE_GEN_T);
+    }
+  }
 
   // Clean up
   glDisableClientState(GL_VERTEX_ARRAY);
   glDisableClientState(GL_NORMAL_ARRAY);
-  glDisableClientState(GL_COLOR_ARRAY);
-
-  glDeleteBuffers(1, &colorBuffer);
 
   glDisable(GL_LIGHTING);
 
@@ -230,98 +1238,179 @@ void Terrain::render() const {
   if (showNormals) {
     renderNormals();
   }
+
+  if (!pathPoints.empty()) {
+    renderPath();
+  }
 }
 
-// Initialize compute shader for GPU-based normal calculation
-void Terrain::initComputeShader() {
-  // Create and compile compute shader
-  GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
-  std::string computeShaderSource = loadShaderSource("compute_shader.glsl");
-  const char *source = computeShaderSource.c_str();
-  glShaderSource(computeShader, 1, &source, nullptr);
-  glCompileShader(computeShader);
+// Draw the chunks inside the orthographic volume of casterMatrix (world to
+// clip space) at level of detail lod, depth only
+void Terrain::renderShadowCasters(const glm::mat4 &casterMatrix,
+                                  int lod) const {
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadMatrixf(glm::value_ptr(casterMatrix));
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
 
-  // Create and link compute program
-  computeProgram = glCreateProgram();
-  glAttachShader(computeProgram, computeShader);
-  glLinkProgram(computeProgram);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glVertexPointer(3, GL_FLOAT, 0, nullptr);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+  for (int i = 0; i < getChunkCount(); ++i) {
+    // The volume is orthographic, so clip space is a box
+    const BoundingBox &box = chunkBounds[i];
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; ++corner) {
+      glm::vec3 point((corner & 1) ? box.max.x : box.min.x,
+                      (corner & 2) ? box.max.y : box.min.y,
+                      (corner & 4) ? box.max.z : box.min.z);
+      glm::vec3 clip(casterMatrix * glm::vec4(point, 1.0f));
+      lo = glm::min(lo, clip);
+      hi = glm::max(hi, clip);
+    }
+    if (lo.x > 1.0f || lo.y > 1.0f || lo.z > 1.0f || hi.x < -1.0f ||
+        hi.y < -1.0f || hi.z < -1.0f)
+      continue;
 
-  glDeleteShader(computeShader);
+    const Chunk &chunk = getChunk(i, lod);
+    glDrawRangeElements(
+        GL_TRIANGLES, chunk.minVertex, chunk.maxVertex, chunk.indexCount,
+        GL_UNSIGNED_INT,
+        reinterpret_cast<void *>(chunk.firstIndex * sizeof(unsigned int)));
+  }
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+}
+
+// Load the GPU programs: the compute shader for normal calculation and the
+// clustered forward lighting program for drawing
+void Terrain::initShaders(ShaderManager &shaders) {
+  this->shaders = &shaders;
+  normalsProgram = shaders.loadProgram(
+      "terrain_normals", {{GL_COMPUTE_SHADER, "compute_shader.glsl"}});
+  litProgram = shaders.loadProgram(
+      "terrain_lit", {{GL_VERTEX_SHADER, "terrain_vertex.glsl"},
+                      {GL_FRAGMENT_SHADER, "terrain_surface.glsl"},
+                      {GL_FRAGMENT_SHADER, "terrain_fragment.glsl"}});
+  gbufferProgram = shaders.loadProgram(
+      "terrain_gbuffer", {{GL_VERTEX_SHADER, "terrain_vertex.glsl"},
+                          {GL_FRAGMENT_SHADER, "terrain_surface.glsl"},
+                          {GL_FRAGMENT_SHADER, "terrain_gbuffer.glsl"}});
 
   // Create height map texture
   glGenTextures(1, &heightMapTexture);
   glBindTexture(GL_TEXTURE_2D, heightMapTexture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, gridSize, gridSize, 0, GL_RED,
-               GL_FLOAT, vertices.data());
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-  // Create normal map texture
-  glGenTextures(1, &normalMapTexture);
-  glBindTexture(GL_TEXTURE_2D, normalMapTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, gridSize, gridSize, 0, GL_RGBA,
-               GL_FLOAT, nullptr);
+               GL_FLOAT, mesh.vertices);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 }
 
 // Compute normals using either CPU or GPU method
 void Terrain::computeNormals() {
-  if (useCPUOnly) {
+  GLuint computeProgram = shaders ? shaders->getProgram(normalsProgram) : 0;
+  if (useCPUOnly || computeProgram == 0) {
     calculateNormalsCPU();
   } else {
-    // Use GPU compute shader
+    // Use GPU compute shader, writing into the region the next draw reads.
+    // GPU commands are ordered, so this needs no fence.
     glUseProgram(computeProgram);
 
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertexBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, indexBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, normalBuffer);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, normalBuffer,
+                      normalRegion * normalRegionStride,
+                      static_cast<GLsizeiptr>(gridSize) * gridSize * 3 *
+                          sizeof(float));
 
     glUniform1i(glGetUniformLocation(computeProgram, "gridSize"), gridSize);
 
     glDispatchCompute((gridSize * gridSize + 255) / 256, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    glUseProgram(0);
   }
 }
 
-// Calculate normals on the CPU
+// Calculate normals on the CPU straight into the next region of the mapped
+// ring. With three regions the one being written was last drawn two frames
+// ago, so its fence has normally signaled and nothing waits.
 void Terrain::calculateNormalsCPU() {
-  normals.clear();
-  normals.resize(vertices.size(), 0.0f);
-
-  // Calculate normals for each triangle
-  for (size_t i = 0; i < indices.size(); i += 3) {
-    unsigned int i0 = indices[i] * 3;
-    unsigned int i1 = indices[i + 1] * 3;
-    unsigned int i2 = indices[i + 2] * 3;
-
-    glm::vec3 v1(vertices[i0], vertices[i0 + 1], vertices[i0 + 2]);
-    glm::vec3 v2(vertices[i1], vertices[i1 + 1], vertices[i1 + 2]);
-    glm::vec3 v3(vertices[i2], vertices[i2 + 1], vertices[i2 + 2]);
+  if (!normalRing) {
+    // Not allocated after a mesh cache hit until this path needs it
+    normals.resize(static_cast<size_t>(gridSize) * gridSize * 3);
+    calculateNormals(JobSystem::shared(), normals.data());
+    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, normals.size() * sizeof(float),
+                    normals.data());
+    return;
+  }
 
-    glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+  normalRegion = (normalRegion + 1) % kNormalRegions;
+  GLsync &fence = normalFences[normalRegion];
+  if (fence) {
+    GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+      GLenum result = glClientWaitSync(fence, waitFlags, 1000000);
+      if (result != GL_TIMEOUT_EXPIRED)
+        break;
+      waitFlags = 0;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+    idleNormalRegions.fetch_or(1u << normalRegion);
+  }
+  writeNormalRegion(normalRegion);
+}
 
-    // Accumulate normals for each vertex
-    for (int j = 0; j < 3; ++j) {
-      normals[i0 + j] += normal[j];
-      normals[i1 + j] += normal[j];
-      normals[i2 + j] += normal[j];
+// Release the regions whose last draw has completed, without waiting
+void Terrain::pollNormalFences() {
+  for (int region = 0; region < kNormalRegions; ++region) {
+    GLsync &fence = normalFences[region];
+    if (!fence)
+      continue;
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+      glDeleteSync(fence);
+      fence = nullptr;
+      idleNormalRegions.fetch_or(1u << region, std::memory_order_release);
     }
   }
+}
 
-  // Normalize the accumulated normals
-  for (size_t i = 0; i < normals.size(); i += 3) {
-    glm::vec3 n(normals[i], normals[i + 1], normals[i + 2]);
-    n = glm::normalize(n);
-    normals[i] = n.x;
-    normals[i + 1] = n.y;
-    normals[i + 2] = n.z;
+void Terrain::waitNormalFences() {
+  for (int region = 0; region < kNormalRegions; ++region) {
+    GLsync &fence = normalFences[region];
+    if (!fence)
+      continue;
+    GLenum result = GL_TIMEOUT_EXPIRED;
+    while (result == GL_TIMEOUT_EXPIRED) {
+      result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000); // 1 s
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+    idleNormalRegions.fetch_or(1u << region, std::memory_order_release);
   }
+}
 
-  // Update normal buffer
-  glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, normals.size() * sizeof(float),
-                  normals.data());
+bool Terrain::isNormalRegionIdle(int region) const {
+  return (idleNormalRegions.load(std::memory_order_acquire) &
+          (1u << region)) != 0;
+}
+
+// Calculate CPU normals into a region of the mapped ring. Makes no GL
+// calls, so it can run on a thread without the context.
+void Terrain::writeNormalRegion(int region) const {
+  char *base = normalRing + region * normalRegionStride;
+  calculateNormals(JobSystem::shared(), reinterpret_cast<float *>(base));
 }
 
 // Render normal vectors for visualization
@@ -329,13 +1418,14 @@ void Terrain::renderNormals() const {
   glDisable(GL_LIGHTING);
   glColor3f(1.0f, 1.0f, 0.0f); // Yellow color for normals
   glBegin(GL_LINES);
-  for (size_t i = 0; i < indices.size(); i += 3) {
-    glm::vec3 v1(vertices[indices[i] * 3], vertices[indices[i] * 3 + 1],
-                 vertices[indices[i] * 3 + 2]);
-    glm::vec3 v2(vertices[indices[i + 1] * 3], vertices[indices[i + 1] * 3 + 1],
-                 vertices[indices[i + 1] * 3 + 2]);
-    glm::vec3 v3(vertices[indices[i + 2] * 3], vertices[indices[i + 2] * 3 + 1],
-                 vertices[indices[i + 2] * 3 + 2]);
+  auto vertex = [this](unsigned int index) {
+    const float *v = mesh.vertices + static_cast<size_t>(index) * 3;
+    return glm::vec3(v[0], v[1], v[2]);
+  };
+  for (size_t i = 0; i < mesh.indexCount; i += 3) {
+    glm::vec3 v1 = vertex(mesh.indices[i]);
+    glm::vec3 v2 = vertex(mesh.indices[i + 1]);
+    glm::vec3 v3 = vertex(mesh.indices[i + 2]);
 
     glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
     glm::vec3 center = (v1 + v2 + v3) / 3.0f;
@@ -348,14 +1438,16 @@ void Terrain::renderNormals() const {
   glEnable(GL_LIGHTING);
 }
 
-// Load shader source code from file
-std::string Terrain::loadShaderSource(const std::string &filename) {
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    std::cerr << "Failed to open shader file: " << filename << std::endl;
-    return "";
+// Render the planned path as a polyline over the terrain
+void Terrain::renderPath() const {
+  glDisable(GL_LIGHTING);
+  glLineWidth(3.0f);
+  glColor3f(1.0f, 0.0f, 1.0f); // Magenta for the path
+  glBegin(GL_LINE_STRIP);
+  for (const auto &point : pathPoints) {
+    glVertex3f(point.x, point.y, point.z);
   }
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  return buffer.str();
+  glEnd();
+  glLineWidth(1.0f);
+  glEnable(GL_LIGHTING);
 }
\ No newline at end of file
@@ -4,13 +4,41 @@
 #ifndef TERRAIN_H
 #define TERRAIN_H
 
+#include "chunk_culling.h"
+#include "clustered_lighting.h"
+#include "deferred_shading.h"
+#include "heightmap_pyramid.h"
+#include "horizon_map.h"
+#include "job_system.h"
+#include "mesh_cache.h"
+#include "minmax_pyramid.h"
+#include "normal_map.h"
+#include "raycast.h"
+#include "shader_manager.h"
+#include "shadow_cascades.h"
+#include "terrain_palette.h"
+#include "terrain_rasters.h"
+#include "viewshed.h"
 #include <GL/glew.h>
+#include <atomic>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <limits>
 #include <string>
 #include <vector>
 
+// Derived raster drawn over the terrain as a grayscale tint
+enum class RasterOverlay { None, Slope, Aspect };
+
+// What shadows the sun on the lit program: the real-time cascaded shadow
+// maps or the horizon map precomputed with the mesh
+enum class SunShadows { ShadowMaps, HorizonMap };
+
+// How the lit program path shades: clustered forward lighting while
+// drawing, or a G-buffer lit afterwards by a tiled compute pass
+enum class ShadingPath { Forward, Deferred };
+
 class Terrain {
 public:
   // Constructor and destructor
@@ -20,12 +48,183 @@ public:
   // Public methods
   bool loadHeightmap(const std::string &filename);
   void generate();
+
+  // Generation stages. generate() runs them as a task graph on the shared
+  // job system; they take the scheduler so each can also be timed on its
+  // own at any thread count. generateVertices() resamples the loaded
+  // heightmap (see hasHeightmap()) into positions and heights.
+  bool hasHeightmap() const { return !heightmapData.empty(); }
+  void generateVertices(JobSystem &jobs, float *vertexOut,
+                        float *heightOut) const;
+  void generateIndices(JobSystem &jobs, unsigned int *indexOut) const;
+  void calculateNormals(JobSystem &jobs, float *normalOut) const;
+
+  // Mesh cache in cacheDirectory, keyed by a hash of the heightmap file and
+  // the generation parameters. A successful loadCachedMesh() stands in for
+  // loadHeightmap() + generate(): the mesh is uploaded and read straight
+  // from the mapped file, which stays mapped, and the query structures are
+  // copied from it rather than rebuilt. saveCachedMesh() stores the result
+  // of generate().
+  bool loadCachedMesh(const std::string &heightmapPath,
+                      const std::string &cacheDirectory);
+  bool saveCachedMesh(const std::string &heightmapPath,
+                      const std::string &cacheDirectory) const;
   void render() const;
-  void initComputeShader();
+  void initShaders(ShaderManager &shaders);
+
+  // Froxel light lists used by render(); null draws with fixed-function
+  // lighting, as does a missing lit program
+  void setLighting(const ClusteredLighting *lighting) {
+    this->lighting = lighting;
+  }
+
+  // G-buffer and lighting pass used by render() on the deferred path; the
+  // forward path is used while it is null or unavailable
+  void setDeferredShading(DeferredShading *deferred) {
+    this->deferred = deferred;
+  }
+  void setShadingPath(ShadingPath path) { shadingPath = path; }
+  ShadingPath getShadingPath() const { return shadingPath; }
+  // True when render() takes the deferred path, which needs only the
+  // lights from ClusteredLighting, not its froxel and chunk lists
+  bool usesDeferredShading() const;
+
+  // GPU culling, level of detail selection and drawing of the chunks in
+  // render(), used while it is set and available (never in CPU-only mode);
+  // otherwise every chunk is drawn at full detail, one call each
+  void setChunkCulling(ChunkCulling *culling);
+
+  // Sun shadow maps sampled by the lit program; null leaves the sun
+  // unshadowed
+  void setShadows(const ShadowCascades *shadows) { this->shadows = shadows; }
+
+  // Sun shadowing of the lit program. The horizon map also supplies the
+  // ambient occlusion, whichever technique shadows the sun.
+  void setSunShadows(SunShadows mode) { sunShadows = mode; }
+  SunShadows getSunShadows() const { return sunShadows; }
+  void setSunDirection(const glm::vec3 &direction) {
+    sunDirection = glm::normalize(direction);
+  }
+  const HorizonMap &getHorizonMap() const { return horizonMap; }
+
+  // Normals the lit program shades with, at heightmap resolution; the
+  // format applies from the next generate() or loadCachedMesh()
+  void setNormalFormat(NormalMap::Format format) { normalFormat = format; }
+  const NormalMap &getNormalMap() const { return normalMap; }
+
+  // Height and slope coloring, evaluated per fragment (the fixed-function
+  // path applies the height palette only). Uploaded with the mesh, or
+  // immediately when the mesh is already loaded.
+  void setPalette(const TerrainPalette &palette) {
+    this->palette = palette;
+    if (paletteTexture != 0)
+      uploadPalette();
+  }
+
+  // Depth-only draw of the chunks inside an orthographic caster volume at a
+  // chunk level of detail, for ShadowCascades
+  void renderShadowCasters(const glm::mat4 &casterMatrix, int lod) const;
   void computeNormals();
   void setShowNormals(bool);
+  void setViewshed(const Viewshed &viewshed);
+  void clearViewshed() { showViewshed = false; }
+  void setPath(const std::vector<glm::vec3> &points) { pathPoints = points; }
+  void clearPath() { pathPoints.clear(); }
   int getTriangleCount() const;
   void setUseCPUOnly(bool useCPU) { useCPUOnly = useCPU; }
+  void setHeightFilter(HeightFilter filter) { heightFilter = filter; }
+  const HeightmapPyramid &getHeightmapPyramid() const {
+    return heightmapPyramid;
+  }
+
+  // Grid/world coordinate mapping. The grid spans worldSize units on x and z,
+  // centered on the origin.
+  int getGridSize() const { return gridSize; }
+  float getWorldSize() const { return worldSize; }
+  glm::vec2 worldToGrid(float x, float z) const;
+  glm::vec3 gridToWorld(int x, int z) const;
+
+  // Spatial queries backed by the min/max height pyramid
+  const MinMaxPyramid &getHeightBounds() const { return heightBounds; }
+  MinMaxPyramid::Range getCellHeightRange(int x0, int z0, int x1,
+                                          int z1) const;
+  bool getHeightRange(float minX, float minZ, float maxX, float maxZ,
+                      float &minHeight, float &maxHeight) const;
+
+  // The grid is split into chunks of up to kChunkCells x kChunkCells cells,
+  // each with its own light list and culling test. Indices are
+  // stored chunk by chunk (chunks row-major, cells row-major within one),
+  // so a chunk's indices are contiguous.
+  //
+  // Each chunk also has coarser levels of detail: level l keeps every 2^l-th
+  // vertex row and column (plus the chunk's edges). Level 0 is the mesh
+  // itself; the coarser levels follow it in the index buffer, each stored
+  // as an interior and four edge strips (-z, +z, -x, +x), followed by every
+  // edge refined to each finer level's vertices. Drawing a coarser chunk's
+  // edge at its finer neighbour's level closes the cracks between levels.
+  static const int kChunkCells = 32;
+  static const int kChunkLods = 3;
+  // Parts of a chunk at one level: the interior, then for each edge one
+  // range per level (the chunk's own level being the edge as it is). Level
+  // 0's interior is the whole chunk and its edges are empty.
+  static const int kChunkParts = 1 + 4 * kChunkLods;
+  struct Chunk {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    unsigned int minVertex; // Vertex range for glDrawRangeElements
+    unsigned int maxVertex;
+  };
+  struct IndexRange {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+  };
+  int getChunkCount() const { return static_cast<int>(chunkBounds.size()); }
+  const Chunk &getChunk(int chunk, int lod = 0) const {
+    return chunks[lod * chunkBounds.size() + chunk];
+  }
+  const std::vector<BoundingBox> &getChunkBounds() const {
+    return chunkBounds;
+  }
+
+  // Read-only view of the generated vertex heights for the query modules
+  HeightGrid getHeightGrid() const;
+
+  // Bilinearly interpolated surface height at world (x, z), clamped to the
+  // grid edge. The batched variant is vectorized (AVX2 gathers when
+  // available) and is the one to use for large numbers of agents.
+  float sampleHeight(float x, float z) const;
+  void sampleHeights(const float *xs, const float *zs, float *out,
+                     int count) const;
+
+  // Slope/aspect/curvature rasters built with the mesh, on the CPU and as
+  // single-channel textures (R8 slope, R16 aspect, R16_SNORM curvature)
+  const TerrainRasters &getRasters() const { return rasters; }
+  GLuint getSlopeTexture() const { return slopeTexture; }
+  GLuint getAspectTexture() const { return aspectTexture; }
+  GLuint getCurvatureTexture() const { return curvatureTexture; }
+  void setRasterOverlay(RasterOverlay overlay) { rasterOverlay = overlay; }
+
+  // Normal ring regions for a producer thread (0 without buffer storage).
+  // The render thread polls the fences of drawn regions each frame; once
+  // isNormalRegionIdle() holds, any thread may fill a region with CPU
+  // normals, and the render thread draws it after setNormalRegion().
+  // waitNormalFences() blocks until every drawn region is idle.
+  int getNormalRegionCount() const { return normalRing ? kNormalRegions : 0; }
+  void pollNormalFences();
+  void waitNormalFences();
+  bool isNormalRegionIdle(int region) const;
+  void writeNormalRegion(int region) const;
+  void setNormalRegion(int region) { normalRegion = region; }
+
+  // Ray casting against the terrain triangles. The batched variant splits
+  // the rays across worker threads.
+  RaycastHit
+  raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+          float maxDistance = std::numeric_limits<float>::max()) const;
+  void
+  raycastBatch(const glm::vec3 *origins, const glm::vec3 *directions,
+               RaycastHit *hits, int count,
+               float maxDistance = std::numeric_limits<float>::max()) const;
 
   // Public member variable
   bool showNormals;
@@ -33,31 +232,103 @@ public:
 private:
   // Private member variables
   int gridSize;
+  float worldSize;
+  // Generated arrays; empty after a mesh cache hit
+  std::vector<float> heights;
   std::vector<float> vertices;
   std::vector<unsigned int> indices;
+  // The arrays every other path reads: the generated ones, or sections of
+  // the mapped mesh cache file
+  struct MeshArrays {
+    const float *heights;
+    const float *vertices;
+    const unsigned int *indices;
+    const unsigned int *lodIndices;
+    size_t indexCount;
+    size_t lodIndexCount;
+  };
+  MeshArrays mesh;
+  MeshCacheFile meshCache;
   std::vector<unsigned char> heightmapData;
   int heightmapWidth;
   int heightmapHeight;
+  HeightmapPyramid heightmapPyramid;
+  HeightFilter heightFilter;
+  int heightmapLevel;
+  MinMaxPyramid heightBounds;
+  TerrainRasters rasters;
+  HorizonMap horizonMap;
+  NormalMap normalMap;
+  std::vector<Chunk> chunks;            // Every level, level-major
+  std::vector<IndexRange> chunkParts;   // kChunkParts per chunk and level,
+                                        // level-major
+  std::vector<int> chunkMaxLods; // Coarsest level with interior and edges
+  std::vector<BoundingBox> chunkBounds; // World space, one per chunk
+  std::vector<unsigned int> lodIndices; // Levels 1 and up, when generated
 
-  GLuint computeProgram;
+  const ShaderManager *shaders;
+  int normalsProgram;
+  int litProgram;
+  int gbufferProgram;
+  const ClusteredLighting *lighting;
+  DeferredShading *deferred;
+  ShadingPath shadingPath;
+  ChunkCulling *culling;
+  const ShadowCascades *shadows;
+  SunShadows sunShadows;
+  glm::vec3 sunDirection; // World space, towards the sun
   GLuint heightMapTexture;
   GLuint normalMapTexture;
+  GLuint viewshedTexture;
+  bool showViewshed;
+  GLuint slopeTexture;
+  GLuint aspectTexture;
+  GLuint curvatureTexture;
+  GLuint horizonTexture;
+  NormalMap::Format normalFormat;
+  RasterOverlay rasterOverlay;
+  std::vector<glm::vec3> pathPoints;
 
-  std::vector<float> normals;
+  std::vector<float> normals; // CPU normals without a normal ring
   GLuint vertexBuffer;
   GLuint indexBuffer;
   GLuint normalBuffer;
+  GLuint chunkIdBuffer; // 0..chunks - 1, the lit program's chunk index
+  TerrainPalette palette;
+  GLuint paletteTexture;
+
+  // Normals live in a persistently mapped ring of kNormalRegions copies.
+  // The CPU path writes the next region while the GPU may still draw from
+  // the others; a fence per region marks its last draw.
+  static const int kNormalRegions = 3;
+  char *normalRing; // Mapped base of the ring, null without buffer storage
+  size_t normalRegionStride;
+  int normalRegion; // Region the next draw reads
+  mutable GLsync normalFences[kNormalRegions];
+  mutable std::atomic<unsigned int> idleNormalRegions; // Bit per region
 
   bool useCPUOnly;
 
   // Private methods
   float getHeight(int x, int z) const;
-  glm::vec3 calculateColor(float height) const;
   void renderNormals() const;
-  std::string loadShaderSource(const std::string &filename);
-  void calculateNormals();
+  void renderPath() const;
+  void faceNormalsRow(int qz, glm::vec3 *out) const;
   void calculateNormalsCPU();
-  void setupBuffers();
+  void setupNormalRing(const float *normalData);
+  void releaseNormalRing();
+  void setupBuffers(const float *normalData);
+  void buildQueryStructures();
+  size_t chunkFirstIndex(int chunkX, int chunkZ) const;
+  void buildChunks();
+  void uploadChunkCommands();
+  bool meshCacheKey(const std::string &heightmapPath, uint64_t &key) const;
+  std::string meshCachePath(const std::string &cacheDirectory,
+                            uint64_t key) const;
+  void uploadRasterTextures();
+  void uploadPalette();
+  glm::vec2 gridTexCoordScaleBias() const;
+  void enableGridTexGen() const;
 };
 
 #endif // TERRAIN_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+#version 430 compatibility
+
+// Clustered forward shading: the fixed-function sun (GL_LIGHT0, a
+// directional light shadowed by the cascaded shadow maps or the horizon
+// map) plus the point lights listed for this fragment's froxel or for its
+// terrain chunk, whichever list is shorter. The horizon map also
+// occludes the ambient light.
+
+struct Light {
+    vec4 positionRange;  // View space position, radius
+    vec4 colorIntensity;
+};
+
+layout(std430, binding = 3) readonly buffer LightBuffer {
+    Light lights[];
+};
+
+// (offset, count) into lightIndices per froxel
+layout(std430, binding = 4) readonly buffer ClusterBuffer {
+    uint clusters[];
+};
+
+layout(std430, binding = 5) readonly buffer LightIndexBuffer {
+    uint lightIndices[];
+};
+
+layout(std430, binding = 6) readonly buffer ChunkLightIndexBuffer {
+    uint chunkLightIndices[];
+};
+
+// (offset, count) into chunkLightIndices per chunk
+layout(std430, binding = 7) readonly buffer ChunkLightRangeBuffer {
+    uint chunkLightRanges[];
+};
+
+uniform ivec3 clusterGrid; // Tiles x, tiles y, depth slices
+uniform vec2 tileSize;     // Pixels
+uniform float sliceScale;  // slice = log(depth) * sliceScale + sliceBias
+uniform float sliceBias;
+
+// Defined in terrain_surface.glsl
+vec3 surfaceColor();
+vec3 surfaceNormal();
+vec4 surfaceHorizon();
+float sunVisibility(vec4 horizon);
+
+in vec3 viewPosition;
+flat in uint chunk;
+
+layout(location = 0) out vec4 fragColor;
+
+// Inverse-square falloff windowed to reach zero at radius
+float attenuation(float lightDistance, float radius) {
+    float ratio = lightDistance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / max(lightDistance * lightDistance, 0.01);
+}
+
+void main() {
+    vec3 color = surfaceColor();
+    vec4 horizon = surfaceHorizon();
+
+    vec3 normal = surfaceNormal();
+    vec3 toSun = normalize(gl_LightSource[0].position.xyz);
+    vec3 light = gl_LightModel.ambient.rgb * horizon.a +
+                 gl_LightSource[0].diffuse.rgb * sunVisibility(horizon) *
+                 max(dot(normal, toSun), 0.0);
+
+    ivec3 cluster;
+    cluster.xy = ivec2(gl_FragCoord.xy / tileSize);
+    cluster.z = int(max(log(-viewPosition.z) * sliceScale + sliceBias, 0.0));
+    cluster = min(cluster, clusterGrid - 1);
+    int index = (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x +
+                cluster.x;
+    uint offset = clusters[2 * index];
+    uint count = clusters[2 * index + 1];
+    uint chunkCount = chunkLightRanges[2 * chunk + 1];
+    bool useChunkList = chunkCount < count;
+    if (useChunkList) {
+        offset = chunkLightRanges[2 * chunk];
+        count = chunkCount;
+    }
+
+    for (uint i = 0; i < count; ++i) {
+        uint lightIndex = useChunkList ? chunkLightIndices[offset + i]
+                                       : lightIndices[offset + i];
+        Light pointLight = lights[lightIndex];
+        vec3 toLight = pointLight.positionRange.xyz - viewPosition;
+        float lightDistance = length(toLight);
+        float falloff = attenuation(lightDistance,
+                                    pointLight.positionRange.w);
+        light += pointLight.colorIntensity.rgb * pointLight.colorIntensity.a *
+                 falloff * max(dot(normal, toLight / lightDistance), 0.0);
+    }
+
+    fragColor = vec4(color * light, 1.0);
+}
@@ -0,0 +1,32 @@
+#version 430 compatibility
+
+// Deferred geometry pass: the terrain surface written to the G-buffer for
+// deferred_lighting.glsl. Depth comes from the depth attachment, from
+// which the lighting pass reconstructs the view position.
+
+// Defined in terrain_surface.glsl
+vec3 surfaceColor();
+vec3 surfaceNormal();
+vec4 surfaceHorizon();
+float sunVisibility(vec4 horizon);
+
+layout(location = 0) out vec2 gNormal;    // Octahedral view space normal
+layout(location = 1) out vec4 gAlbedo;    // Surface color, tinted
+layout(location = 2) out vec2 gOcclusion; // Sun visibility, ambient
+
+// Map a unit vector onto the octahedron and unfold it to [-1, 1]^2
+vec2 octahedralEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        return (1.0 - abs(n.yx)) * signs;
+    }
+    return n.xy;
+}
+
+void main() {
+    vec4 horizon = surfaceHorizon();
+    gNormal = octahedralEncode(surfaceNormal());
+    gAlbedo = vec4(surfaceColor(), 1.0);
+    gOcclusion = vec2(sunVisibility(horizon), horizon.a);
+}
@@ -0,0 +1,108 @@
+// terrain_palette.cpp
+// Implements palette file parsing and baking the height color ramp
+
+#include "terrain_palette.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+TerrainPalette::TerrainPalette()
+    : stops({{0.00f, glm::vec3(0.2f, 0.2f, 0.8f)}, // Water
+             {0.09f, glm::vec3(0.2f, 0.2f, 0.8f)},
+             {0.11f, glm::vec3(0.8f, 0.7f, 0.4f)}, // Sand
+             {0.28f, glm::vec3(0.8f, 0.7f, 0.4f)},
+             {0.32f, glm::vec3(0.4f, 0.8f, 0.4f)}, // Grass
+             {0.57f, glm::vec3(0.4f, 0.8f, 0.4f)},
+             {0.63f, glm::vec3(0.5f, 0.5f, 0.5f)}, // Rock
+             {1.00f, glm::vec3(0.5f, 0.5f, 0.5f)}}),
+      snowColor(1.0f), snowHeights(0.78f, 0.82f),
+      rockColor(0.45f, 0.42f, 0.4f), rockSlopes(35.0f, 50.0f) {}
+
+bool TerrainPalette::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open palette: " << path << std::endl;
+    return false;
+  }
+
+  std::vector<Stop> newStops;
+  glm::vec3 newSnowColor = snowColor;
+  glm::vec2 newSnowHeights = snowHeights;
+  glm::vec3 newRockColor = rockColor;
+  glm::vec2 newRockSlopes = rockSlopes;
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line)) {
+    ++lineNumber;
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string kind;
+    if (!(fields >> kind))
+      continue;
+
+    bool valid;
+    if (kind == "stop") {
+      Stop stop;
+      valid = static_cast<bool>(fields >> stop.height >> stop.color.r >>
+                                stop.color.g >> stop.color.b) &&
+              (newStops.empty() || stop.height >= newStops.back().height);
+      if (valid)
+        newStops.push_back(stop);
+    } else if (kind == "snow") {
+      valid = static_cast<bool>(fields >> newSnowColor.r >> newSnowColor.g >>
+                                newSnowColor.b >> newSnowHeights.x >>
+                                newSnowHeights.y);
+    } else if (kind == "rock") {
+      valid = static_cast<bool>(fields >> newRockColor.r >> newRockColor.g >>
+                                newRockColor.b >> newRockSlopes.x >>
+                                newRockSlopes.y);
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      std::cerr << path << ":" << lineNumber << ": invalid palette entry"
+                << std::endl;
+      return false;
+    }
+  }
+  if (newStops.empty()) {
+    std::cerr << path << ": palette has no color stops" << std::endl;
+    return false;
+  }
+
+  stops = newStops;
+  snowColor = newSnowColor;
+  snowHeights = newSnowHeights;
+  rockColor = newRockColor;
+  rockSlopes = newRockSlopes;
+  return true;
+}
+
+std::vector<uint8_t> TerrainPalette::bake() const {
+  std::vector<uint8_t> texels(kTextureSize * 3);
+  size_t next = 0; // First stop above the current texel
+  for (int i = 0; i < kTextureSize; ++i) {
+    float height = i / static_cast<float>(kTextureSize - 1);
+    while (next < stops.size() && stops[next].height <= height)
+      ++next;
+    glm::vec3 color;
+    if (next == 0) {
+      color = stops.front().color;
+    } else if (next == stops.size()) {
+      color = stops.back().color;
+    } else {
+      const Stop &below = stops[next - 1];
+      const Stop &above = stops[next];
+      float t = (height - below.height) / (above.height - below.height);
+      color = glm::mix(below.color, above.color, t);
+    }
+    for (int channel = 0; channel < 3; ++channel) {
+      float value = std::min(std::max(color[channel], 0.0f), 1.0f);
+      texels[i * 3 + channel] =
+          static_cast<uint8_t>(std::lrint(value * 255.0f));
+    }
+  }
+  return texels;
+}
@@ -0,0 +1,57 @@
+// terrain_palette.h
+// Defines the TerrainPalette class describing how the terrain is colored by
+// height and slope in the lit shaders
+
+#ifndef TERRAIN_PALETTE_H
+#define TERRAIN_PALETTE_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Color stops over normalized height (0 at the lowest possible terrain, 1
+// at the highest), baked into a 1D texture the fragment shader indexes by
+// height, plus two blends on top of it: snow fading in between two
+// heights and rock covering slopes between two angles (rock wins on steep
+// snowy slopes).
+//
+// Palette files are text, one entry per line, # starting a comment:
+//   stop <height> <r> <g> <b>
+//   snow <r> <g> <b> <start height> <full height>
+//   rock <r> <g> <b> <start degrees> <full degrees>
+// Colors are 0-1. Stops must be listed by increasing height.
+class TerrainPalette {
+public:
+  static const int kTextureSize = 256;
+
+  struct Stop {
+    float height;
+    glm::vec3 color;
+  };
+
+  // The default water/sand/grass/rock/snow bands
+  TerrainPalette();
+
+  // Replace this palette with the one in a file. Returns false, leaving the
+  // palette unchanged, if the file cannot be read or is malformed.
+  bool load(const std::string &path);
+
+  // kTextureSize RGB8 texels with the stops interpolated linearly
+  std::vector<uint8_t> bake() const;
+
+  const std::vector<Stop> &getStops() const { return stops; }
+  glm::vec3 getSnowColor() const { return snowColor; }
+  glm::vec2 getSnowHeights() const { return snowHeights; }
+  glm::vec3 getRockColor() const { return rockColor; }
+  glm::vec2 getRockSlopes() const { return rockSlopes; } // Degrees
+
+private:
+  std::vector<Stop> stops;
+  glm::vec3 snowColor;
+  glm::vec2 snowHeights;
+  glm::vec3 rockColor;
+  glm::vec2 rockSlopes;
+};
+
+#endif // TERRAIN_PALETTE_H
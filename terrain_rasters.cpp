@@ -0,0 +1,214 @@
+// terrain_rasters.cpp
+// Implements slope, aspect and curvature generation with a 3x3 Horn kernel
+
+#include "terrain_rasters.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float kPi = 3.14159265358979f;
+const float kRadiansToDegrees = 180.0f / kPi;
+
+// Minimax polynomial for atan on [0, 1], max error about 1e-5 radians. The
+// scalar and SSE2 paths share it so edge vertices quantize the same way as
+// interior ones.
+inline float atanPolynomial(float a) {
+  float s = a * a;
+  return a * (0.99997726f +
+              s * (-0.33262347f +
+                   s * (0.19354346f +
+                        s * (-0.11643287f +
+                             s * (0.05265332f + s * -0.01172120f)))));
+}
+
+inline float fastAtan2(float y, float x) {
+  float ax = std::fabs(x);
+  float ay = std::fabs(y);
+  float r = atanPolynomial(std::min(ax, ay) / std::max(std::max(ax, ay),
+                                                       1e-30f));
+  if (ay > ax)
+    r = 0.5f * kPi - r;
+  if (x < 0.0f)
+    r = kPi - r;
+  return y < 0.0f ? -r : r;
+}
+
+#if defined(__SSE2__)
+inline __m128 blend(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 fastAtan2(__m128 y, __m128 x) {
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  __m128 ax = _mm_andnot_ps(signMask, x);
+  __m128 ay = _mm_andnot_ps(signMask, y);
+  __m128 a = _mm_div_ps(_mm_min_ps(ax, ay),
+                        _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+  __m128 s = _mm_mul_ps(a, a);
+  __m128 p = _mm_set1_ps(-0.01172120f);
+  p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.05265332f));
+  p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(-0.11643287f));
+  p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.19354346f));
+  p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(-0.33262347f));
+  p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.99997726f));
+  __m128 r = _mm_mul_ps(a, p);
+
+  r = blend(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(0.5f * kPi), r), r);
+  r = blend(_mm_cmplt_ps(x, _mm_setzero_ps()),
+             _mm_sub_ps(_mm_set1_ps(kPi), r), r);
+  return _mm_or_ps(r, _mm_and_ps(y, signMask));
+}
+#endif
+
+} // namespace
+
+TerrainRasters::TerrainRasters() : gridSize(0) {}
+
+void TerrainRasters::build(const HeightGrid &grid) {
+  gridSize = grid.gridSize;
+  size_t count = static_cast<size_t>(gridSize) * gridSize;
+  slope.assign(count, 0);
+  aspect.assign(count, 0);
+  curvature.assign(count, 0);
+  if (gridSize < 2)
+    return;
+
+  parallelFor(0, gridSize, [&](int zBegin, int zEnd) {
+    for (int z = zBegin; z < zEnd; ++z) {
+      bool interiorRow = z > 0 && z < gridSize - 1;
+      buildVertex(grid, 0, z);
+      int x = 1;
+      if (interiorRow)
+        buildRowSIMD(grid, z, x);
+      for (; x < gridSize; ++x) {
+        buildVertex(grid, x, z);
+      }
+    }
+  });
+}
+
+// Window layout, z growing downwards:
+//   a b c
+//   d e f
+//   g h i
+void TerrainRasters::assign(int gridSize, const uint8_t *slope,
+                            const uint16_t *aspect,
+                            const int16_t *curvature) {
+  this->gridSize = gridSize;
+  size_t count = static_cast<size_t>(gridSize) * gridSize;
+  this->slope.assign(slope, slope + count);
+  this->aspect.assign(aspect, aspect + count);
+  this->curvature.assign(curvature, curvature + count);
+}
+
+void TerrainRasters::buildVertex(const HeightGrid &grid, int x, int z) {
+  int n = grid.gridSize;
+  int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, n - 1);
+  int z0 = std::max(z - 1, 0), z1 = std::min(z + 1, n - 1);
+  const float *top = grid.heights + static_cast<size_t>(z0) * n;
+  const float *mid = grid.heights + static_cast<size_t>(z) * n;
+  const float *bottom = grid.heights + static_cast<size_t>(z1) * n;
+
+  float a = top[x0], b = top[x], c = top[x1];
+  float d = mid[x0], e = mid[x], f = mid[x1];
+  float g = bottom[x0], h = bottom[x], i = bottom[x1];
+
+  float inv8Step = 1.0f / (8.0f * grid.step);
+  float gradX = ((c + 2.0f * f + i) - (a + 2.0f * d + g)) * inv8Step;
+  float gradZ = ((g + 2.0f * h + i) - (a + 2.0f * b + c)) * inv8Step;
+  float laplacian = (d + f + b + h - 4.0f * e) / (grid.step * grid.step);
+
+  float slopeDeg =
+      fastAtan2(std::sqrt(gradX * gradX + gradZ * gradZ), 1.0f) *
+      kRadiansToDegrees;
+  float aspectDeg = fastAtan2(-gradX, gradZ) * kRadiansToDegrees;
+  if (aspectDeg < 0.0f)
+    aspectDeg += 360.0f;
+  float curv = std::min(std::max(-laplacian * kCurvatureScale, -32767.0f),
+                        32767.0f);
+
+  size_t out = cellIndex(x, z);
+  slope[out] = static_cast<uint8_t>(std::lrint(slopeDeg * kSlopeScale));
+  aspect[out] = static_cast<uint16_t>(std::lrint(aspectDeg * kAspectScale));
+  curvature[out] = static_cast<int16_t>(std::lrint(curv));
+}
+
+// Four interior vertices per iteration starting at x, stopping before the
+// last column. Leaves x at the first vertex still to be processed.
+void TerrainRasters::buildRowSIMD(const HeightGrid &grid, int z, int &x) {
+#if defined(__SSE2__)
+  int n = grid.gridSize;
+  const float *top = grid.heights + static_cast<size_t>(z - 1) * n;
+  const float *mid = grid.heights + static_cast<size_t>(z) * n;
+  const float *bottom = grid.heights + static_cast<size_t>(z + 1) * n;
+
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 inv8Step = _mm_set1_ps(1.0f / (8.0f * grid.step));
+  const __m128 negInvStep2 =
+      _mm_set1_ps(-kCurvatureScale / (grid.step * grid.step));
+  const __m128 toSlope = _mm_set1_ps(kRadiansToDegrees * kSlopeScale);
+  const __m128 toAspect = _mm_set1_ps(kRadiansToDegrees * kAspectScale);
+  const __m128 fullTurn = _mm_set1_ps(360.0f * kAspectScale);
+  const __m128 curvLimit = _mm_set1_ps(32767.0f);
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+
+  for (; x + 4 < n; x += 4) {
+    __m128 a = _mm_loadu_ps(top + x - 1), b = _mm_loadu_ps(top + x),
+           c = _mm_loadu_ps(top + x + 1);
+    __m128 d = _mm_loadu_ps(mid + x - 1), e = _mm_loadu_ps(mid + x),
+           f = _mm_loadu_ps(mid + x + 1);
+    __m128 g = _mm_loadu_ps(bottom + x - 1), h = _mm_loadu_ps(bottom + x),
+           i = _mm_loadu_ps(bottom + x + 1);
+
+    __m128 gradX = _mm_mul_ps(
+        _mm_sub_ps(_mm_add_ps(_mm_add_ps(c, _mm_mul_ps(two, f)), i),
+                   _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, d)), g)),
+        inv8Step);
+    __m128 gradZ = _mm_mul_ps(
+        _mm_sub_ps(_mm_add_ps(_mm_add_ps(g, _mm_mul_ps(two, h)), i),
+                   _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, b)), c)),
+        inv8Step);
+    __m128 laplacian = _mm_sub_ps(
+        _mm_add_ps(_mm_add_ps(d, f), _mm_add_ps(b, h)), _mm_mul_ps(four, e));
+
+    __m128 magnitude = _mm_sqrt_ps(
+        _mm_add_ps(_mm_mul_ps(gradX, gradX), _mm_mul_ps(gradZ, gradZ)));
+    __m128 slopeQ = _mm_mul_ps(fastAtan2(magnitude, one), toSlope);
+
+    __m128 aspectQ = _mm_mul_ps(
+        fastAtan2(_mm_xor_ps(gradX, _mm_set1_ps(-0.0f)), gradZ), toAspect);
+    aspectQ = _mm_add_ps(
+        aspectQ, _mm_and_ps(_mm_cmplt_ps(aspectQ, _mm_setzero_ps()), fullTurn));
+
+    __m128 curv = _mm_mul_ps(laplacian, negInvStep2);
+    curv = _mm_min_ps(_mm_max_ps(curv, _mm_sub_ps(_mm_setzero_ps(), curvLimit)),
+                      curvLimit);
+
+    // Narrow to the stored widths. Aspect is biased into the signed range so
+    // the saturating signed pack keeps all 16 bits.
+    __m128i slope16 =
+        _mm_packs_epi32(_mm_cvtps_epi32(slopeQ), _mm_setzero_si128());
+    int slope8 = _mm_cvtsi128_si32(_mm_packus_epi16(slope16, slope16));
+    __m128i aspect16 = _mm_xor_si128(
+        _mm_packs_epi32(_mm_sub_epi32(_mm_cvtps_epi32(aspectQ), bias),
+                        _mm_setzero_si128()),
+        flip);
+    __m128i curv16 =
+        _mm_packs_epi32(_mm_cvtps_epi32(curv), _mm_setzero_si128());
+
+    size_t out = cellIndex(x, z);
+    std::memcpy(&slope[out], &slope8, 4);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&aspect[out]), aspect16);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&curvature[out]), curv16);
+  }
+#endif
+}
@@ -0,0 +1,66 @@
+// terrain_rasters.h
+// Defines the TerrainRasters class holding slope, aspect and curvature
+// derived once from the terrain height grid
+
+#ifndef TERRAIN_RASTERS_H
+#define TERRAIN_RASTERS_H
+
+#include "height_grid.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TerrainRasters {
+public:
+  // Encoding of the compact rasters
+  static constexpr float kSlopeScale = 255.0f / 90.0f;     // degrees -> u8
+  static constexpr float kAspectScale = 65535.0f / 360.0f; // degrees -> u16
+  static constexpr float kCurvatureScale = 100.0f;        // 1/units -> s16
+
+  TerrainRasters();
+
+  // Derive all three rasters with a 3x3 Horn kernel (edges clamp to the
+  // nearest vertex). Rows are split across worker threads in bands and each
+  // band is processed four vertices at a time with SSE2 where available.
+  void build(const HeightGrid &grid);
+
+  // Take rasters a previous build produced, such as a copy in the mesh
+  // cache; each array holds gridSize * gridSize values
+  void assign(int gridSize, const uint8_t *slope, const uint16_t *aspect,
+              const int16_t *curvature);
+
+  bool empty() const { return slope.empty(); }
+  int getGridSize() const { return gridSize; }
+
+  // Slope from horizontal, 0-90 degrees
+  const std::vector<uint8_t> &getSlope() const { return slope; }
+  // Compass direction of steepest descent, 0-360 degrees clockwise from -z
+  // (north); flat vertices report 0
+  const std::vector<uint16_t> &getAspect() const { return aspect; }
+  // Negative Laplacian of height: positive on ridges, negative in valleys
+  const std::vector<int16_t> &getCurvature() const { return curvature; }
+
+  float slopeDegrees(int x, int z) const {
+    return slope[cellIndex(x, z)] / kSlopeScale;
+  }
+  float aspectDegrees(int x, int z) const {
+    return aspect[cellIndex(x, z)] / kAspectScale;
+  }
+  float curvatureAt(int x, int z) const {
+    return curvature[cellIndex(x, z)] / kCurvatureScale;
+  }
+
+private:
+  int gridSize;
+  std::vector<uint8_t> slope;
+  std::vector<uint16_t> aspect;
+  std::vector<int16_t> curvature;
+
+  size_t cellIndex(int x, int z) const {
+    return static_cast<size_t>(z) * gridSize + x;
+  }
+  void buildVertex(const HeightGrid &grid, int x, int z);
+  void buildRowSIMD(const HeightGrid &grid, int z, int &x);
+};
+
+#endif // TERRAIN_RASTERS_H
@@ -0,0 +1,97 @@
+#version 430 compatibility
+
+// Terrain surface terms shared by the forward and G-buffer fragment
+// shaders: the palette color, the normal map and the sun and ambient
+// occlusion from the horizon map or the cascaded shadow maps
+
+uniform bool useViewshed;
+uniform bool useOverlay;
+uniform sampler2D viewshedMap;
+uniform sampler2D overlayMap;
+
+// Height palette (see terrain_palette.h) with snow above a height and rock
+// on slopes, blended in per fragment
+uniform sampler1D paletteMap;
+uniform float paletteHeightScale; // World height to palette coordinate
+uniform vec3 snowColor;
+uniform vec2 snowHeights; // Normalized heights where snow starts and is full
+uniform vec3 rockColor;
+uniform vec2 rockSlopes; // Slope sines where rock starts and is full
+
+const int kCascades = 4;
+uniform bool useShadows;
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[kCascades]; // World to shadow map coordinates
+uniform float cascadeFar[kCascades];    // View depth where each cascade ends
+uniform uint cascadeMask;               // Cascades holding a shadow map
+
+// Horizon sines in RGB (three neighbouring azimuths) and ambient occlusion
+// in A; the sun's horizon is dot(texel.rgb, horizonWeights) in one layer
+uniform bool useHorizon;
+uniform bool useHorizonShadows;
+uniform sampler2DArray horizonMap;
+uniform float horizonLayer;
+uniform vec3 horizonWeights;
+uniform float sunSine; // Sine of the sun's elevation
+
+// World space normal x and z at heightmap resolution; y is reconstructed
+uniform bool useNormalMap;
+uniform sampler2D normalMap;
+uniform vec2 normalScale; // Coordinates are world x/z * normalScale + 0.5
+
+in vec3 worldPosition;
+in vec3 viewPosition;
+in vec3 worldNormal;
+in vec2 gridCoord;
+
+// World space normal from the normal map, else the interpolated vertex
+// normal
+vec3 worldSurfaceNormal() {
+    if (!useNormalMap) return normalize(worldNormal);
+    vec2 n = texture(normalMap, worldPosition.xz * normalScale + 0.5).rg;
+    return vec3(n.x, sqrt(max(1.0 - dot(n, n), 0.0)), n.y);
+}
+
+// Palette, snow and rock color tinted by the viewshed and the raster overlay
+vec3 surfaceColor() {
+    float height = clamp(worldPosition.y * paletteHeightScale, 0.0, 1.0);
+    vec3 color = texture(paletteMap, height).rgb;
+    color = mix(color, snowColor,
+                smoothstep(snowHeights.x, snowHeights.y, height));
+    float normalY = worldSurfaceNormal().y;
+    float slope = sqrt(max(1.0 - normalY * normalY, 0.0));
+    color = mix(color, rockColor,
+                smoothstep(rockSlopes.x, rockSlopes.y, slope));
+    if (useViewshed) color *= texture(viewshedMap, gridCoord).rgb;
+    if (useOverlay) color *= texture(overlayMap, gridCoord).rgb;
+    return color;
+}
+
+// View space surface normal
+vec3 surfaceNormal() {
+    return normalize(gl_NormalMatrix * worldSurfaceNormal());
+}
+
+// Horizon texel of the sun's azimuth; A is the ambient occlusion
+vec4 surfaceHorizon() {
+    if (!useHorizon) return vec4(1.0);
+    return texture(horizonMap, vec3(gridCoord, horizonLayer));
+}
+
+// Fraction of sunlight reaching the fragment: a soft step as the sun
+// clears the horizon, or the first shadow cascade covering its depth
+float sunVisibility(vec4 horizon) {
+    if (useHorizonShadows) {
+        float sine = dot(horizon.rgb, horizonWeights);
+        return smoothstep(sine - 0.03, sine + 0.03, sunSine);
+    }
+    if (!useShadows) return 1.0;
+    float depth = -viewPosition.z;
+    for (int cascade = 0; cascade < kCascades; ++cascade) {
+        if (depth > cascadeFar[cascade]) continue;
+        if ((cascadeMask & (1u << cascade)) == 0u) return 1.0;
+        vec4 coord = shadowMatrices[cascade] * vec4(worldPosition, 1.0);
+        return texture(shadowMap, vec4(coord.xy, float(cascade), coord.z));
+    }
+    return 1.0;
+}
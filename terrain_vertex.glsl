@@ -0,0 +1,25 @@
+#version 430 compatibility
+
+// Lit terrain drawn from the fixed-function vertex arrays (positions are
+// world space, the modelview matrix holds the camera view). The chunk
+// index is an instanced attribute, selected by each draw's base instance.
+
+uniform vec2 gridScaleBias; // World x/z to grid texture coordinates
+
+layout(location = 7) in uint chunkIndex;
+
+out vec3 worldPosition;
+out vec3 viewPosition;
+out vec3 worldNormal;
+out vec2 gridCoord;
+flat out uint chunk;
+
+void main() {
+    worldPosition = gl_Vertex.xyz;
+    vec4 position = gl_ModelViewMatrix * gl_Vertex;
+    viewPosition = position.xyz;
+    worldNormal = gl_Normal;
+    gridCoord = gl_Vertex.xz * gridScaleBias.x + gridScaleBias.y;
+    chunk = chunkIndex;
+    gl_Position = gl_ProjectionMatrix * position;
+}
@@ -0,0 +1,59 @@
+// triple_buffer.h
+// Defines a lock-free single-producer/single-consumer triple buffer
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Three slots shared by one writer and one reader thread. The writer fills
+// its back slot and publishes it by swapping it with the middle slot; the
+// reader takes the newest published slot by swapping its front slot with
+// the middle one. Neither side ever waits for the other: an unread value is
+// replaced by a newer one, and the reader keeps its current slot until
+// something new is published. Slot indices are stable, so callers can tie
+// other per-slot resources to them.
+template <typename T> class TripleBuffer {
+public:
+  static const int kSlots = 3;
+
+  TripleBuffer() : back(0), middle(1), front(2) {}
+
+  // Writer side
+  T &writeSlot() { return slots[back]; }
+  int writeIndex() const { return back; }
+  void publish() {
+    back = middle.exchange(back | kFresh, std::memory_order_acq_rel) &
+           kIndexMask;
+  }
+
+  // True while the last published value has not been taken by the reader
+  bool pending() const {
+    return (middle.load(std::memory_order_acquire) & kFresh) != 0;
+  }
+
+  // Reader side. acquire() returns false, leaving readSlot() unchanged,
+  // when nothing new has been published since the last call.
+  bool acquire() {
+    if ((middle.load(std::memory_order_relaxed) & kFresh) == 0)
+      return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+  const T &readSlot() const { return slots[front]; }
+  int readIndex() const { return front; }
+
+private:
+  static const int kFresh = 4; // Set in middle when it holds a new value
+  static const int kIndexMask = 3;
+
+  T slots[kSlots];
+  int back;
+  std::atomic<int> middle;
+  int front;
+
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,132 @@
+// viewshed.cpp
+// Implements the multithreaded horizon-sweep viewshed
+
+#include "viewshed.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+Viewshed::Viewshed() : gridSize(0) {}
+
+int Viewshed::getVisibleCount() const {
+  int count = 0;
+  for (uint64_t word : mask) {
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
+
+// Walk from the observer towards a perimeter vertex one major-axis step at a
+// time, marking each vertex whose slope reaches the running horizon
+void Viewshed::traceRay(const HeightGrid &grid, int observerX, int observerZ,
+                        float eyeHeight, int targetX, int targetZ,
+                        uint64_t *bits) {
+  int dx = targetX - observerX;
+  int dz = targetZ - observerZ;
+  int steps = std::max(std::abs(dx), std::abs(dz));
+  if (steps == 0)
+    return;
+
+  bool xMajor = std::abs(dx) >= std::abs(dz);
+  float stepDistance =
+      std::sqrt(static_cast<float>(dx * dx + dz * dz)) / steps * grid.step;
+  float horizon = -std::numeric_limits<float>::max();
+
+  for (int i = 1; i <= steps; ++i) {
+    float t = static_cast<float>(i) / steps;
+    float fx = observerX + dx * t;
+    float fz = observerZ + dz * t;
+
+    // Interpolate across the minor axis for the horizon height
+    float height;
+    if (xMajor) {
+      int x = observerX + (dx > 0 ? i : -i);
+      int z0 = static_cast<int>(std::floor(fz));
+      int z1 = std::min(z0 + 1, grid.gridSize - 1);
+      float w = fz - z0;
+      height = grid.heights[static_cast<size_t>(z0) * grid.gridSize + x] *
+                   (1.0f - w) +
+               grid.heights[static_cast<size_t>(z1) * grid.gridSize + x] * w;
+    } else {
+      int z = observerZ + (dz > 0 ? i : -i);
+      int x0 = static_cast<int>(std::floor(fx));
+      int x1 = std::min(x0 + 1, grid.gridSize - 1);
+      float w = fx - x0;
+      const float *row = grid.heights + static_cast<size_t>(z) * grid.gridSize;
+      height = row[x0] * (1.0f - w) + row[x1] * w;
+    }
+
+    // The vertex nearest the ray is visible if it reaches the horizon
+    int cellX = static_cast<int>(fx + 0.5f);
+    int cellZ = static_cast<int>(fz + 0.5f);
+    size_t index = static_cast<size_t>(cellZ) * grid.gridSize + cellX;
+    float distance = stepDistance * i;
+    float cellSlope = (grid.heights[index] - eyeHeight) / distance;
+    if (cellSlope >= horizon) {
+      bits[index >> 6] |= uint64_t(1) << (index & 63);
+    }
+
+    horizon = std::max(horizon, (height - eyeHeight) / distance);
+  }
+}
+
+void Viewshed::compute(const HeightGrid &grid, int observerX, int observerZ,
+                       float observerHeight) {
+  gridSize = grid.gridSize;
+  size_t vertexCount = static_cast<size_t>(gridSize) * gridSize;
+  size_t words = (vertexCount + 63) / 64;
+  mask.assign(words, 0);
+  if (gridSize < 2)
+    return;
+
+  observerX = std::min(std::max(observerX, 0), gridSize - 1);
+  observerZ = std::min(std::max(observerZ, 0), gridSize - 1);
+  size_t observerIndex = static_cast<size_t>(observerZ) * gridSize + observerX;
+  float eyeHeight = grid.heights[observerIndex] + observerHeight;
+
+  // Perimeter vertices in order around the grid, so contiguous ranges are
+  // angular sectors as seen from the observer
+  int side = gridSize - 1;
+  int perimeter = 4 * side;
+  auto perimeterVertex = [side](int i, int &x, int &z) {
+    if (i < side) {
+      x = i, z = 0;
+    } else if (i < 2 * side) {
+      x = side, z = i - side;
+    } else if (i < 3 * side) {
+      x = 3 * side - i, z = side;
+    } else {
+      x = 0, z = 4 * side - i;
+    }
+  };
+
+  // Each sector writes its own bitmask, merged below
+  int sectors = std::min(workerCount(), perimeter);
+  std::vector<std::vector<uint64_t>> sectorMasks(sectors);
+  int sectorSize = (perimeter + sectors - 1) / sectors;
+  parallelFor(0, sectors, [&](int begin, int end) {
+    for (int s = begin; s < end; ++s) {
+      std::vector<uint64_t> &bits = sectorMasks[s];
+      bits.assign(words, 0);
+      int first = s * sectorSize;
+      int last = std::min(perimeter, first + sectorSize);
+      for (int i = first; i < last; ++i) {
+        int x, z;
+        perimeterVertex(i, x, z);
+        traceRay(grid, observerX, observerZ, eyeHeight, x, z, bits.data());
+      }
+    }
+  });
+
+  parallelFor(0, static_cast<int>(words), [&](int begin, int end) {
+    for (int w = begin; w < end; ++w) {
+      uint64_t merged = 0;
+      for (const auto &bits : sectorMasks) {
+        merged |= bits[w];
+      }
+      mask[w] = merged;
+    }
+  });
+  mask[observerIndex >> 6] |= uint64_t(1) << (observerIndex & 63);
+}
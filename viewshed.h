@@ -0,0 +1,54 @@
+// viewshed.h
+// Defines the Viewshed class, which computes which grid vertices are visible
+// from an observer standing on the terrain
+
+#ifndef VIEWSHED_H
+#define VIEWSHED_H
+
+#include "height_grid.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Viewshed {
+public:
+  Viewshed();
+
+  // Compute visibility from grid vertex (observerX, observerZ) with the eye
+  // observerHeight above the ground. Rays are swept from the observer to
+  // every perimeter vertex, tracking the horizon slope along each one with
+  // heights interpolated across the minor axis (R2 sweep with R3-style
+  // interpolation). Perimeter sectors are split across worker threads.
+  //
+  // This trades accuracy for cost: O(n^2) ray steps where exact R3 line of
+  // sight to every vertex takes O(n^3). Each vertex is judged by the ray
+  // passing nearest it rather than by its own line of sight, so the result
+  // is approximate, most of all near the observer. Against exact R3 on
+  // World_elevation_map.png at the 200 x 200 grid (25 observers, eyes 0.5
+  // to 5 units up), 1.4% of vertices disagree: 1.3% wrongly visible and
+  // 0.1% wrongly hidden, about 7% of the visible area. Within 10 cells of
+  // the observer 2.6% disagree.
+  void compute(const HeightGrid &grid, int observerX, int observerZ,
+               float observerHeight);
+
+  bool empty() const { return mask.empty(); }
+  int getGridSize() const { return gridSize; }
+  int getVisibleCount() const;
+  bool isVisible(int x, int z) const {
+    size_t i = static_cast<size_t>(z) * gridSize + x;
+    return (mask[i >> 6] >> (i & 63)) & 1;
+  }
+
+  // One bit per grid vertex, row-major
+  const std::vector<uint64_t> &getMask() const { return mask; }
+
+private:
+  int gridSize;
+  std::vector<uint64_t> mask;
+
+  static void traceRay(const HeightGrid &grid, int observerX, int observerZ,
+                       float eyeHeight, int targetX, int targetZ,
+                       uint64_t *bits);
+};
+
+#endif // VIEWSHED_H